@@ -10,11 +10,8 @@ layout (location = 1) in vec2 att_tex_coords;
 layout (location = 2) in vec3 att_normal;
 layout (location = 3) in vec3 att_tangent;
 layout (location = 4) in vec3 att_bitangent;
-
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform mat4 light_space;
+// Per instance, takes locations 5 to 8.
+layout (location = 5) in mat4 att_model;
 
 out VS_OUT
 {
@@ -22,24 +19,25 @@ out VS_OUT
 	vec2 frag_tex_coords;
 	mat3 TBN;
 	vec3 frag_normal; // @Temporary
-	vec4 frag_pos_light_space;
 } vs_out;
 
+// Same depth as depth_prepass.glsl, for the GL_EQUAL test after the pre-pass.
+invariant gl_Position;
+
 void
 main()
 {
     vs_out.frag_tex_coords = att_tex_coords;
-    vs_out.frag_world_pos = vec3(model * vec4(att_position, 1.0f));
-    vs_out.frag_normal = mat3(transpose(inverse(model))) * att_normal;
-	vs_out.frag_pos_light_space = light_space * vec4(vs_out.frag_world_pos, 1.0f);
+    vs_out.frag_world_pos = vec3(att_model * vec4(att_position, 1.0f));
+    vs_out.frag_normal = mat3(transpose(inverse(att_model))) * att_normal;
 
-	vec3 T = normalize(vec3(model * vec4(att_tangent,   0.0)));
-	vec3 B = normalize(vec3(model * vec4(att_bitangent, 0.0)));
+	vec3 T = normalize(vec3(att_model * vec4(att_tangent,   0.0)));
+	vec3 B = normalize(vec3(att_model * vec4(att_bitangent, 0.0)));
 	vec3 N = normalize(vs_out.frag_normal);
 
 	vs_out.TBN = mat3(T, B, N);
 
-    gl_Position = projection * view * model * vec4(att_position, 1.0f);
+    gl_Position = projection * view * att_model * vec4(att_position, 1.0f);
 }
 
 #endif
@@ -57,34 +55,11 @@ in VS_OUT
 	vec2 frag_tex_coords;
 	mat3 TBN;
 	vec3 frag_normal;
-	vec4 frag_pos_light_space;
 } vs_out;
 
 layout (location = 0) out vec4 frag_color;
 layout (location = 1) out vec4 bright_color;
 
-const int NUM_POINT_LIGHTS = 1;
-
-struct PointLight
-{
-    vec3  position;
-    vec3  ambient;
-    vec3  diffuse;
-    vec3  specular;
-
-    float constant;
-    float linear;
-    float quadratic;
-};
-
-struct DirectionalLight
-{
-	vec3  direction;
-	vec3  ambient;
-	vec3  diffuse;
-	vec3  specular;
-};
-
 struct Material
 {
     float      shininess;
@@ -95,27 +70,57 @@ struct Material
 	bool       use_normal_map;
 };
 
-uniform vec3 view_position;
-uniform PointLight point_lights[NUM_POINT_LIGHTS];
-uniform DirectionalLight dir_light;
 uniform Material material;
-uniform mat4 model;
-uniform float bloom_threshold = 1.0;
 
-uniform sampler2D texture_shadow_map;
+uniform sampler2DArray texture_shadow_map;
+
+// Point lights binned in clusters, see light_clusters.hpp.
+uniform samplerBuffer  light_data;
+uniform usamplerBuffer cluster_grid;
+uniform usamplerBuffer light_indices;
 
-struct DebugGuiState
+PointLight
+fetch_point_light(int index)
 {
-	bool enable_normal_mapping;
-	float pcf_texel_offset;
-	int pcf_window_side;
-};
+	vec4 position_radius    = texelFetch(light_data, 4*index + 0);
+	vec4 ambient_constant   = texelFetch(light_data, 4*index + 1);
+	vec4 diffuse_linear     = texelFetch(light_data, 4*index + 2);
+	vec4 specular_quadratic = texelFetch(light_data, 4*index + 3);
+
+	PointLight light;
+	light.position  = position_radius.xyz;
+	light.ambient   = ambient_constant.xyz;
+	light.diffuse   = diffuse_linear.xyz;
+	light.specular  = specular_quadratic.xyz;
+	light.constant  = ambient_constant.w;
+	light.linear    = diffuse_linear.w;
+	light.quadratic = specular_quadratic.w;
+	return light;
+}
+
+int
+cluster_index(float depth)
+{
+	int slice = int(floor(log(depth) * cluster_depth_scale + cluster_depth_bias));
+	slice = clamp(slice, 0, int(cluster_grid.z) - 1);
+
+	ivec2 tile = ivec2(gl_FragCoord.xy / screen_size * vec2(cluster_grid.xy));
+	tile = clamp(tile, ivec2(0), ivec2(cluster_grid.xy) - 1);
 
-uniform DebugGuiState debug_gui_state;
+	return (slice*int(cluster_grid.y) + tile.y)*int(cluster_grid.x) + tile.x;
+}
 
 float
-shadow_calculation(vec4 pos_light_space, vec3 surface_normal, vec3 light_dir, DebugGuiState state)
+shadow_calculation(vec3 world_pos, float view_depth, DebugGuiState state)
 {
+	// The first cascade that reaches the fragment, past the last one there are no shadows.
+	int cascade = 0;
+	while (cascade < num_shadow_cascades && view_depth > cascade_splits[cascade])
+		cascade++;
+	if (cascade == num_shadow_cascades)
+		return 0.0;
+	vec4 pos_light_space = light_space[cascade] * vec4(world_pos, 1.0);
+
 	// TODO: Maybe expose this variables to the debug GUI
 	const int mipmap_lvl = 0;
 	float texel_offset = state.pcf_texel_offset;
@@ -134,12 +139,13 @@ shadow_calculation(vec4 pos_light_space, vec3 surface_normal, vec3 light_dir, De
 	// Implement Percentage-Closer Filtering
 	float frag_depth = projection_coords.z;
 	float shadow = 0.0;
-	vec2 texel_size = texel_offset / textureSize(texture_shadow_map, mipmap_lvl);
+	vec2 texel_size = texel_offset / textureSize(texture_shadow_map, mipmap_lvl).xy;
 	// Get depth values for a 3x3 neighborhood, then average by 9 (number of neighbors)
 	for (int y = -offset_xy; y <= offset_xy; y++)
 		for (int x = -offset_xy; x <= offset_xy; x++)
 		{
-			float depth = texture(texture_shadow_map, projection_coords.xy + vec2(x, y)*texel_size).r;
+			vec2 uv = projection_coords.xy + vec2(x, y)*texel_size;
+			float depth = texture(texture_shadow_map, vec3(uv, cascade)).r;
 			shadow += float(frag_depth > depth);
 		}
 	shadow /= num_sampled_texels;
@@ -147,7 +153,7 @@ shadow_calculation(vec4 pos_light_space, vec3 surface_normal, vec3 light_dir, De
 }
 
 vec3
-calc_directional_light(DirectionalLight dir_light, vec3 normal, vec3 surface_normal, vec4 frag_pos_light_space)
+calc_directional_light(DirectionalLight dir_light, vec3 normal, vec3 surface_normal, float view_depth)
 {
     vec3 diffuse_color = vec3(texture(material.texture_diffuse1, vs_out.frag_tex_coords));
     vec3 specular_color = vec3(texture(material.texture_specular1, vs_out.frag_tex_coords));
@@ -169,7 +175,7 @@ calc_directional_light(DirectionalLight dir_light, vec3 normal, vec3 surface_nor
 		evaluate_normal_map;
     vec3 specular = dir_light.specular * (specular_strength * specular_color);
 
-	float shadow = shadow_calculation(frag_pos_light_space, surface_normal, dir_light.direction, debug_gui_state);
+	float shadow = shadow_calculation(vs_out.frag_world_pos, view_depth, debug_gui_state);
 	// float shadow = 0;
     return (ambient + (diffuse + specular)*(1-shadow));
 }
@@ -180,12 +186,12 @@ calc_point_light(PointLight light, vec3 normal, vec3 surface_normal)
     vec3 diffuse_color = vec3(texture(material.texture_diffuse1, vs_out.frag_tex_coords));
     vec3 specular_color = vec3(texture(material.texture_specular1, vs_out.frag_tex_coords));
 
+    float dist = length(light.position - vs_out.frag_world_pos);
     vec3 frag_to_light = normalize(light.position - vs_out.frag_world_pos);
 
     vec3 frag_to_view = normalize(view_position - vs_out.frag_world_pos);
     vec3 halfway_dir = normalize(frag_to_light + frag_to_view);
 
-    float dist = length(frag_to_light);
     float attenuation = 1.0 / (light.constant + light.linear*dist + light.quadratic*pow(dist, 2));
 
     vec3 ambient = light.ambient * diffuse_color * vec3(0.04f);
@@ -225,11 +231,17 @@ main()
 
     vec3 light_contributions = vec3(0);
 	vec3 surface_normal = vs_out.frag_normal;
+	float view_depth = -(view * vec4(vs_out.frag_world_pos, 1.0)).z;
 
-    for (int i = 0; i < NUM_POINT_LIGHTS; ++i)
-        light_contributions += calc_point_light(point_lights[i], normal, surface_normal);
+	// Only the lights whose range touches the cluster of the fragment.
+	uvec2 cluster = texelFetch(cluster_grid, cluster_index(view_depth)).xy;
+    for (uint i = 0u; i < cluster.y; ++i)
+	{
+		int light_index = int(texelFetch(light_indices, int(cluster.x + i)).r);
+        light_contributions += calc_point_light(fetch_point_light(light_index), normal, surface_normal);
+	}
 
-	light_contributions += calc_directional_light(dir_light, normal, surface_normal, vs_out.frag_pos_light_space);
+	light_contributions += calc_directional_light(dir_light, normal, surface_normal, view_depth);
 
     frag_color = vec4(light_contributions, 1.0f);
 
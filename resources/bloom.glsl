@@ -30,34 +30,64 @@ out vec4 frag_color;
 
 in vec2 tex_coords;
 
+// Level above (down sampling) or below (up sampling) the one being drawn.
 uniform sampler2D texture_image;
 
-uniform bool horizontal;
-uniform float weight[5] = float[] (0.227027, 0.1945946, 0.1216216, 0.054054, 0.016216);
+uniform bool upsample;
+// Keeps only the texels above the bloom threshold, when down sampling the scene itself.
+uniform bool extract_bright = false;
+
+vec3
+sample_image(vec2 uv)
+{
+	vec3 color = texture(texture_image, uv).rgb;
+	if (extract_bright && dot(color, vec3(0.2126, 0.7152, 0.0722)) <= bloom_threshold)
+		return vec3(0.0);
+	return color;
+}
+
+// 13 taps spread over 4x4 source texels, five overlapping boxes weighted so the result
+// doesn't flicker with small bright spots.
+vec3
+downsample(vec2 uv, vec2 texel)
+{
+	vec3 a = sample_image(uv + texel*vec2(-2,  2));
+	vec3 b = sample_image(uv + texel*vec2( 0,  2));
+	vec3 c = sample_image(uv + texel*vec2( 2,  2));
+	vec3 d = sample_image(uv + texel*vec2(-2,  0));
+	vec3 e = sample_image(uv);
+	vec3 f = sample_image(uv + texel*vec2( 2,  0));
+	vec3 g = sample_image(uv + texel*vec2(-2, -2));
+	vec3 h = sample_image(uv + texel*vec2( 0, -2));
+	vec3 i = sample_image(uv + texel*vec2( 2, -2));
+	vec3 j = sample_image(uv + texel*vec2(-1,  1));
+	vec3 k = sample_image(uv + texel*vec2( 1,  1));
+	vec3 l = sample_image(uv + texel*vec2(-1, -1));
+	vec3 m = sample_image(uv + texel*vec2( 1, -1));
+
+	return e*0.125 + (a + c + g + i)*0.03125 + (b + d + f + h)*0.0625 + (j + k + l + m)*0.125;
+}
+
+// 3x3 tent filter.
+vec3
+upsample_tent(vec2 uv, vec2 texel)
+{
+	vec3 result = sample_image(uv) * 4.0;
+	result += (sample_image(uv + texel*vec2( 0,  1)) + sample_image(uv + texel*vec2( 0, -1))
+			 + sample_image(uv + texel*vec2( 1,  0)) + sample_image(uv + texel*vec2(-1,  0))) * 2.0;
+	result += sample_image(uv + texel*vec2( 1,  1)) + sample_image(uv + texel*vec2(-1,  1))
+			+ sample_image(uv + texel*vec2( 1, -1)) + sample_image(uv + texel*vec2(-1, -1));
+	return result / 16.0;
+}
 
 void
 main()
 {
-	vec2 tex_offset = 1.0 / textureSize(texture_image, 0);
-	vec3 result = texture(texture_image, tex_coords).rgb * weight[0];
-
-	if (horizontal)
-	{
-		for (int i = 1; i < 5; i++)
-		{
-			result += texture(texture_image, tex_coords + vec2(tex_offset.x * i, 0.0)).rgb * weight[i];
-			result += texture(texture_image, tex_coords - vec2(tex_offset.x * i, 0.0)).rgb * weight[i];
-		}
-	}
+	vec2 texel = 1.0 / textureSize(texture_image, 0);
+	if (upsample)
+		frag_color = vec4(upsample_tent(tex_coords, texel), 1.0);
 	else
-	{
-		for (int i = 1; i < 5; i++)
-		{
-			result += texture(texture_image, tex_coords + vec2(0.0, tex_offset.y * i)).rgb * weight[i];
-			result += texture(texture_image, tex_coords - vec2(0.0, tex_offset.y * i)).rgb * weight[i];
-		}
-	}
-	frag_color = vec4(result, 1.0);
+		frag_color = vec4(downsample(tex_coords, texel), 1.0);
 }
 
 #endif
@@ -0,0 +1,194 @@
+/* ====================================
+ *
+ *   Vertex Shader
+ *
+ * ==================================== */
+#ifdef COMPILING_VERTEX
+
+layout (location = 0) in vec3 att_position;
+// Model matrix of the light volume, one instance per point light.
+layout (location = 5) in mat4 att_model;
+
+// Draws the light volumes of the point lights when set, a full screen quad lit by the
+// directional light otherwise.
+uniform bool point_lights;
+
+flat out int light_index;
+
+void
+main()
+{
+	if (point_lights)
+	{
+		light_index = gl_InstanceID;
+		gl_Position = projection * view * att_model * vec4(att_position, 1.0f);
+	}
+	else
+	{
+		light_index = -1;
+		gl_Position = vec4(att_position, 1.0f);
+	}
+}
+
+#endif
+
+/* ====================================
+ *
+ *   Fragment Shader
+ *
+ * ==================================== */
+#ifdef COMPILING_FRAGMENT
+
+flat in int light_index;
+
+layout (location = 0) out vec4 frag_color;
+
+// See GBufferTarget in application.hpp.
+uniform sampler2D texture_albedo_specular;
+uniform sampler2D texture_normals;
+uniform sampler2D texture_shininess;
+uniform sampler2D texture_depth;
+
+uniform sampler2DArray texture_shadow_map;
+uniform samplerBuffer light_data;
+
+struct Surface
+{
+	vec3  position;
+	vec3  normal;
+	vec3  surface_normal;
+	vec3  diffuse_color;
+	vec3  specular_color;
+	float shininess;
+};
+
+vec3
+decode_octahedral(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
+PointLight
+fetch_point_light(int index)
+{
+	vec4 position_radius    = texelFetch(light_data, 4*index + 0);
+	vec4 ambient_constant   = texelFetch(light_data, 4*index + 1);
+	vec4 diffuse_linear     = texelFetch(light_data, 4*index + 2);
+	vec4 specular_quadratic = texelFetch(light_data, 4*index + 3);
+
+	PointLight light;
+	light.position  = position_radius.xyz;
+	light.ambient   = ambient_constant.xyz;
+	light.diffuse   = diffuse_linear.xyz;
+	light.specular  = specular_quadratic.xyz;
+	light.constant  = ambient_constant.w;
+	light.linear    = diffuse_linear.w;
+	light.quadratic = specular_quadratic.w;
+	return light;
+}
+
+float
+shadow_calculation(vec3 world_pos, float view_depth, DebugGuiState state)
+{
+	int cascade = 0;
+	while (cascade < num_shadow_cascades && view_depth > cascade_splits[cascade])
+		cascade++;
+	if (cascade == num_shadow_cascades)
+		return 0.0;
+	vec4 pos_light_space = light_space[cascade] * vec4(world_pos, 1.0);
+
+	const int mipmap_lvl = 0;
+	float texel_offset = state.pcf_texel_offset;
+	int window_side = state.pcf_window_side;
+	int num_sampled_texels = window_side*window_side;
+	int offset_xy = window_side/2;
+
+	vec3 projection_coords = pos_light_space.xyz / pos_light_space.w;
+	projection_coords = projection_coords * 0.5 + 0.5;
+
+	if (projection_coords.z > 1.0)
+		return 0.0;
+
+	float frag_depth = projection_coords.z;
+	float shadow = 0.0;
+	vec2 texel_size = texel_offset / textureSize(texture_shadow_map, mipmap_lvl).xy;
+	for (int y = -offset_xy; y <= offset_xy; y++)
+		for (int x = -offset_xy; x <= offset_xy; x++)
+		{
+			vec2 uv = projection_coords.xy + vec2(x, y)*texel_size;
+			float depth = texture(texture_shadow_map, vec3(uv, cascade)).r;
+			shadow += float(frag_depth > depth);
+		}
+	shadow /= num_sampled_texels;
+	return shadow;
+}
+
+// Same shading as basic.glsl, evaluated once per visible pixel.
+vec3
+shade(Surface s, vec3 frag_to_light, vec3 ambient_light, vec3 diffuse_light, vec3 specular_light, float shadow)
+{
+	vec3 frag_to_view = normalize(view_position - s.position);
+	vec3 halfway_dir = normalize(frag_to_light + frag_to_view);
+
+	vec3 ambient = ambient_light * s.diffuse_color * vec3(0.04f);
+
+	// The normal from the normal map may face the light even if the surface doesn't.
+	float evaluate_normal_map = ceil(dot(s.surface_normal, frag_to_light));
+
+	float diffuse_strength = max(0.0f, dot(frag_to_light, s.normal)) * evaluate_normal_map;
+	vec3 diffuse = diffuse_light * diffuse_strength * s.diffuse_color;
+
+	float specular_strength = pow(max(0.0f, dot(halfway_dir, s.normal)), s.shininess) * evaluate_normal_map;
+	vec3 specular = specular_light * (specular_strength * s.specular_color);
+
+	return ambient + (diffuse + specular)*(1 - shadow);
+}
+
+void
+main()
+{
+	ivec2 texel = ivec2(gl_FragCoord.xy);
+	float depth = texelFetch(texture_depth, texel, 0).r;
+	// Nothing was drawn here, the skybox fills it later.
+	if (depth == 1.0)
+		discard;
+
+	vec4 ndc = vec4(gl_FragCoord.xy / screen_size * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+	vec4 world = inv_view_projection * ndc;
+
+	vec4 albedo_specular = texelFetch(texture_albedo_specular, texel, 0);
+	vec4 normals = texelFetch(texture_normals, texel, 0);
+
+	Surface s;
+	s.position = world.xyz / world.w;
+	s.normal = decode_octahedral(normals.xy);
+	s.surface_normal = decode_octahedral(normals.zw);
+	s.diffuse_color = albedo_specular.rgb;
+	s.specular_color = vec3(albedo_specular.a);
+	s.shininess = texelFetch(texture_shininess, texel, 0).r * 256.0;
+
+	vec3 color;
+	if (light_index < 0)
+	{
+		float view_depth = -(view * vec4(s.position, 1.0)).z;
+		float shadow = shadow_calculation(s.position, view_depth, debug_gui_state);
+		color = shade(s, -dir_light.direction, dir_light.ambient, dir_light.diffuse, dir_light.specular, shadow);
+	}
+	else
+	{
+		PointLight light = fetch_point_light(light_index);
+		float dist = length(light.position - s.position);
+		float attenuation = 1.0 / (light.constant + light.linear*dist + light.quadratic*pow(dist, 2));
+
+		color = attenuation * shade(s, normalize(light.position - s.position),
+									light.ambient, light.diffuse, light.specular, 0.0);
+	}
+
+	frag_color = vec4(color, 1.0);
+}
+
+#endif
@@ -0,0 +1,43 @@
+/* ====================================
+ *
+ *   Vertex Shader
+ *
+ * ==================================== */
+#ifdef COMPILING_VERTEX
+
+layout (location = 0) in vec3 att_position;
+// Per instance, takes locations 5 to 8.
+layout (location = 5) in mat4 att_model;
+
+// Must match the depth of basic.glsl exactly, the color pass tests with GL_EQUAL.
+invariant gl_Position;
+
+void
+main()
+{
+    gl_Position = projection * view * att_model * vec4(att_position, 1.0f);
+}
+
+#endif
+
+/* ====================================
+ *
+ *   Fragment Shader
+ *
+ * ==================================== */
+#ifdef COMPILING_FRAGMENT
+
+#ifdef COUNT_OVERDRAW
+layout (location = 0) out vec4 frag_color;
+#endif
+
+void
+main()
+{
+#ifdef COUNT_OVERDRAW
+	// Added up with blending, one per fragment.
+	frag_color = vec4(1.0, 0.0, 0.0, 1.0);
+#endif
+}
+
+#endif
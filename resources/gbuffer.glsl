@@ -0,0 +1,98 @@
+/* ====================================
+ *
+ *   Vertex Shader
+ *
+ * ==================================== */
+#ifdef COMPILING_VERTEX
+
+layout (location = 0) in vec3 att_position;
+layout (location = 1) in vec2 att_tex_coords;
+layout (location = 2) in vec3 att_normal;
+layout (location = 3) in vec3 att_tangent;
+layout (location = 4) in vec3 att_bitangent;
+// Per instance, takes locations 5 to 8.
+layout (location = 5) in mat4 att_model;
+
+out VS_OUT
+{
+	vec2 frag_tex_coords;
+	mat3 TBN;
+	vec3 frag_normal;
+} vs_out;
+
+void
+main()
+{
+	vs_out.frag_tex_coords = att_tex_coords;
+	vs_out.frag_normal = mat3(transpose(inverse(att_model))) * att_normal;
+
+	vec3 T = normalize(vec3(att_model * vec4(att_tangent,   0.0)));
+	vec3 B = normalize(vec3(att_model * vec4(att_bitangent, 0.0)));
+	vec3 N = normalize(vs_out.frag_normal);
+
+	vs_out.TBN = mat3(T, B, N);
+
+	gl_Position = projection * view * att_model * vec4(att_position, 1.0f);
+}
+
+#endif
+
+/* ====================================
+ *
+ *   Fragment Shader
+ *
+ * ==================================== */
+#ifdef COMPILING_FRAGMENT
+
+in VS_OUT
+{
+	vec2 frag_tex_coords;
+	mat3 TBN;
+	vec3 frag_normal;
+} vs_out;
+
+// See GBufferTarget in application.hpp.
+layout (location = 0) out vec4  albedo_specular;
+layout (location = 1) out vec4  normals;
+layout (location = 2) out float shininess;
+
+struct Material
+{
+	float      shininess;
+	sampler2D  texture_diffuse1;
+	sampler2D  texture_specular1;
+	sampler2D  texture_normal1;
+	bool       use_normal_map;
+};
+
+uniform Material material;
+
+// Maps the unit sphere to the [-1, 1] square, folding the lower hemisphere over the corners.
+vec2
+encode_octahedral(vec3 n)
+{
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	if (n.z < 0.0)
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return n.xy;
+}
+
+void
+main()
+{
+	vec3 surface_normal = normalize(vs_out.frag_normal);
+	vec3 normal = surface_normal;
+	if (debug_gui_state.enable_normal_mapping && material.use_normal_map)
+	{
+		normal = texture(material.texture_normal1, vs_out.frag_tex_coords).rgb;
+		normal = normalize(normal * 2 - 1.0); // map to range [-1, 1]
+		normal = normalize(vs_out.TBN * normal);
+	}
+
+	albedo_specular.rgb = texture(material.texture_diffuse1, vs_out.frag_tex_coords).rgb;
+	albedo_specular.a = texture(material.texture_specular1, vs_out.frag_tex_coords).r;
+	normals = vec4(encode_octahedral(normal), encode_octahedral(surface_normal));
+	shininess = material.shininess / 256.0;
+}
+
+#endif
@@ -8,8 +8,6 @@
 layout (location = 0) in vec3 position;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 
 void main()
 {
@@ -29,7 +27,6 @@ layout (location = 0) out vec4 frag_color;
 layout (location = 1) out vec4 bright_color;
 
 uniform vec3 light_color = vec3(1);
-uniform float bloom_threshold = 1.0;
 
 void
 main()
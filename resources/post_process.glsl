@@ -0,0 +1,95 @@
+/* ====================================
+ *
+ *   Vertex Shader
+ *
+ * ==================================== */
+#ifdef COMPILING_VERTEX
+
+layout (location = 0) in vec3 att_position;
+layout (location = 1) in vec2 att_tex_coords;
+
+out vec2 tex_coords;
+
+void
+main()
+{
+    tex_coords = att_tex_coords;
+    gl_Position = vec4(att_position, 1.0f);
+}
+
+#endif
+
+/* ====================================
+ *
+ *   Fragment Shader
+ *
+ * ==================================== */
+#ifdef COMPILING_FRAGMENT
+
+out vec4 frag_color;
+
+in vec2 tex_coords;
+
+// Stages are enabled by the defines the program is compiled with, see post_process.hpp.
+uniform sampler2D texture_scene;
+uniform sampler2D texture_bloom;
+
+uniform float exposure = 1.0;
+uniform float bloom_strength = 1.0;
+uniform float contrast = 1.0;
+uniform float saturation = 1.0;
+uniform vec3 color_filter = vec3(1.0);
+uniform float vignette_intensity = 0.5;
+uniform float vignette_radius = 0.5;
+
+#ifdef OVERDRAW_HEAT_MAP
+// Black for no fragments, then blue, cyan, green, yellow and red for 5, white past that.
+const vec3 heat_map[7] = vec3[](vec3(0.0), vec3(0.0, 0.0, 1.0), vec3(0.0, 1.0, 1.0), vec3(0.0, 1.0, 0.0),
+								vec3(1.0, 1.0, 0.0), vec3(1.0, 0.0, 0.0), vec3(1.0));
+
+void
+main()
+{
+	int count = int(texture(texture_scene, tex_coords).r + 0.5);
+	frag_color = vec4(heat_map[min(count, 6)], 1.0);
+}
+#else
+void
+main()
+{
+#ifdef BLOOM_ONLY
+	vec3 result = texture(texture_bloom, tex_coords).rgb * bloom_strength;
+#else
+	vec3 result = texture(texture_scene, tex_coords).rgb;
+#ifdef BLOOM
+	result += texture(texture_bloom, tex_coords).rgb * bloom_strength;
+#endif
+#endif
+
+#ifdef TONE_MAPPING
+	result = vec3(1.0) - exp(-result * exposure);
+#endif
+
+#ifdef COLOR_GRADING
+	// Graded in display range, around middle gray.
+	result *= color_filter;
+	result = max((result - 0.5) * contrast + 0.5, 0.0);
+	float luminance = dot(result, vec3(0.2126, 0.7152, 0.0722));
+	result = max(mix(vec3(luminance), result, saturation), 0.0);
+#endif
+
+#ifdef VIGNETTE
+	// Distance to the center, 1 at the corners.
+	float d = length(tex_coords - 0.5) * 1.41421356;
+	result *= 1.0 - vignette_intensity * smoothstep(vignette_radius, 1.0, d);
+#endif
+
+#ifdef GAMMA_CORRECTION
+	result = pow(result, vec3(1.0/2.2));
+#endif
+
+	frag_color = vec4(result, 1.0);
+}
+#endif
+
+#endif
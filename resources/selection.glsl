@@ -10,8 +10,6 @@ layout (location = 1) in vec2 att_tex_coords;
 layout (location = 2) in vec3 att_normal;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 
 void
 main()
@@ -6,14 +6,15 @@
 #ifdef COMPILING_VERTEX
 
 layout (location = 0) in vec3 att_position;
+// Per instance, takes locations 5 to 8.
+layout (location = 5) in mat4 att_model;
 
-uniform mat4 model;
-uniform mat4 light_space;
+uniform int cascade;
 
 void
 main()
 {
-    gl_Position = light_space * model * vec4(att_position, 1.0f);
+    gl_Position = light_space[cascade] * att_model * vec4(att_position, 1.0f);
 }
 
 #endif
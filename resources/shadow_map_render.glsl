@@ -29,12 +29,13 @@ main()
 in vec2 tex_coords;
 out vec4 frag_color;
 
-uniform sampler2D texture_shadow_map;
+uniform sampler2DArray texture_shadow_map;
+uniform int cascade = 0;
 
 void
 main()
 {
-	float depth = texture(texture_shadow_map, tex_coords).r;
+	float depth = texture(texture_shadow_map, vec3(tex_coords, cascade)).r;
 	frag_color = vec4(vec3(depth), 1.0f);
     // frag_color = vec4(1.0f, 1.0f, 1.0f, 1.0f);
     // Apply gamma correction
@@ -9,9 +9,6 @@ layout (location = 0) in vec3 att_position;
 
 out vec3 tex_coords;
 
-uniform mat4 view;
-uniform mat4 projection;
-
 void main()
 {
 	tex_coords = att_position;
@@ -0,0 +1,67 @@
+/* ====================================
+ *
+ *   Uniform blocks, prepended to every
+ *   shader. Each block has a fixed
+ *   binding point (see uniform_blocks.hpp)
+ *   and is updated once per frame.
+ *
+ * ==================================== */
+
+// Also defined in uniform_blocks.hpp.
+#define MAX_SHADOW_CASCADES 4
+
+struct PointLight
+{
+    vec3  position;
+    vec3  ambient;
+    vec3  diffuse;
+    vec3  specular;
+
+    float constant;
+    float linear;
+    float quadratic;
+};
+
+struct DirectionalLight
+{
+	vec3  direction;
+	vec3  ambient;
+	vec3  diffuse;
+	vec3  specular;
+};
+
+struct DebugGuiState
+{
+	bool enable_normal_mapping;
+	float pcf_texel_offset;
+	int pcf_window_side;
+};
+
+layout (std140) uniform Camera
+{
+	mat4 view;
+	mat4 projection;
+	vec3 view_position;
+	vec2 screen_size;
+	mat4 inv_view_projection;
+};
+
+layout (std140) uniform Lights
+{
+	DirectionalLight dir_light;
+	// Light space of each shadow cascade and the view depth where it ends.
+	mat4             light_space[MAX_SHADOW_CASCADES];
+	vec4             cascade_splits;
+	// Clusters in x, y and z, then the number of point lights.
+	uvec4            cluster_grid;
+	float            cluster_depth_scale;
+	float            cluster_depth_bias;
+	int              num_shadow_cascades;
+};
+
+layout (std140) uniform Settings
+{
+	DebugGuiState debug_gui_state;
+	float         bloom_threshold;
+};
+
@@ -6,6 +6,12 @@
 
 lt_global_variable lt::Logger logger("application");
 
+const char *const gbuffer_texture_names[GBufferTarget_Count] = {
+	"texture_albedo_specular",
+	"texture_normals",
+	"texture_shininess",
+};
+
 lt_internal void
 framebuffer_size_callback(GLFWwindow *w, i32 width, i32 height)
 {
@@ -19,6 +25,11 @@ Application::~Application()
 	glDeleteTextures(1, &bloom_texture);
 	glDeleteFramebuffers(1, &hdr_fbo);
 	glDeleteRenderbuffers(1, &hdr_rbo);
+	glDeleteTextures(MAX_BLOOM_MIPS, bloom_mips);
+	glDeleteFramebuffers(1, &bloom_fbo);
+	glDeleteTextures(GBufferTarget_Count, gbuffer_textures);
+	glDeleteTextures(1, &gbuffer_depth);
+	glDeleteFramebuffers(1, &gbuffer_fbo);
 }
 
 Application
@@ -94,22 +105,66 @@ application_create_and_set_context(Resources &resources, const char *title, i32
 		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
 			logger.error("Failed to properly create the HDR framebuffer for the application.");
 	}
-	// Create pingpong buffers
+	// Create the bloom chain, the framebuffer gets each level attached when it is drawn.
 	{
-		glGenFramebuffers(2, app.pingpong_fbos);
-		glGenTextures(2, app.pingpong_textures);
-		for (i32 i = 0; i < LT_Count(app.pingpong_fbos); i++)
+		glGenFramebuffers(1, &app.bloom_fbo);
+		glGenTextures(MAX_BLOOM_MIPS, app.bloom_mips);
+		i32 mip_width = width, mip_height = height;
+		for (i32 i = 0; i < MAX_BLOOM_MIPS; i++)
 		{
-			glBindFramebuffer(GL_FRAMEBUFFER, app.pingpong_fbos[i]);
-			glBindTexture(GL_TEXTURE_2D, app.pingpong_textures[i]);
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGB, GL_FLOAT, nullptr);
+			mip_width = mip_width > 1 ? mip_width / 2 : 1;
+			mip_height = mip_height > 1 ? mip_height / 2 : 1;
+			app.bloom_mip_width[i] = mip_width;
+			app.bloom_mip_height[i] = mip_height;
+
+			glBindTexture(GL_TEXTURE_2D, app.bloom_mips[i]);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_R11F_G11F_B10F, mip_width, mip_height, 0, GL_RGB, GL_FLOAT, nullptr);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		}
+	}
+
+	// Create the G-buffer
+	{
+		const GLenum internal_formats[GBufferTarget_Count] = {GL_RGBA8, GL_RGBA16F, GL_R8};
+		const GLenum formats[GBufferTarget_Count] = {GL_RGBA, GL_RGBA, GL_RED};
+		const GLenum types[GBufferTarget_Count] = {GL_UNSIGNED_BYTE, GL_FLOAT, GL_UNSIGNED_BYTE};
+
+		glGenFramebuffers(1, &app.gbuffer_fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, app.gbuffer_fbo);
+
+		u32 attachments[GBufferTarget_Count];
+		glGenTextures(GBufferTarget_Count, app.gbuffer_textures);
+		for (i32 i = 0; i < GBufferTarget_Count; i++)
+		{
+			glBindTexture(GL_TEXTURE_2D, app.gbuffer_textures[i]);
+			glTexImage2D(GL_TEXTURE_2D, 0, internal_formats[i], width, height, 0, formats[i], types[i], nullptr);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
-								   app.pingpong_textures[i], 0);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D,
+								   app.gbuffer_textures[i], 0);
+			attachments[i] = GL_COLOR_ATTACHMENT0 + i;
 		}
+
+		// The lighting reconstructs the positions from the depth, so it has to be a texture.
+		glGenTextures(1, &app.gbuffer_depth);
+		glBindTexture(GL_TEXTURE_2D, app.gbuffer_depth);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, width, height, 0, GL_DEPTH_STENCIL,
+					 GL_UNSIGNED_INT_24_8, nullptr);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, app.gbuffer_depth, 0);
+
+		glDrawBuffers(GBufferTarget_Count, attachments);
+
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			logger.error("Failed to properly create the G-buffer for the application.");
 	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
 	app.render_quad = resources.load_hdr_render_quad(app.hdr_texture);
 
@@ -7,6 +7,22 @@ struct GLFWwindow;
 struct Mesh;
 struct Resources;
 
+// Levels of the bloom chain, the first one at half the screen resolution.
+#define MAX_BLOOM_MIPS 8
+
+// Color targets of the G-buffer used by the deferred path, written by gbuffer.glsl.
+enum GBufferTarget
+{
+	GBufferTarget_AlbedoSpecular, // RGBA8, albedo and specular intensity.
+	GBufferTarget_Normal,         // RGBA16F, octahedral encoded normal and surface normal.
+	GBufferTarget_Shininess,      // R8, shininess divided by 256.
+
+	GBufferTarget_Count,
+};
+
+// Sampler names in deferred_lighting.glsl, indexed by GBufferTarget.
+extern const char *const gbuffer_texture_names[GBufferTarget_Count];
+
 struct Application
 {
 	GLFWwindow *window;
@@ -18,8 +34,13 @@ struct Application
 	u32         bloom_texture;
 	u32         hdr_rbo;
 	Mesh       *render_quad;
-	u32         pingpong_fbos[2];
-	u32         pingpong_textures[2];
+	u32         bloom_fbo;
+	u32         bloom_mips[MAX_BLOOM_MIPS]; // R11F_G11F_B10F, each half the size of the previous.
+	i32         bloom_mip_width[MAX_BLOOM_MIPS];
+	i32         bloom_mip_height[MAX_BLOOM_MIPS];
+	u32         gbuffer_fbo;
+	u32         gbuffer_textures[GBufferTarget_Count];
+	u32         gbuffer_depth; // Depth and stencil, copied to the HDR framebuffer after the geometry pass.
 
 	~Application();
 };
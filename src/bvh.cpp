@@ -0,0 +1,835 @@
+#include "bvh.hpp"
+#include <math.h>
+#include <algorithm>
+#include "lt_utils.hpp"
+#include "entities.hpp"
+
+lt_global_variable lt::Logger logger("bvh");
+
+// Fat boxes grow by this fraction of their extent, plus a constant amount.
+#define BVH_FAT_SCALE 0.05f
+#define BVH_FAT_MARGIN 0.1f
+#define BVH_SAH_BINS 16
+// Deepest traversal supported by the queries.
+#define BVH_MAX_STACK 256
+
+lt_internal inline f32 min_f32(f32 a, f32 b) { return a < b ? a : b; }
+lt_internal inline f32 max_f32(f32 a, f32 b) { return a > b ? a : b; }
+lt_internal inline i32 max_i32(i32 a, i32 b) { return a > b ? a : b; }
+
+AABB
+aabb_union(const AABB &a, const AABB &b)
+{
+	AABB r;
+	r.min = Vec3f(min_f32(a.min.x, b.min.x), min_f32(a.min.y, b.min.y), min_f32(a.min.z, b.min.z));
+	r.max = Vec3f(max_f32(a.max.x, b.max.x), max_f32(a.max.y, b.max.y), max_f32(a.max.z, b.max.z));
+	return r;
+}
+
+f32
+aabb_surface_area(const AABB &a)
+{
+	const f32 dx = a.max.x - a.min.x;
+	const f32 dy = a.max.y - a.min.y;
+	const f32 dz = a.max.z - a.min.z;
+	return 2.0f * (dx*dy + dy*dz + dz*dx);
+}
+
+bool
+aabb_contains(const AABB &outer, const AABB &inner)
+{
+	return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && outer.min.z <= inner.min.z
+		&& outer.max.x >= inner.max.x && outer.max.y >= inner.max.y && outer.max.z >= inner.max.z;
+}
+
+bool
+aabb_overlaps(const AABB &a, const AABB &b)
+{
+	return a.min.x <= b.max.x && a.max.x >= b.min.x
+		&& a.min.y <= b.max.y && a.max.y >= b.min.y
+		&& a.min.z <= b.max.z && a.max.z >= b.min.z;
+}
+
+AABB
+aabb_transform(const AABB &box, const Mat4f &m)
+{
+	// Arvo's method: each axis of the result is the translation plus the smallest and
+	// largest contribution of every column.
+	AABB r;
+	for (i32 i = 0; i < 3; i++)
+	{
+		r.min.val[i] = r.max.val[i] = m(i, 3);
+		for (i32 j = 0; j < 3; j++)
+		{
+			const f32 a = m(i, j) * box.min.val[j];
+			const f32 b = m(i, j) * box.max.val[j];
+			r.min.val[i] += min_f32(a, b);
+			r.max.val[i] += max_f32(a, b);
+		}
+	}
+	return r;
+}
+
+FrustumPlanes
+frustum_planes_from_matrix(const Mat4f &m)
+{
+	// Gribb & Hartmann, each plane is the last row of the matrix plus or minus another row.
+	FrustumPlanes f;
+	for (i32 i = 0; i < 3; i++)
+	{
+		f.planes[2*i + 0] = Vec4f(m(3, 0) + m(i, 0), m(3, 1) + m(i, 1), m(3, 2) + m(i, 2), m(3, 3) + m(i, 3));
+		f.planes[2*i + 1] = Vec4f(m(3, 0) - m(i, 0), m(3, 1) - m(i, 1), m(3, 2) - m(i, 2), m(3, 3) - m(i, 3));
+	}
+	for (i32 i = 0; i < 6; i++)
+	{
+		Vec4f &p = f.planes[i];
+		const f32 inv_len = 1.0f / sqrtf(p.x*p.x + p.y*p.y + p.z*p.z);
+		p = Vec4f(p.x*inv_len, p.y*inv_len, p.z*inv_len, p.w*inv_len);
+	}
+	return f;
+}
+
+bool
+aabb_ray_intersect(const AABB &box, const Ray &ray, f32 *t_entry)
+{
+	// Slab test, divisions by zero give infinities that compare the right way.
+	f32 t_min = 0;
+	f32 t_max = ray.max_distance;
+	for (i32 i = 0; i < 3; i++)
+	{
+		const f32 inv_dir = 1.0f / ray.direction.val[i];
+		const f32 t0 = (box.min.val[i] - ray.origin.val[i]) * inv_dir;
+		const f32 t1 = (box.max.val[i] - ray.origin.val[i]) * inv_dir;
+		t_min = max_f32(t_min, min_f32(t0, t1));
+		t_max = min_f32(t_max, max_f32(t0, t1));
+	}
+	*t_entry = t_min;
+	return t_min <= t_max;
+}
+
+bool
+triangle_ray_intersect(const Vec3f &v0, const Vec3f &v1, const Vec3f &v2, const Ray &ray, f32 *t)
+{
+	const Vec3f edge1 = v1 - v0;
+	const Vec3f edge2 = v2 - v0;
+	const Vec3f p = lt::cross(ray.direction, edge2);
+	const f32 det = lt::dot(edge1, p);
+	if (fabsf(det) < 1e-8f)
+		return false;
+
+	const f32 inv_det = 1.0f / det;
+	const Vec3f s = ray.origin - v0;
+	const f32 u = lt::dot(s, p) * inv_det;
+	if (u < 0 || u > 1)
+		return false;
+
+	const Vec3f q = lt::cross(s, edge1);
+	const f32 v = lt::dot(ray.direction, q) * inv_det;
+	if (v < 0 || u + v > 1)
+		return false;
+
+	const f32 dist = lt::dot(edge2, q) * inv_det;
+	if (dist < 0 || dist > ray.max_distance)
+		return false;
+
+	*t = dist;
+	return true;
+}
+
+lt_internal AABB
+fatten(const AABB &box)
+{
+	const Vec3f margin((box.max.x - box.min.x) * BVH_FAT_SCALE + BVH_FAT_MARGIN,
+					   (box.max.y - box.min.y) * BVH_FAT_SCALE + BVH_FAT_MARGIN,
+					   (box.max.z - box.min.z) * BVH_FAT_SCALE + BVH_FAT_MARGIN);
+	return AABB{box.min - margin, box.max + margin};
+}
+
+i32
+EntityBVH::allocate_node()
+{
+	i32 node;
+	if (m_free_list != -1)
+	{
+		node = m_free_list;
+		m_free_list = nodes[node].parent;
+	}
+	else
+	{
+		node = nodes.size();
+		nodes.emplace_back();
+	}
+
+	nodes[node].parent = -1;
+	nodes[node].left = -1;
+	nodes[node].right = -1;
+	nodes[node].height = 0;
+	nodes[node].handle = -1;
+	return node;
+}
+
+void
+EntityBVH::free_node(i32 node)
+{
+	// Free nodes are linked through their parent index.
+	nodes[node].parent = m_free_list;
+	nodes[node].height = -1;
+	m_free_list = node;
+}
+
+bool
+EntityBVH::contains(EntityHandle h) const
+{
+	const u32 index = entity_index(h);
+	return index < m_leaf_of.size() && m_leaf_of[index] != -1 && nodes[m_leaf_of[index]].handle == h;
+}
+
+void
+EntityBVH::insert(EntityHandle h, const AABB &box)
+{
+	if (contains(h))
+	{
+		update(h, box);
+		return;
+	}
+
+	const u32 index = entity_index(h);
+	if (index >= m_leaf_of.size())
+		m_leaf_of.resize(index + 1, -1);
+
+	const i32 leaf = allocate_node();
+	nodes[leaf].box = fatten(box);
+	nodes[leaf].handle = h;
+	m_leaf_of[index] = leaf;
+
+	insert_leaf(leaf);
+}
+
+void
+EntityBVH::remove(EntityHandle h)
+{
+	LT_Assert(contains(h));
+	const u32 index = entity_index(h);
+	const i32 leaf = m_leaf_of[index];
+
+	remove_leaf(leaf);
+	free_node(leaf);
+	m_leaf_of[index] = -1;
+}
+
+bool
+EntityBVH::update(EntityHandle h, const AABB &box)
+{
+	LT_Assert(contains(h));
+	const i32 leaf = m_leaf_of[entity_index(h)];
+	if (aabb_contains(nodes[leaf].box, box))
+		return false;
+
+	remove_leaf(leaf);
+	nodes[leaf].box = fatten(box);
+	insert_leaf(leaf);
+	return true;
+}
+
+void
+EntityBVH::insert_leaf(i32 leaf)
+{
+	if (root == -1)
+	{
+		root = leaf;
+		nodes[leaf].parent = -1;
+		return;
+	}
+
+	// Walk down choosing the child that grows the least, stopping when making a new
+	// parent for the current node is cheaper than descending further.
+	const AABB leaf_box = nodes[leaf].box;
+	i32 index = root;
+	while (nodes[index].left != -1)
+	{
+		const f32 area = aabb_surface_area(nodes[index].box);
+		const f32 combined_area = aabb_surface_area(aabb_union(nodes[index].box, leaf_box));
+		const f32 cost = 2.0f * combined_area;
+		const f32 inheritance_cost = 2.0f * (combined_area - area);
+
+		auto descend_cost = [&](i32 child) {
+			const f32 grown = aabb_surface_area(aabb_union(leaf_box, nodes[child].box));
+			if (nodes[child].left == -1)
+				return grown + inheritance_cost;
+			return grown - aabb_surface_area(nodes[child].box) + inheritance_cost;
+		};
+
+		const i32 left = nodes[index].left;
+		const i32 right = nodes[index].right;
+		const f32 cost_left = descend_cost(left);
+		const f32 cost_right = descend_cost(right);
+
+		if (cost < cost_left && cost < cost_right)
+			break;
+		index = cost_left < cost_right ? left : right;
+	}
+
+	const i32 sibling = index;
+	const i32 old_parent = nodes[sibling].parent;
+	const i32 new_parent = allocate_node();
+
+	nodes[new_parent].parent = old_parent;
+	nodes[new_parent].box = aabb_union(leaf_box, nodes[sibling].box);
+	nodes[new_parent].height = nodes[sibling].height + 1;
+	nodes[new_parent].left = sibling;
+	nodes[new_parent].right = leaf;
+	nodes[sibling].parent = new_parent;
+	nodes[leaf].parent = new_parent;
+
+	if (old_parent == -1)
+		root = new_parent;
+	else if (nodes[old_parent].left == sibling)
+		nodes[old_parent].left = new_parent;
+	else
+		nodes[old_parent].right = new_parent;
+
+	fix_upwards(nodes[leaf].parent);
+}
+
+void
+EntityBVH::remove_leaf(i32 leaf)
+{
+	if (leaf == root)
+	{
+		root = -1;
+		return;
+	}
+
+	const i32 parent = nodes[leaf].parent;
+	const i32 grand_parent = nodes[parent].parent;
+	const i32 sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+
+	// The sibling takes the place of the parent.
+	nodes[sibling].parent = grand_parent;
+	free_node(parent);
+
+	if (grand_parent == -1)
+	{
+		root = sibling;
+	}
+	else
+	{
+		if (nodes[grand_parent].left == parent)
+			nodes[grand_parent].left = sibling;
+		else
+			nodes[grand_parent].right = sibling;
+		fix_upwards(grand_parent);
+	}
+}
+
+void
+EntityBVH::fix_upwards(i32 index)
+{
+	while (index != -1)
+	{
+		index = balance(index);
+
+		BVHNode &node = nodes[index];
+		node.height = 1 + max_i32(nodes[node.left].height, nodes[node.right].height);
+		node.box = aabb_union(nodes[node.left].box, nodes[node.right].box);
+
+		index = node.parent;
+	}
+}
+
+// Rotates the taller child of a up if the subtree is unbalanced, returning the new subtree root.
+i32
+EntityBVH::balance(i32 ia)
+{
+	BVHNode *a = &nodes[ia];
+	if (a->left == -1 || a->height < 2)
+		return ia;
+
+	const i32 ib = a->left;
+	const i32 ic = a->right;
+	BVHNode *b = &nodes[ib];
+	BVHNode *c = &nodes[ic];
+	const i32 diff = c->height - b->height;
+
+	if (diff > 1)
+	{
+		// Rotate c up.
+		const i32 i_f = c->left;
+		const i32 i_g = c->right;
+		BVHNode *f = &nodes[i_f];
+		BVHNode *g = &nodes[i_g];
+
+		c->left = ia;
+		c->parent = a->parent;
+		a->parent = ic;
+
+		if (c->parent == -1)
+			root = ic;
+		else if (nodes[c->parent].left == ia)
+			nodes[c->parent].left = ic;
+		else
+			nodes[c->parent].right = ic;
+
+		if (f->height > g->height)
+		{
+			c->right = i_f;
+			a->right = i_g;
+			g->parent = ia;
+			a->box = aabb_union(b->box, g->box);
+			c->box = aabb_union(a->box, f->box);
+			a->height = 1 + max_i32(b->height, g->height);
+			c->height = 1 + max_i32(a->height, f->height);
+		}
+		else
+		{
+			c->right = i_g;
+			a->right = i_f;
+			f->parent = ia;
+			a->box = aabb_union(b->box, f->box);
+			c->box = aabb_union(a->box, g->box);
+			a->height = 1 + max_i32(b->height, f->height);
+			c->height = 1 + max_i32(a->height, g->height);
+		}
+		return ic;
+	}
+
+	if (diff < -1)
+	{
+		// Rotate b up.
+		const i32 i_d = b->left;
+		const i32 i_e = b->right;
+		BVHNode *d = &nodes[i_d];
+		BVHNode *e = &nodes[i_e];
+
+		b->left = ia;
+		b->parent = a->parent;
+		a->parent = ib;
+
+		if (b->parent == -1)
+			root = ib;
+		else if (nodes[b->parent].left == ia)
+			nodes[b->parent].left = ib;
+		else
+			nodes[b->parent].right = ib;
+
+		if (d->height > e->height)
+		{
+			b->right = i_d;
+			a->left = i_e;
+			e->parent = ia;
+			a->box = aabb_union(c->box, e->box);
+			b->box = aabb_union(a->box, d->box);
+			a->height = 1 + max_i32(c->height, e->height);
+			b->height = 1 + max_i32(a->height, d->height);
+		}
+		else
+		{
+			b->right = i_e;
+			a->left = i_d;
+			d->parent = ia;
+			a->box = aabb_union(c->box, d->box);
+			b->box = aabb_union(a->box, e->box);
+			a->height = 1 + max_i32(c->height, d->height);
+			b->height = 1 + max_i32(a->height, e->height);
+		}
+		return ib;
+	}
+
+	return ia;
+}
+
+void
+EntityBVH::rebuild()
+{
+	if (root == -1)
+		return;
+
+	// Keep the leaves, since entities map to them, and free every internal node.
+	m_leaves.clear();
+	for (i32 i = 0; i < (i32)nodes.size(); i++)
+	{
+		if (nodes[i].height < 0)
+			continue;
+		if (nodes[i].left == -1)
+			m_leaves.push_back(i);
+		else
+			free_node(i);
+	}
+
+	root = build_sah(m_leaves.data(), m_leaves.size());
+	nodes[root].parent = -1;
+}
+
+lt_internal inline Vec3f
+centroid(const AABB &box)
+{
+	return (box.min + box.max) * 0.5f;
+}
+
+i32
+EntityBVH::build_sah(i32 *leaves, i32 count)
+{
+	if (count == 1)
+		return leaves[0];
+
+	AABB centroids = {centroid(nodes[leaves[0]].box), centroid(nodes[leaves[0]].box)};
+	for (i32 i = 1; i < count; i++)
+	{
+		const Vec3f c = centroid(nodes[leaves[i]].box);
+		centroids = aabb_union(centroids, AABB{c, c});
+	}
+
+	const Vec3f extent = centroids.max - centroids.min;
+	i32 axis = 0;
+	if (extent.y > extent.val[axis]) axis = 1;
+	if (extent.z > extent.val[axis]) axis = 2;
+
+	i32 mid = count / 2;
+	if (extent.val[axis] > 1e-6f)
+	{
+		// Binned SAH: sort the centroids into bins and evaluate splitting between each pair.
+		i32  bin_count[BVH_SAH_BINS] = {};
+		AABB bin_box[BVH_SAH_BINS];
+		const f32 scale = BVH_SAH_BINS / extent.val[axis];
+
+		auto bin_of = [&](i32 leaf) {
+			const i32 b = (i32)((centroid(nodes[leaf].box).val[axis] - centroids.min.val[axis]) * scale);
+			return b < BVH_SAH_BINS ? b : BVH_SAH_BINS - 1;
+		};
+
+		for (i32 i = 0; i < count; i++)
+		{
+			const i32 b = bin_of(leaves[i]);
+			bin_box[b] = bin_count[b] ? aabb_union(bin_box[b], nodes[leaves[i]].box) : nodes[leaves[i]].box;
+			bin_count[b]++;
+		}
+
+		// Sweep from the right to get the cost of every right side.
+		f32 right_cost[BVH_SAH_BINS];
+		{
+			AABB box = {};
+			i32 n = 0;
+			for (i32 b = BVH_SAH_BINS - 1; b > 0; b--)
+			{
+				if (bin_count[b])
+				{
+					box = n ? aabb_union(box, bin_box[b]) : bin_box[b];
+					n += bin_count[b];
+				}
+				right_cost[b] = n ? aabb_surface_area(box) * n : 0;
+			}
+		}
+
+		f32 best_cost = INFINITY;
+		i32 best_split = -1;
+		AABB box = {};
+		i32 n = 0;
+		for (i32 b = 0; b < BVH_SAH_BINS - 1; b++)
+		{
+			if (bin_count[b])
+			{
+				box = n ? aabb_union(box, bin_box[b]) : bin_box[b];
+				n += bin_count[b];
+			}
+			if (n == 0 || n == count)
+				continue;
+
+			const f32 cost = aabb_surface_area(box) * n + right_cost[b + 1];
+			if (cost < best_cost)
+			{
+				best_cost = cost;
+				best_split = b;
+			}
+		}
+
+		if (best_split != -1)
+		{
+			i32 *split = std::partition(leaves, leaves + count, [&](i32 leaf) {
+				return bin_of(leaf) <= best_split;
+			});
+			mid = split - leaves;
+		}
+	}
+
+	if (mid == 0 || mid == count)
+	{
+		// All centroids in the same place, split in half.
+		mid = count / 2;
+		std::nth_element(leaves, leaves + mid, leaves + count, [&](i32 a, i32 b) {
+			return centroid(nodes[a].box).val[axis] < centroid(nodes[b].box).val[axis];
+		});
+	}
+
+	const i32 left = build_sah(leaves, mid);
+	const i32 right = build_sah(leaves + mid, count - mid);
+
+	const i32 node = allocate_node();
+	nodes[node].left = left;
+	nodes[node].right = right;
+	nodes[node].box = aabb_union(nodes[left].box, nodes[right].box);
+	nodes[node].height = 1 + max_i32(nodes[left].height, nodes[right].height);
+	nodes[left].parent = node;
+	nodes[right].parent = node;
+	return node;
+}
+
+void
+EntityBVH::query_aabb(const AABB &box, std::vector<EntityHandle> &out) const
+{
+	if (root == -1)
+		return;
+
+	i32 stack[BVH_MAX_STACK];
+	i32 top = 0;
+	stack[top++] = root;
+
+	while (top > 0)
+	{
+		const BVHNode &node = nodes[stack[--top]];
+		if (!aabb_overlaps(node.box, box))
+			continue;
+
+		if (node.left == -1)
+		{
+			out.push_back(node.handle);
+		}
+		else
+		{
+			LT_Assert(top + 2 <= BVH_MAX_STACK);
+			stack[top++] = node.left;
+			stack[top++] = node.right;
+		}
+	}
+}
+
+void
+EntityBVH::add_subtree(i32 index, std::vector<EntityHandle> &out) const
+{
+	const BVHNode &node = nodes[index];
+	if (node.left == -1)
+	{
+		out.push_back(node.handle);
+		return;
+	}
+	add_subtree(node.left, out);
+	add_subtree(node.right, out);
+}
+
+void
+EntityBVH::query_frustum(const FrustumPlanes &frustum, std::vector<EntityHandle> &out) const
+{
+	if (root == -1)
+		return;
+
+	i32 stack[BVH_MAX_STACK];
+	i32 top = 0;
+	stack[top++] = root;
+
+	while (top > 0)
+	{
+		const i32 index = stack[--top];
+		const BVHNode &node = nodes[index];
+
+		bool outside = false;
+		bool inside = true;
+		for (i32 i = 0; i < 6 && !outside; i++)
+		{
+			const Vec4f &p = frustum.planes[i];
+			// Corner furthest along the plane normal, and the one furthest against it.
+			const f32 far_dist = p.x * (p.x >= 0 ? node.box.max.x : node.box.min.x)
+				+ p.y * (p.y >= 0 ? node.box.max.y : node.box.min.y)
+				+ p.z * (p.z >= 0 ? node.box.max.z : node.box.min.z) + p.w;
+			const f32 near_dist = p.x * (p.x >= 0 ? node.box.min.x : node.box.max.x)
+				+ p.y * (p.y >= 0 ? node.box.min.y : node.box.max.y)
+				+ p.z * (p.z >= 0 ? node.box.min.z : node.box.max.z) + p.w;
+
+			outside = far_dist < 0;
+			inside = inside && near_dist >= 0;
+		}
+
+		if (outside)
+			continue;
+
+		if (inside || node.left == -1)
+		{
+			// Everything below a node fully inside the frustum is visible.
+			add_subtree(index, out);
+		}
+		else
+		{
+			LT_Assert(top + 2 <= BVH_MAX_STACK);
+			stack[top++] = node.left;
+			stack[top++] = node.right;
+		}
+	}
+}
+
+void
+EntityBVH::query_ray(const Ray &ray, std::vector<EntityHandle> &out) const
+{
+	if (root == -1)
+		return;
+
+	i32 stack[BVH_MAX_STACK];
+	i32 top = 0;
+	stack[top++] = root;
+
+	while (top > 0)
+	{
+		const BVHNode &node = nodes[stack[--top]];
+		f32 t_entry;
+		if (!aabb_ray_intersect(node.box, ray, &t_entry))
+			continue;
+
+		if (node.left == -1)
+		{
+			out.push_back(node.handle);
+		}
+		else
+		{
+			LT_Assert(top + 2 <= BVH_MAX_STACK);
+			stack[top++] = node.left;
+			stack[top++] = node.right;
+		}
+	}
+}
+
+// Triangles per leaf of the mesh BVHs.
+#define TRIANGLE_BVH_LEAF_SIZE 4
+
+lt_internal inline AABB
+triangle_bounds(const std::vector<Vec3f> &vertices, const Vec3i &face)
+{
+	const Vec3f &a = vertices[face.val[0]];
+	const Vec3f &b = vertices[face.val[1]];
+	const Vec3f &c = vertices[face.val[2]];
+	return aabb_union(aabb_union(AABB{a, a}, AABB{b, b}), AABB{c, c});
+}
+
+void
+TriangleBVH::build(const std::vector<Vec3f> &vertices, const std::vector<Vec3i> &faces)
+{
+	nodes.clear();
+	triangles.resize(faces.size());
+	if (faces.empty())
+		return;
+
+	std::vector<Vec3f> centroids(faces.size());
+	for (usize i = 0; i < faces.size(); i++)
+	{
+		triangles[i] = i;
+		const Vec3i &f = faces[i];
+		centroids[i] = (vertices[f.val[0]] + vertices[f.val[1]] + vertices[f.val[2]]) * (1.0f / 3.0f);
+	}
+
+	nodes.reserve(2 * faces.size() / TRIANGLE_BVH_LEAF_SIZE + 1);
+	build_node(0, faces.size(), vertices, faces, centroids);
+}
+
+i32
+TriangleBVH::build_node(i32 first, i32 count, const std::vector<Vec3f> &vertices,
+						const std::vector<Vec3i> &faces, std::vector<Vec3f> &centroids)
+{
+	const i32 index = nodes.size();
+	nodes.emplace_back();
+
+	AABB box = triangle_bounds(vertices, faces[triangles[first]]);
+	AABB centroid_box = {centroids[triangles[first]], centroids[triangles[first]]};
+	for (i32 i = first + 1; i < first + count; i++)
+	{
+		box = aabb_union(box, triangle_bounds(vertices, faces[triangles[i]]));
+		centroid_box = aabb_union(centroid_box, AABB{centroids[triangles[i]], centroids[triangles[i]]});
+	}
+	nodes[index].box = box;
+
+	if (count <= TRIANGLE_BVH_LEAF_SIZE)
+	{
+		nodes[index].offset = first;
+		nodes[index].count = count;
+		return index;
+	}
+
+	// Median split on the axis where the centroids spread the most.
+	const Vec3f extent = centroid_box.max - centroid_box.min;
+	i32 axis = 0;
+	if (extent.y > extent.val[axis]) axis = 1;
+	if (extent.z > extent.val[axis]) axis = 2;
+
+	const i32 mid = count / 2;
+	std::nth_element(triangles.begin() + first, triangles.begin() + first + mid,
+					 triangles.begin() + first + count, [&](i32 a, i32 b) {
+		return centroids[a].val[axis] < centroids[b].val[axis];
+	});
+
+	build_node(first, mid, vertices, faces, centroids);
+	const i32 right = build_node(first + mid, count - mid, vertices, faces, centroids);
+
+	nodes[index].offset = right;
+	nodes[index].count = 0;
+	return index;
+}
+
+bool
+TriangleBVH::raycast(const Ray &ray, const std::vector<Vec3f> &vertices, const std::vector<Vec3i> &faces,
+					 f32 *t) const
+{
+	if (nodes.empty())
+		return false;
+
+	Ray r = ray;
+	bool hit = false;
+
+	i32 stack[BVH_MAX_STACK];
+	i32 top = 0;
+	stack[top++] = 0;
+
+	while (top > 0)
+	{
+		const i32 index = stack[--top];
+		const TriangleBVHNode &node = nodes[index];
+
+		f32 t_entry;
+		if (!aabb_ray_intersect(node.box, r, &t_entry))
+			continue;
+
+		if (node.count > 0)
+		{
+			for (i32 i = node.offset; i < node.offset + node.count; i++)
+			{
+				const Vec3i &f = faces[triangles[i]];
+				f32 t_hit;
+				if (triangle_ray_intersect(vertices[f.val[0]], vertices[f.val[1]], vertices[f.val[2]], r, &t_hit))
+				{
+					// Shrinking the ray prunes everything further than the closest hit so far.
+					r.max_distance = t_hit;
+					hit = true;
+				}
+			}
+			continue;
+		}
+
+		// Visit the nearest child first, so the ray gets shorter sooner.
+		i32 near_child = index + 1;
+		i32 far_child = node.offset;
+		f32 t_near, t_far;
+		const bool hit_near = aabb_ray_intersect(nodes[near_child].box, r, &t_near);
+		const bool hit_far = aabb_ray_intersect(nodes[far_child].box, r, &t_far);
+		if (hit_near && hit_far && t_far < t_near)
+		{
+			const i32 tmp = near_child;
+			near_child = far_child;
+			far_child = tmp;
+		}
+
+		LT_Assert(top + 2 <= BVH_MAX_STACK);
+		if (hit_near || hit_far)
+		{
+			stack[top++] = far_child;
+			stack[top++] = near_child;
+		}
+	}
+
+	if (hit)
+		*t = r.max_distance;
+	return hit;
+}
@@ -0,0 +1,131 @@
+#ifndef __BVH_HPP__
+#define __BVH_HPP__
+
+#include <vector>
+#include "lt_core.hpp"
+#include "lt_math.hpp"
+
+typedef isize EntityHandle;
+
+struct AABB
+{
+	Vec3f min;
+	Vec3f max;
+};
+
+AABB aabb_union(const AABB &a, const AABB &b);
+f32  aabb_surface_area(const AABB &a);
+bool aabb_contains(const AABB &outer, const AABB &inner);
+bool aabb_overlaps(const AABB &a, const AABB &b);
+// Bounds of the box after being transformed by m.
+AABB aabb_transform(const AABB &box, const Mat4f &m);
+
+//
+// Planes of a view frustum as (normal, distance), with the normals pointing inside, so a
+// point p is inside a plane when dot(normal, p) + distance >= 0.
+//
+struct FrustumPlanes
+{
+	Vec4f planes[6];
+};
+
+// Extracts the planes from a projection * view matrix.
+FrustumPlanes frustum_planes_from_matrix(const Mat4f &m);
+
+// Distances along a ray are in units of the direction length, which does not need to be normalized.
+struct Ray
+{
+	Vec3f origin;
+	Vec3f direction;
+	f32   max_distance;
+};
+
+// Returns true if the ray hits the box, writing the distance where it enters it (0 if it
+// starts inside).
+bool aabb_ray_intersect(const AABB &box, const Ray &ray, f32 *t_entry);
+// Moller-Trumbore, both sides of the triangle count as hits.
+bool triangle_ray_intersect(const Vec3f &v0, const Vec3f &v1, const Vec3f &v2, const Ray &ray, f32 *t);
+
+struct BVHNode
+{
+	AABB         box;
+	i32          parent;
+	i32          left;   // -1 for leaves.
+	i32          right;
+	i32          height; // 0 for leaves, -1 for nodes in the free list.
+	EntityHandle handle;
+};
+
+//
+// Dynamic AABB tree over entity bounds. Leaves store a box slightly larger than the entity
+// (a fat box), so small movements don't touch the tree at all, and a leaf whose entity
+// moved out of its fat box is removed and inserted again, with rotations that keep the tree
+// balanced.
+//
+// For content that does not move, rebuild builds the whole tree again top-down with the
+// surface area heuristic, which gives better trees than incremental insertion.
+//
+// Queries append every matching handle to the output vector, without clearing it, and
+// can run concurrently with each other.
+//
+struct EntityBVH
+{
+	std::vector<BVHNode> nodes;
+	i32                  root = -1;
+
+	void insert(EntityHandle h, const AABB &box);
+	void remove(EntityHandle h);
+	// Updates the bounds of an entity already in the tree. Returns true if the tree changed.
+	bool update(EntityHandle h, const AABB &box);
+	bool contains(EntityHandle h) const;
+	void rebuild();
+
+	void query_aabb(const AABB &box, std::vector<EntityHandle> &out) const;
+	void query_frustum(const FrustumPlanes &frustum, std::vector<EntityHandle> &out) const;
+	// Entities whose box is hit by the ray, in no particular order.
+	void query_ray(const Ray &ray, std::vector<EntityHandle> &out) const;
+
+	inline i32 height() const { return root == -1 ? 0 : nodes[root].height; }
+
+private:
+	std::vector<i32> m_leaf_of;  // Indexed by entity_index(handle).
+	i32              m_free_list = -1;
+	std::vector<i32> m_leaves;   // Scratch memory for rebuild.
+
+	i32  allocate_node();
+	void free_node(i32 node);
+	void insert_leaf(i32 leaf);
+	void remove_leaf(i32 leaf);
+	i32  balance(i32 node);
+	void fix_upwards(i32 node);
+	i32  build_sah(i32 *leaves, i32 count);
+	void add_subtree(i32 node, std::vector<EntityHandle> &out) const;
+};
+
+//
+// Static BVH over the triangles of a mesh, built once when the mesh is loaded. Nodes are
+// stored depth first, so the left child of an internal node is always the next node.
+//
+struct TriangleBVHNode
+{
+	AABB box;
+	i32  offset; // First triangle for leaves, right child for internal nodes.
+	i32  count;  // Number of triangles, 0 for internal nodes.
+};
+
+struct TriangleBVH
+{
+	std::vector<TriangleBVHNode> nodes;
+	std::vector<i32>             triangles; // Face indexes, leaves point to ranges of it.
+
+	void build(const std::vector<Vec3f> &vertices, const std::vector<Vec3i> &faces);
+	// Finds the closest triangle hit by the ray, returning false if there is none.
+	bool raycast(const Ray &ray, const std::vector<Vec3f> &vertices, const std::vector<Vec3i> &faces,
+				 f32 *t) const;
+
+private:
+	i32 build_node(i32 first, i32 count, const std::vector<Vec3f> &vertices,
+				   const std::vector<Vec3i> &faces, std::vector<Vec3f> &centroids);
+};
+
+#endif // __BVH_HPP__
@@ -1,4 +1,5 @@
 #include "camera.hpp"
+#include <math.h>
 #include "lt_utils.hpp"
 #include "input.hpp"
 #include <GLFW/glfw3.h>
@@ -29,7 +30,8 @@ Camera::Camera(Vec3f position, Vec3f front_vec, Vec3f up_world,
     frustum.fovy = fovy;
     frustum.znear = ZNEAR;
     frustum.zfar = ZFAR;
-    frustum.projection = lt::perspective(lt::radians(fovy), ratio, ZNEAR, ZFAR);
+    // lt::perspective takes the field of view in degrees.
+    frustum.projection = lt::perspective(fovy, ratio, ZNEAR, ZFAR);
 
     update_frustum_right_and_up(frustum, up_world);
 
@@ -140,3 +142,17 @@ Camera::view_matrix() const
 					   interpolated_frustum.position + interpolated_frustum.front.v,
 					   interpolated_frustum.up.v);
 }
+
+Ray
+Camera::ray_through(f32 ndc_x, f32 ndc_y) const
+{
+	const f32 tan_half_fovy = tanf(lt::radians(frustum.fovy) * 0.5f);
+
+	Ray ray;
+	ray.origin = frustum.position;
+	ray.direction = lt::normalize(frustum.front.v
+								  + frustum.right.v * (ndc_x * tan_half_fovy * frustum.ratio)
+								  + frustum.up.v * (ndc_y * tan_half_fovy));
+	ray.max_distance = frustum.zfar;
+	return ray;
+}
@@ -2,6 +2,7 @@
 #define CAMERA_HPP
 
 #include "lt_math.hpp"
+#include "bvh.hpp"
 
 struct Key;
 
@@ -47,6 +48,8 @@ struct Camera
 	void interpolate_frustum(f64 lag_offset);
 
     Mat4f view_matrix() const;
+	// Ray from the camera through a point in normalized device coordinates ([-1, 1], y up).
+	Ray   ray_through(f32 ndc_x, f32 ndc_y) const;
 
 private:
 	void add_frame_movement(Direction dir);
@@ -0,0 +1,68 @@
+#include "culling.hpp"
+#include <xmmintrin.h>
+
+i32
+frustum_cull(const FrustumPlanes &frustum, const BoundsSoA &bounds, i32 count, u8 *visible)
+{
+	// Each plane broadcast to all the lanes, with the absolute value of the normal used to
+	// project the extents on it.
+	const __m128 sign_mask = _mm_set1_ps(-0.0f);
+	__m128 normal[6][3], abs_normal[6][3], distance[6];
+	for (i32 p = 0; p < 6; p++)
+	{
+		const Vec4f &plane = frustum.planes[p];
+		for (i32 axis = 0; axis < 3; axis++)
+		{
+			normal[p][axis] = _mm_set1_ps(plane.val[axis]);
+			abs_normal[p][axis] = _mm_andnot_ps(sign_mask, normal[p][axis]);
+		}
+		distance[p] = _mm_set1_ps(plane.w);
+	}
+
+	i32 num_visible = 0;
+	for (i32 i = 0; i < count; i += 4)
+	{
+		const __m128 cx = _mm_load_ps(bounds.center[0] + i);
+		const __m128 cy = _mm_load_ps(bounds.center[1] + i);
+		const __m128 cz = _mm_load_ps(bounds.center[2] + i);
+		const __m128 ex = _mm_load_ps(bounds.extent[0] + i);
+		const __m128 ey = _mm_load_ps(bounds.extent[1] + i);
+		const __m128 ez = _mm_load_ps(bounds.extent[2] + i);
+
+		// A box is outside when even its corner furthest along the normal is behind a plane.
+		__m128 outside = _mm_setzero_ps();
+		for (i32 p = 0; p < 6; p++)
+		{
+			__m128 d = _mm_add_ps(distance[p], _mm_mul_ps(normal[p][0], cx));
+			d = _mm_add_ps(d, _mm_mul_ps(normal[p][1], cy));
+			d = _mm_add_ps(d, _mm_mul_ps(normal[p][2], cz));
+			d = _mm_add_ps(d, _mm_mul_ps(abs_normal[p][0], ex));
+			d = _mm_add_ps(d, _mm_mul_ps(abs_normal[p][1], ey));
+			d = _mm_add_ps(d, _mm_mul_ps(abs_normal[p][2], ez));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(d, _mm_setzero_ps()));
+		}
+
+		const i32 outside_bits = _mm_movemask_ps(outside);
+		const i32 lanes = count - i < 4 ? count - i : 4;
+		for (i32 lane = 0; lane < lanes; lane++)
+		{
+			const u8 v = ((outside_bits >> lane) & 1) == 0;
+			visible[i + lane] = v;
+			num_visible += v;
+		}
+	}
+	return num_visible;
+}
+
+FrustumPlanes
+sweep_frustum_planes(const FrustumPlanes &frustum, const Vec3f &dir)
+{
+	FrustumPlanes swept = frustum;
+	for (i32 p = 0; p < 6; p++)
+	{
+		const Vec4f &plane = frustum.planes[p];
+		if (plane.x*dir.x + plane.y*dir.y + plane.z*dir.z > 0.0f)
+			swept.planes[p] = Vec4f(0.0f, 0.0f, 0.0f, 1.0f);
+	}
+	return swept;
+}
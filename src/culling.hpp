@@ -0,0 +1,27 @@
+#ifndef __CULLING_HPP__
+#define __CULLING_HPP__
+
+#include "lt_core.hpp"
+#include "bvh.hpp"
+
+//
+// Boxes stored as one array per component (center and half extent on each axis), so four
+// of them are tested at the same time with SSE. Every array must be readable up to count
+// rounded up to a multiple of 4, the extra lanes are ignored.
+//
+struct BoundsSoA
+{
+	const f32 *center[3];
+	const f32 *extent[3];
+};
+
+// Writes 1 to visible[i] for every box that is at least partially inside the frustum and 0
+// for the rest. Returns the number of visible boxes.
+i32 frustum_cull(const FrustumPlanes &frustum, const BoundsSoA &bounds, i32 count, u8 *visible);
+
+// Planes to cull boxes swept to infinity along dir, e.g. shadow casters and the light direction:
+// a box moving along dir eventually crosses the planes facing against it, so those are
+// replaced by planes that keep everything.
+FrustumPlanes sweep_frustum_planes(const FrustumPlanes &frustum, const Vec3f &dir);
+
+#endif // __CULLING_HPP__
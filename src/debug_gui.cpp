@@ -6,6 +6,11 @@
 #include <GLFW/glfw3.h>
 #include "imgui/imgui.h"
 #include "imgui_impl_glfw.hpp"
+#include "jobs.hpp"
+#include "light_clusters.hpp"
+#include "uniform_blocks.hpp"
+#include "application.hpp"
+#include "profiler.hpp"
 #include "lt_utils.hpp"
 #include <cstdio>
 #include <map>
@@ -16,7 +21,8 @@ using std::endl;
 
 lt_global_variable lt::Logger logger("debug_gui");
 
-lt_internal void
+// Returns true if any of the values was changed.
+lt_internal bool
 draw_vec3(f32 &x, f32 &y, f32 &z, u32 id, i32 width = 65)
 {
 	lt_local_persist char x_buf[10] = {};
@@ -27,14 +33,74 @@ draw_vec3(f32 &x, f32 &y, f32 &z, u32 id, i32 width = 65)
 	std::snprintf(y_buf, 10, "y##%u", id);
 	std::snprintf(z_buf, 10, "z##%u", id);
 
+	bool changed = false;
 	ImGui::PushItemWidth(width);
-	ImGui::DragFloat(x_buf, &x, 0.05f, 0, 0, "%.2f");
+	changed |= ImGui::DragFloat(x_buf, &x, 0.05f, 0, 0, "%.2f");
 	ImGui::SameLine();
 	ImGui::PushItemWidth(width);
-	ImGui::DragFloat(y_buf, &y, 0.05f, 0, 0, "%.2f");
+	changed |= ImGui::DragFloat(y_buf, &y, 0.05f, 0, 0, "%.2f");
 	ImGui::SameLine();
 	ImGui::PushItemWidth(width);
-	ImGui::DragFloat(z_buf, &z, 0.05f, 0, 0, "%.2f");
+	changed |= ImGui::DragFloat(z_buf, &z, 0.05f, 0, 0, "%.2f");
+	return changed;
+}
+
+// Draws the zones of the frame as a flame graph, a row per nesting level and a group of rows
+// per thread. Zones are sized by their share of the frame.
+lt_internal void
+draw_flame_graph(const ProfileFrame &frame)
+{
+	const f32 row_height = ImGui::GetTextLineHeight() + 2.0f;
+	const f32 width = ImGui::GetContentRegionAvailWidth();
+	const f64 frame_cycles = frame.end > frame.begin ? (f64)(frame.end - frame.begin) : 1.0;
+	const f64 cycles_per_ms = profiler::cycles_per_ms();
+	ImDrawList *draw_list = ImGui::GetWindowDrawList();
+
+	for (i32 t = 0; t < profiler::num_threads(); t++)
+	{
+		u32 max_depth = 0;
+		bool has_zones = false;
+		for (const ProfileZone &zone : frame.zones)
+		{
+			if (zone.thread != (u32)t)
+				continue;
+			has_zones = true;
+			max_depth = zone.depth > max_depth ? zone.depth : max_depth;
+		}
+		if (!has_zones)
+			continue;
+
+		ImGui::Text(t == 0 ? "Main thread" : "Thread %d", t);
+		const ImVec2 origin = ImGui::GetCursorScreenPos();
+		const f32 height = (max_depth + 1) * row_height;
+		draw_list->AddRectFilled(origin, ImVec2(origin.x + width, origin.y + height), IM_COL32(30, 30, 30, 255));
+
+		for (const ProfileZone &zone : frame.zones)
+		{
+			if (zone.thread != (u32)t)
+				continue;
+
+			// Zones that started in the previous frame are clamped to its beginning.
+			const f64 begin = zone.begin > frame.begin ? (f64)(zone.begin - frame.begin) : 0.0;
+			const f64 end = zone.end > frame.begin ? (f64)(zone.end - frame.begin) : 0.0;
+			const ImVec2 min(origin.x + (f32)(begin / frame_cycles) * width, origin.y + zone.depth * row_height);
+			const ImVec2 max(origin.x + (f32)(end / frame_cycles) * width, min.y + row_height - 1.0f);
+			if (max.x - min.x < 1.0f)
+				continue;
+
+			// The color only depends on the name, so a zone keeps it from one frame to the next.
+			const u32 hash = (u32)((uintptr_t)zone.name * 2654435761u);
+			draw_list->AddRectFilled(min, max, IM_COL32(90 + (hash >> 8) % 120, 90 + (hash >> 16) % 120, 60, 255));
+
+			draw_list->PushClipRect(min, max, true);
+			draw_list->AddText(ImVec2(min.x + 2.0f, min.y + 1.0f), IM_COL32_WHITE, zone.name);
+			draw_list->PopClipRect();
+
+			if (ImGui::IsMouseHoveringRect(min, max))
+				ImGui::SetTooltip("%s: %.3f ms", zone.name, (zone.end - zone.begin) / cycles_per_ms);
+		}
+		ImGui::Dummy(ImVec2(width, height));
+	}
 }
 
 void
@@ -46,17 +112,33 @@ dgui::init(GLFWwindow *window)
 	 // ImGui::StyleColorsClassic();
 }
 
+bool
+dgui::is_capturing_mouse()
+{
+	return ImGui::GetIO().WantCaptureMouse;
+}
+
 void
 dgui::draw(GLFWwindow *window, Entities &entities)
 {
 	auto &state = State::instance();
 	i32 id = 0;
 
+	// Drop the selection if the selected entity was destroyed in the meantime. Only entities
+	// with a mesh in the world can be selected, the skybox can't.
+	if (!entities.is_valid(state.selected_entity_handle) ||
+		!entities.has_all(state.selected_entity_handle, ComponentKind_Transform | ComponentKind_Renderable))
+		state.selected_entity_handle = -1;
+
 	ImGui_ImplGlfwGL3_NewFrame();
 
 	if (ImGui::Begin("Rendering Options", nullptr, ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_NoCollapse))
 	{
 		ImGui::Checkbox("Normal mapping", &state.enable_normal_mapping);
+		ImGui::Checkbox("Deferred shading", &state.enable_deferred_shading);
+		ImGui::Checkbox("Depth pre-pass", &state.enable_depth_prepass);
+		ImGui::Checkbox("Show overdraw", &state.show_overdraw);
+		ImGui::Checkbox("Occlusion culling", &state.enable_occlusion_culling);
 		ImGui::Checkbox("Multisampling", &state.enable_multisampling);
 		ImGui::Checkbox("Gamma correction", &state.enable_gamma_correction);
 		ImGui::Checkbox("Tone mapping", &state.enable_tone_mapping);
@@ -65,6 +147,7 @@ dgui::draw(GLFWwindow *window, Entities &entities)
 
 		ImGui::PushItemWidth(65);
 		ImGui::DragFloat("Bloom threshold", &state.bloom_threshold, 0.05f, 0, 100);
+		ImGui::SliderInt("Bloom levels", &state.bloom_levels, 1, MAX_BLOOM_MIPS);
 
 		ImGui::PushItemWidth(65);
 		ImGui::DragFloat("Exposure", &state.exposure, 0.05f, 0.05f, 100);
@@ -88,14 +171,38 @@ dgui::draw(GLFWwindow *window, Entities &entities)
 		{
 			ImGui::DragFloat("PCF texel offset", &state.pcf_texel_offset, 0.05f, 0.0f, 30.f, "%.2f");
 			ImGui::DragInt("PCF window side", &state.pcf_window_side, 2, 1, 21);
+			ImGui::SliderInt("Cascades", &state.shadow_cascades, 2, MAX_SHADOW_CASCADES);
+			ImGui::SliderFloat("Split lambda", &state.cascade_split_lambda, 0.0f, 1.0f, "%.2f");
+			ImGui::DragFloat("Shadow distance", &state.shadow_distance, 1.0f, 10.0f, 1000.0f, "%.0f");
+			ImGui::SliderInt("Shown cascade", &state.shadow_map_cascade, 0, state.shadow_cascades - 1);
+		}
+		if (ImGui::CollapsingHeader("Post processing"))
+		{
+			ImGui::Checkbox("Color grading", &state.enable_color_grading);
+			ImGui::SliderFloat("Contrast", &state.contrast, 0.0f, 2.0f, "%.2f");
+			ImGui::SliderFloat("Saturation", &state.saturation, 0.0f, 2.0f, "%.2f");
+			ImGui::ColorEdit3("Color filter", &state.color_filter.x);
+			ImGui::Checkbox("Vignette", &state.enable_vignette);
+			ImGui::SliderFloat("Vignette intensity", &state.vignette_intensity, 0.0f, 1.0f, "%.2f");
+			ImGui::SliderFloat("Vignette radius", &state.vignette_radius, 0.0f, 1.0f, "%.2f");
 		}
 		if (ImGui::CollapsingHeader("Entities"))
 		{
+			if (ImGui::Button("Export scene"))
+				state.export_scene_requested = true;
+			ImGui::SameLine();
+			if (ImGui::Button("Spawn 256 cubes"))
+				state.spawn_cubes_requested += 256;
+			ImGui::Text("Spawned cubes: %d", state.num_spawned_cubes);
+
 			ImGui::PushStyleVar(ImGuiStyleVar_IndentSpacing, ImGui::GetFontSize()*3);
 			EntityHandle node_clicked = -1;
-			for (const auto &it : state.entities_map)
+			for (isize slot = 0; slot < entities.num_slots(); slot++)
 			{
-				const EntityHandle curr_handle = it.first;
+				if (entities.locations[slot].archetype == -1 || entities.name[slot] == STRING_ID_NONE)
+					continue;
+
+				const EntityHandle curr_handle = make_entity_handle(slot, entities.generations[slot]);
 
 				const ImGuiTreeNodeFlags node_flags = ImGuiTreeNodeFlags_OpenOnArrow
 					| ImGuiTreeNodeFlags_OpenOnDoubleClick
@@ -103,28 +210,35 @@ dgui::draw(GLFWwindow *window, Entities &entities)
 
 				// ImGui::SetNextTreeNodeOpen(curr_handle == state.selected_entity_handle);
 				const bool node_open = ImGui::TreeNodeEx((void*)(intptr_t)curr_handle, node_flags,
-														 "%s", it.second.c_str());
+														 "%s", entities.names.get(entities.name[slot]));
 
-				if (ImGui::IsItemClicked())
+				if (ImGui::IsItemClicked() &&
+					entities.has_all(curr_handle, ComponentKind_Transform | ComponentKind_Renderable))
 					node_clicked = curr_handle;
 				if (node_open)
 				{
 					if (entities.has(curr_handle, ComponentKind_Transform))
 					{
-						// HACK: this code should be here just for testing.
-						// directly changing the transform matrix is kinda sneaky.
-						Mat4f &transform = entities.transform[curr_handle].mat;
+						// Edits the transform relative to the parent, the world matrix is
+						// recomputed by the hierarchy on the next update.
+						LocalTransform local = entities.hierarchy.local[entity_index(curr_handle)];
+						bool changed = false;
 
 						ImGui::Text("Position:");
-						draw_vec3(transform(0, 3), transform(1, 3), transform(2, 3), id++);
+						changed |= draw_vec3(local.position.x, local.position.y, local.position.z, id++);
+
+						ImGui::Text("Rotation:");
+						changed |= draw_vec3(local.rotation.x, local.rotation.y, local.rotation.z, id++);
 
 						ImGui::Text("Scale:");
-						draw_vec3(transform(0, 0), transform(1, 1), transform(2, 2), id++);
+						changed |= draw_vec3(local.scale.x, local.scale.y, local.scale.z, id++);
+
+						if (changed)
+							entities.hierarchy.set_local(curr_handle, local);
 
 						if (entities.has(curr_handle, ComponentKind_LightEmmiter))
 						{
-							LightEmmiter &le = entities.light_emmiter[curr_handle];
-							le.position = Vec3f(transform.col(3));
+							LightEmmiter &le = *entities.light_emmiter(curr_handle);
 
 							ImGui::Text("Light variables:");
 							ImGui::Text("Ambient:");
@@ -149,33 +263,98 @@ dgui::draw(GLFWwindow *window, Entities &entities)
 
 	if (ImGui::Begin("Performance", nullptr))
 	{
-		ImGui::PushStyleVar(ImGuiStyleVar_IndentSpacing, ImGui::GetFontSize()*3);
+		if (ImGui::CollapsingHeader("CPU zones", ImGuiTreeNodeFlags_DefaultOpen))
+		{
+			bool paused = profiler::is_paused();
+			if (ImGui::Checkbox("Pause profiler", &paused))
+				profiler::set_paused(paused);
+			ImGui::SameLine();
+			if (ImGui::Button("Write trace"))
+				profiler::write_chrome_trace("trace.json");
+			ImGui::BulletText("Frames kept: %d, zones dropped: %'lu", profiler::num_frames(),
+							  profiler::dropped_zones());
 
-		i32 node_clicked = -1;
-		lt_local_persist i32 selected_node = -1;
+			if (const ProfileFrame *frame = profiler::last_frame())
+			{
+				ImGui::BulletText("Frame: %.3f ms, %d zones",
+								  (frame->end - frame->begin) / profiler::cycles_per_ms(), (i32)frame->zones.size());
+				draw_flame_graph(*frame);
+			}
+		}
 
-		for (i32 i = 0; i < PerformanceRegion_Count; i++)
+		if (ImGui::CollapsingHeader("GPU passes", ImGuiTreeNodeFlags_DefaultOpen))
 		{
-			const u64 region_val = state.performance_regions[i];
+			for (i32 i = 0; i < GpuPass_Count; i++)
+			{
+				const GpuPassTiming &t = state.gpu_timings[i];
+				if (t.samples == 0)
+					ImGui::BulletText("%s: not issued", gpu_pass_names[i]);
+				else
+					ImGui::BulletText("%s: %.3f ms (avg %.3f, max %.3f over %d frames)", gpu_pass_names[i],
+									  t.last, t.average, t.max, t.samples);
+			}
+			ImGui::BulletText("Frames not ready in time: %'lu", state.gpu_dropped_frames);
+		}
 
-			const ImGuiTreeNodeFlags node_flags = ImGuiTreeNodeFlags_OpenOnArrow
-				| ImGuiTreeNodeFlags_OpenOnDoubleClick
-				| ((i == selected_node) ? ImGuiTreeNodeFlags_Selected : 0);
+		if (ImGui::CollapsingHeader("Systems", ImGuiTreeNodeFlags_DefaultOpen))
+		{
+			// Times come from the zones of the last frame, a system can run several times in it or
+			// not at all.
+			const ProfileFrame *frame = profiler::last_frame();
+			const f64 cycles_per_ms = profiler::cycles_per_ms();
+			for (const SystemInfo &info : state.systems)
+			{
+				u64 cycles = 0;
+				i32 runs = 0;
+				for (usize z = 0; frame && z < frame->zones.size(); z++)
+				{
+					const ProfileZone &zone = frame->zones[z];
+					if (zone.name == info.name)
+					{
+						cycles += zone.end - zone.begin;
+						runs++;
+					}
+				}
+				ImGui::BulletText("[level %d] %s: %.3f ms (%d runs)", info.level, info.name,
+								  cycles / cycles_per_ms, runs);
+			}
+		}
 
-			// ImGui::SetNextTreeNodeOpen(curr_handle == state.selected_entity_handle);
-			const bool node_open = ImGui::TreeNodeEx((void*)(intptr_t)i, node_flags,
-													 "%s: %'lu cycles", PerformanceRegionNames[i], region_val);
+		if (ImGui::CollapsingHeader("Render queue", ImGuiTreeNodeFlags_DefaultOpen))
+		{
+			const RenderStats &stats = state.render_stats;
+			ImGui::BulletText("Visible: %d, culled: %d, occluded: %d", stats.visible, stats.culled, stats.occluded);
+			ImGui::BulletText("Occluders: %d (%d triangles)", state.num_occluders, state.num_occluder_triangles);
+			ImGui::BulletText("Draw calls: %d (%d instances)", stats.draw_calls, stats.instances);
+			ImGui::BulletText("Shader changes: %d", stats.shader_changes);
+			ImGui::BulletText("Material changes: %d", stats.material_changes);
+			ImGui::BulletText("VAO changes: %d", stats.vao_changes);
+		}
 
-			if (ImGui::IsItemClicked())
-				node_clicked = i;
+		if (ImGui::CollapsingHeader("Shadow pass"))
+		{
+			const RenderStats &stats = state.shadow_stats;
+			ImGui::BulletText("Cascades redrawn: %d (%d static layers)", state.shadow_cascades_redrawn,
+							  state.shadow_static_layers_redrawn);
+			ImGui::BulletText("Casters drawn: %d, culled: %d (all cascades)", stats.visible, stats.culled);
+			ImGui::BulletText("Draw calls: %d (%d instances)", stats.draw_calls, stats.instances);
+		}
 
-			if (node_open)
-				ImGui::TreePop();
+		if (ImGui::CollapsingHeader("Light clusters"))
+		{
+			ImGui::BulletText("Grid: %dx%dx%d", CLUSTER_GRID_X, CLUSTER_GRID_Y, CLUSTER_GRID_Z);
+			ImGui::BulletText("Point lights: %d", state.num_point_lights);
+			ImGui::BulletText("Lights per cluster: %.2f", (f32)state.num_cluster_light_refs / CLUSTER_COUNT);
 		}
-		if (node_clicked != -1)
-			selected_node = (node_clicked == selected_node) ? -1 : node_clicked;
 
-		ImGui::PopStyleVar();
+		if (ImGui::CollapsingHeader("Jobs"))
+		{
+			for (i32 i = 0; i < jobs::num_threads(); i++)
+			{
+				const JobWorkerStats stats = jobs::worker_stats(i);
+				ImGui::BulletText("Thread %d: %'lu jobs (%'lu stolen)", i, stats.executed, stats.stolen);
+			}
+		}
 		ImGui::End();
 	}
 	// ImGui::ShowDemoWindow();
@@ -3,40 +3,24 @@
 
 // #include <vector>
 // #include <utility>
-#include <unordered_map>
+#include <vector>
 #include "lt_core.hpp"
 #include "lt_math.hpp"
 #include "entities.hpp"
-
-#define PERFORMANCE_KINDS \
-	PERFORMANCE_KIND(PerformanceRegion_RenderLoop = 0, "Render loop"), \
-	PERFORMANCE_KIND(PerformanceRegion_DrawEntities, "Draw entities"), \
-	PERFORMANCE_KIND(PerformanceRegion_UpdateLoop, "Update loop"),
+#include "render_queue.hpp"
+#include "gpu_profiler.hpp"
 
 struct GLFWwindow;
 
-enum PerformanceRegion
+namespace dgui
 {
-#define PERFORMANCE_KIND(e, s) e
-	PERFORMANCE_KINDS
-#undef PERFORMANCE_KIND
-	PerformanceRegion_Count,
-};
 
-lt_internal const char *PerformanceRegionNames[] =
+struct SystemInfo
 {
-#define PERFORMANCE_KIND(e, s) s
-	PERFORMANCE_KINDS
-#undef PERFORMANCE_KIND
+	const char *name;
+	i32         level;
 };
 
-
-namespace dgui
-{
-
-static_assert(LT_Count(PerformanceRegionNames) == PerformanceRegion_Count,
-			  "Both the char array and the enum should match");
-
 struct State
 {
 	bool enable_normal_mapping = true;
@@ -47,8 +31,20 @@ struct State
 	bool enable_gamma_correction = true;
 	bool enable_bloom = false;
 	bool display_bloom_filter = false;
+	i32 bloom_levels = 6;
+	bool enable_deferred_shading = false;
+	bool enable_depth_prepass = false;
+	bool show_overdraw = false;
+	bool enable_occlusion_culling = true;
 	f32  bloom_threshold = 1.0f;
 	f32  exposure = 1.0f;
+	bool enable_color_grading = false;
+	f32  contrast = 1.0f;
+	f32  saturation = 1.0f;
+	Vec3f color_filter = Vec3f(1.0f);
+	bool enable_vignette = false;
+	f32  vignette_intensity = 0.5f;
+	f32  vignette_radius = 0.5f;
 	f32  frame_time;
 	f32  fps;
 	f32  ups;
@@ -56,10 +52,34 @@ struct State
 	Vec3f camera_front;
 	f32 pcf_texel_offset = 1.0f;
 	i32 pcf_window_side = 3;
-	std::unordered_map<EntityHandle, std::string> entities_map;
 	EntityHandle selected_entity_handle = -1;
+	// Set by the gui, main writes the entities to the scene file and clears it.
+	bool export_scene_requested = false;
+	// Cubes the Spawner system records in the entity commands on its next run.
+	i32 spawn_cubes_requested = 0;
+	i32 num_spawned_cubes = 0;
+
+	GpuPassTiming gpu_timings[GpuPass_Count] = {};
+	u64 gpu_dropped_frames = 0;
+	std::vector<SystemInfo> systems;
+	RenderStats render_stats = {};
+	RenderStats shadow_stats = {};
+	i32 shadow_cascades_redrawn = 0;
+	i32 shadow_static_layers_redrawn = 0;
+	i32 shadow_cascades = 3;
+	f32 cascade_split_lambda = 0.75f;
+	f32 shadow_distance = 100.0f;
+	i32 shadow_map_cascade = 0; // Cascade shown by "Draw shadow map".
+	i32 num_occluders = 0;
+	i32 num_occluder_triangles = 0;
+	i32 num_point_lights = 0;
+	i32 num_cluster_light_refs = 0; // Sum of the lights listed in every cluster.
 
-	u64 performance_regions[PerformanceRegion_Count];
+	// The overdraw count is only taken by the forward path, and not with the shadow map shown.
+	bool showing_overdraw() const
+	{
+		return show_overdraw && !enable_deferred_shading && !draw_shadow_map;
+	}
 
 	static State &instance()
 	{
@@ -73,6 +93,8 @@ private:
 
 void draw(GLFWwindow *window, Entities &entities);
 void init(GLFWwindow *window);
+// True when the mouse is over a window of the gui, so clicks should not reach the scene.
+bool is_capturing_mouse();
 
 };
 
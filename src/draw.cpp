@@ -1,4 +1,6 @@
 #include "draw.hpp"
+#include <math.h>
+#include <string.h>
 
 #include "mesh.hpp"
 #include "shader.hpp"
@@ -7,6 +9,12 @@
 #include "camera.hpp"
 #include "application.hpp"
 #include "debug_gui.hpp"
+#include "render_queue.hpp"
+#include "culling.hpp"
+#include "light_clusters.hpp"
+#include "post_process.hpp"
+#include "occlusion.hpp"
+#include "gpu_profiler.hpp"
 
 lt_internal lt::Logger logger("draw");
 
@@ -21,34 +29,123 @@ create_shadow_map(i32 width, i32 height, Shader &shader)
 	sm.width = width;
 	sm.height = height;
 	sm.shader = &shader;
-	   
-	// Create the texture
+	sm.num_cascades = 3;
+	sm.split_lambda = 0.75f;
+	sm.max_distance = 100.0f;
+
+	// Create the texture, with a layer for each cascade.
 	glGenTextures(1, &sm.texture);
-	glBindTexture(GL_TEXTURE_2D, sm.texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, sm.texture);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT, width, height, 2 * MAX_SHADOW_CASCADES, 0,
+				 GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	const Vec4f border_color(1.0f, 1.0f, 1.0f, 1.0f);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER); 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);  
-	glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, &border_color.val[0]);  
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, &border_color.val[0]);
 
-	// Attach texture to the framebuffer
+	// Attach the first layer to the framebuffer, the rest are attached when they are drawn.
 	glGenFramebuffers(1, &sm.fbo);
 	glBindFramebuffer(GL_FRAMEBUFFER, sm.fbo);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, sm.texture, 0);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, sm.texture, 0, 0);
 	glDrawBuffer(GL_NONE);
 	glReadBuffer(GL_NONE);
 
 	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
 		logger.error("framebuffer not complete");
 
+	glGenFramebuffers(1, &sm.cache_fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, sm.cache_fbo);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, sm.texture, 0, MAX_SHADOW_CASCADES);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	return sm;
 }
 
 void
-draw_unit_quad(Mesh *mesh, Shader &shader, GLContext &context)
+fit_shadow_cascades(ShadowMap &sm, const Frustum &camera, const Vec3f &light_direction, LightsBlock &block)
+{
+	LT_Assert(sm.num_cascades > 0 && sm.num_cascades <= MAX_SHADOW_CASCADES);
+
+	// Every cascade shares the orientation of the light, only the projection moves. Keeping
+	// it at the origin is what lets the snapping below work in world units.
+	const Vec3f dir = lt::normalize(light_direction);
+	const Vec3f up = fabsf(dir.y) > 0.99f ? Vec3f(1, 0, 0) : Vec3f(0, 1, 0);
+	const Mat4f light_view = lt::look_at(Vec3f(0.0f), dir, up);
+
+	const f32 znear = camera.znear;
+	const f32 zfar = fminf(camera.zfar, sm.max_distance);
+	const f32 tan_y = tanf(lt::radians(camera.fovy) * 0.5f);
+	const f32 tan_x = tan_y * camera.ratio;
+	const Vec3f front = camera.front.v;
+
+	f32 split_near = znear;
+	for (i32 c = 0; c < sm.num_cascades; c++)
+	{
+		const f32 t = (f32)(c + 1) / sm.num_cascades;
+		const f32 log_split = znear * powf(zfar / znear, t);
+		const f32 uniform_split = znear + (zfar - znear) * t;
+		const f32 split_far = sm.split_lambda*log_split + (1.0f - sm.split_lambda)*uniform_split;
+
+		// A sphere around the corners of the split, measured in the frame of the camera so its
+		// size doesn't change when the camera moves or rotates, and neither do the texels.
+		const f32 mid = 0.5f * (split_near + split_far);
+		f32 radius = 0.0f;
+		for (i32 i = 0; i < 2; i++)
+		{
+			const f32 d = i ? split_far : split_near;
+			const Vec3f v(d*tan_x, d*tan_y, d - mid);
+			radius = fmaxf(radius, sqrtf(lt::dot(v, v)));
+		}
+		const Vec3f center = camera.position + front*mid;
+		const i32 radius_steps = (i32)ceilf(radius * 16.0f);
+		radius = radius_steps / 16.0f;
+
+		// The center is snapped to cells of whole texels, and the projection grows by a cell
+		// to still cover the sphere. The cascade only moves when the camera leaves its cell,
+		// and then by whole texels, so the shadow edges don't shimmer and the cached layers
+		// stay valid while it doesn't.
+		const i32 cell_texels = sm.width / 16;
+		const f32 texel = 2.0f * radius / (sm.width - cell_texels);
+		const f32 cell = cell_texels * texel;
+		const f32 lx = light_view(0, 0)*center.x + light_view(0, 1)*center.y + light_view(0, 2)*center.z;
+		const f32 ly = light_view(1, 0)*center.x + light_view(1, 1)*center.y + light_view(1, 2)*center.z;
+		const f32 lz = light_view(2, 0)*center.x + light_view(2, 1)*center.y + light_view(2, 2)*center.z;
+
+		ShadowCascade &cascade = sm.cascades[c];
+		cascade.key.light_direction = dir;
+		cascade.key.cell[0] = (i32)floorf(lx / cell);
+		cascade.key.cell[1] = (i32)floorf(ly / cell);
+		cascade.key.cell[2] = (i32)floorf(lz / cell);
+		cascade.key.radius = radius_steps;
+		const f32 x0 = cascade.key.cell[0] * cell;
+		const f32 y0 = cascade.key.cell[1] * cell;
+		const f32 z0 = cascade.key.cell[2] * cell;
+
+		// The light looks down -z. Casters between the split and the light are not clipped by
+		// the near plane, the shadow pass clamps their depth to it instead.
+		const f32 near_plane = -(z0 + cell) - radius;
+		const f32 far_plane = -z0 + radius;
+		const Mat4f projection = lt::orthographic(x0 - radius, x0 + cell + radius, y0 - radius, y0 + cell + radius,
+												  near_plane, far_plane);
+
+		cascade.light_space = projection * light_view;
+		cascade.caster_planes = frustum_planes_from_matrix(cascade.light_space);
+		cascade.caster_planes.planes[4] = Vec4f(0.0f, 0.0f, 0.0f, 1.0f); // The near plane keeps everything.
+		cascade.split_far = split_far;
+
+		block.light_space[c] = cascade.light_space;
+		block.cascade_splits[c] = split_far;
+		split_near = split_far;
+	}
+	block.num_shadow_cascades = sm.num_cascades;
+}
+
+void
+draw_unit_quad(Mesh *mesh, Shader &shader, GLContext &context, GLenum texture_target)
 {
 	using std::string;
 	context.use_shader(shader);
@@ -60,191 +157,647 @@ draw_unit_quad(Mesh *mesh, Shader &shader, GLContext &context)
 		Submesh sm = mesh->submeshes[i];
 		LT_Assert(sm.textures.size() == 1);
 
-		glBindTexture(GL_TEXTURE_2D, sm.textures[0].id);
+		glBindTexture(texture_target, sm.textures[0].id);
 		glDrawElements(GL_TRIANGLES, sm.num_indices, GL_UNSIGNED_INT, (const void*)sm.start_index);
 	}
 	context.unbind_vao();
 }
 
-void
-draw_unit_quad_and_apply_bloom(const Application &app, Shader &render_shader,
-							   Shader &bloom_shader, GLContext &context)
+//
+// Bloom over a chain of half resolution levels: the bright parts of the scene are filtered
+// down the chain with a 13 tap filter, then each level is upsampled with a tent filter and
+// added to the one above it. The wide blur comes from the small levels, so every pass
+// reads and writes a fraction of the screen.
+//
+lt_internal void
+apply_bloom(const Application &app, Shader &bloom_shader, i32 num_levels, GLContext &context)
 {
-	bool horizontal = true;
-	if (dgui::State::instance().enable_bloom)
+	// The deferred lighting doesn't write the bloom texture, the first level takes the
+	// bright parts of the scene instead.
+	const bool deferred = dgui::State::instance().enable_deferred_shading;
+	const u32 bright_texture = deferred ? app.hdr_texture : app.bloom_texture;
+
+	context.use_shader(bloom_shader);
+	context.bind_vao(app.render_quad->vao);
+	glBindFramebuffer(GL_FRAMEBUFFER, app.bloom_fbo);
+	glActiveTexture(GL_TEXTURE0);
+
+	bloom_shader.set1i("upsample", false);
+	for (i32 i = 0; i < num_levels; i++)
 	{
-		bool first_iteration = true;
-		i32 num_iterations = 10;
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, app.bloom_mips[i], 0);
+		glViewport(0, 0, app.bloom_mip_width[i], app.bloom_mip_height[i]);
+		bloom_shader.set1i("extract_bright", i == 0 && deferred);
+		glBindTexture(GL_TEXTURE_2D, i == 0 ? bright_texture : app.bloom_mips[i - 1]);
+		glDrawElements(GL_TRIANGLES, app.render_quad->number_of_indices(), GL_UNSIGNED_INT, 0);
+	}
 
-		context.use_shader(bloom_shader);
-		for (i32 i = 0; i < num_iterations; i++)
-		{
-			glBindFramebuffer(GL_FRAMEBUFFER, app.pingpong_fbos[horizontal]);
-			bloom_shader.set1i("horizontal", horizontal);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);
+	bloom_shader.set1i("upsample", true);
+	bloom_shader.set1i("extract_bright", false);
+	for (i32 i = num_levels - 1; i > 0; i--)
+	{
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, app.bloom_mips[i - 1], 0);
+		glViewport(0, 0, app.bloom_mip_width[i - 1], app.bloom_mip_height[i - 1]);
+		glBindTexture(GL_TEXTURE_2D, app.bloom_mips[i]);
+		glDrawElements(GL_TRIANGLES, app.render_quad->number_of_indices(), GL_UNSIGNED_INT, 0);
+	}
+	glDisable(GL_BLEND);
 
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D,
-						  first_iteration ? app.bloom_texture : app.pingpong_textures[!horizontal]);
+	context.unbind_vao();
+	glViewport(0, 0, app.screen_width, app.screen_height);
+}
 
-			context.bind_vao(app.render_quad->vao);
-			glDrawElements(GL_TRIANGLES, app.render_quad->number_of_indices(), GL_UNSIGNED_INT, 0);
-			context.unbind_vao();
+void
+draw_unit_quad_and_post_process(const Application &app, PostProcessChain &chain, Shader &bloom_shader,
+								GpuProfiler &profiler, GLContext &context)
+{
+	const auto &state = dgui::State::instance();
+	const bool overdraw = state.showing_overdraw();
+	if (state.enable_bloom && !overdraw)
+	{
+		gpu_pass_begin(profiler, GpuPass_Bloom);
+		apply_bloom(app, bloom_shader, state.bloom_levels, context);
+		gpu_pass_end(profiler, GpuPass_Bloom);
+	}
 
-			horizontal = !horizontal;
-			if (first_iteration)
-				first_iteration = false;
-		}
+	// The overdraw heat map replaces every other stage.
+	u32 stages = PostProcessStage_OverdrawHeatMap;
+	if (!overdraw)
+	{
+		stages = 0;
+		if (state.enable_bloom)
+			stages |= state.display_bloom_filter ? PostProcessStage_BloomOnly : PostProcessStage_Bloom;
+		if (state.enable_tone_mapping)
+			stages |= PostProcessStage_ToneMapping;
+		if (state.enable_color_grading)
+			stages |= PostProcessStage_ColorGrading;
+		if (state.enable_vignette)
+			stages |= PostProcessStage_Vignette;
+		if (state.enable_gamma_correction)
+			stages |= PostProcessStage_GammaCorrection;
 	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	context.use_shader(render_shader);
-	render_shader.set1i("display_bloom_filter", dgui::State::instance().display_bloom_filter);
-	render_shader.set1i("enable_bloom", dgui::State::instance().enable_bloom);
+	Shader &shader = chain.variant(stages, context);
 
-	glActiveTexture(GL_TEXTURE0 + render_shader.texture_unit("texture_scene"));
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	context.use_shader(shader);
+	shader.set1f("exposure", state.exposure);
+	// Every level was added into the first one.
+	shader.set1f("bloom_strength", 1.0f / state.bloom_levels);
+	shader.set1f("contrast", state.contrast);
+	shader.set1f("saturation", state.saturation);
+	shader.set3f("color_filter", state.color_filter);
+	shader.set1f("vignette_intensity", state.vignette_intensity);
+	shader.set1f("vignette_radius", state.vignette_radius);
+
+	glActiveTexture(GL_TEXTURE0 + shader.texture_unit("texture_scene"));
 	glBindTexture(GL_TEXTURE_2D, app.hdr_texture);
 
-	if (dgui::State::instance().enable_bloom)
+	if (stages & (PostProcessStage_Bloom | PostProcessStage_BloomOnly))
 	{
-		const i32 last_index = !horizontal;
-		glActiveTexture(GL_TEXTURE0 + render_shader.texture_unit("texture_bloom"));
-		glBindTexture(GL_TEXTURE_2D, app.pingpong_textures[last_index]);
+		glActiveTexture(GL_TEXTURE0 + shader.texture_unit("texture_bloom"));
+		glBindTexture(GL_TEXTURE_2D, app.bloom_mips[0]);
 	}
 
+	gpu_pass_begin(profiler, GpuPass_PostProcess);
 	context.bind_vao(app.render_quad->vao);
 	glDrawElements(GL_TRIANGLES, app.render_quad->number_of_indices(), GL_UNSIGNED_INT, 0);
 	context.unbind_vao();
+	gpu_pass_end(profiler, GpuPass_PostProcess);
 }
 
-void
-draw_entities_for_shadow_map(const Entities &e, const Mat4f &light_view, const Vec3f &light_pos,
-							 ShadowMap &shadow_map, GLContext &context)
+// Fills the instance buffer of the mesh with the model matrices of the batch.
+lt_internal void
+upload_instances(const Mesh &mesh, const std::vector<Mat4f> &models)
 {
-	for (isize handle = 0; handle < MAX_ENTITIES; handle++)
-	{
-		if ((e.mask[handle] & SHADOW_CASTER_MASK) == SHADOW_CASTER_MASK)
-		{
-			// Draw lights first
-			Mesh *mesh = e.renderable[handle].mesh;
+	LT_Assert(mesh.instance_vbo != 0);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh.instance_vbo);
+	// Specifying the whole store again lets the driver orphan the one still in use by earlier draws.
+	glBufferData(GL_ARRAY_BUFFER, models.size() * sizeof(Mat4f), models.data(), GL_STREAM_DRAW);
+}
 
-			context.use_shader(*shadow_map.shader);
-			shadow_map.shader->set_matrix("model", e.transform[handle].mat);
+enum ShadowCasters
+{
+	ShadowCasters_Settled,
+	ShadowCasters_Moving,
+};
+
+// Draws the casters inside the light volume of the cascade to the bound layer.
+lt_internal void
+draw_shadow_casters(const Entities &e, const ShadowCascade &cascade, ShadowCasters which, Shader *shader,
+					RenderQueue &queue, GLContext &context, RenderStats &stats)
+{
+	queue.clear();
+	for (const Archetype &arch : e.archetypes)
+	{
+		if (!arch.matches(SHADOW_CASTER_MASK))
+			continue;
 
-			context.bind_vao(mesh->vao);
-			glDrawElements(GL_TRIANGLES, mesh->number_of_indices(), GL_UNSIGNED_INT, 0);
-			context.unbind_vao();
+		for (const EntityChunk *chunk : arch.chunks)
+		{
+			const BoundsSoA bounds = {
+				{chunk->bounds_center[0], chunk->bounds_center[1], chunk->bounds_center[2]},
+				{chunk->bounds_extent[0], chunk->bounds_extent[1], chunk->bounds_extent[2]},
+			};
+			queue.visible.resize(chunk->count);
+			const i32 num_visible = frustum_cull(cascade.caster_planes, bounds, chunk->count, queue.visible.data());
+			// Both passes cull the same casters, they are counted once per cascade.
+			if (which == ShadowCasters_Moving)
+				stats.culled += chunk->count - num_visible;
+
+			for (i32 row = 0; row < chunk->count; row++)
+			{
+				if (!queue.visible[row])
+					continue;
+
+				const u64 moved_tick = e.caster_moved_tick[entity_index(chunk->handles[row])];
+				const bool settled = moved_tick + SHADOW_CASTER_SETTLE_TICKS <= cascade.static_tick;
+				if (settled != (which == ShadowCasters_Settled))
+					continue;
+
+				RenderItem item = {};
+				item.model = &chunk->transform[row].mat;
+				item.mesh = chunk->renderable[row].mesh;
+				item.shader = shader;
+				queue.push(render_key(RenderPass_Shadow, shader->program, 0, item.mesh->vao, 0.0f), item);
+				stats.visible++;
+			}
 		}
 	}
+	queue.sort();
+
+	// Every caster with the same mesh goes in a single draw.
+	for (usize i = 0; i < queue.size(); )
+	{
+		const Mesh *mesh = queue[i].mesh;
+
+		queue.instances.clear();
+		for (; i < queue.size() && queue[i].mesh == mesh; i++)
+			queue.instances.push_back(*queue[i].model);
+
+		upload_instances(*mesh, queue.instances);
+		context.bind_vao(mesh->vao);
+		glDrawElementsInstanced(GL_TRIANGLES, mesh->number_of_indices(), GL_UNSIGNED_INT, 0,
+								queue.instances.size());
+		stats.draw_calls++;
+		stats.instances += queue.instances.size();
+	}
+}
+
+// Whether a layer drawn with the key is still valid for the cascade.
+lt_internal inline bool
+same_view(const ShadowCascade &cascade, const ShadowCascadeKey &key)
+{
+	return memcmp(&cascade.key, &key, sizeof(ShadowCascadeKey)) == 0;
 }
 
 void
-draw_entities(f64 lag_offset, const Entities &e, const Camera &camera, GLContext &context,
-			  ShadowMap &shadow_map, EntityHandle selected_entity)
+draw_entities_for_shadow_map(const Entities &e, ShadowMap &shadow_map, RenderQueue &queue, GLContext &context)
 {
-	const Mat4f view_matrix = camera.view_matrix();
+	Shader *shader = shadow_map.shader;
+	RenderStats stats = {};
+	i32 redrawn = 0, static_redrawn = 0;
+	bool bound = false;
 
-	for (EntityHandle handle = 0; handle < MAX_ENTITIES; handle++)
+	for (i32 c = 0; c < shadow_map.num_cascades; c++)
 	{
-		if ((e.mask[handle] & LIGHT_MASK) == LIGHT_MASK)
-		{
-			// Draw lights first
-			Shader *shader = e.renderable[handle].shader;
-			const Mesh *mesh = e.renderable[handle].mesh;
-			const LightEmmiter le = e.light_emmiter[handle];
+		ShadowCascade &cascade = shadow_map.cascades[c];
+		if (cascade.drawn && cascade.drawn_caster_revision == e.caster_revision
+			&& same_view(cascade, cascade.drawn_key))
+			continue;
 
+		if (!bound)
+		{
 			context.use_shader(*shader);
+			glViewport(0, 0, shadow_map.width, shadow_map.height);
+			glBindFramebuffer(GL_FRAMEBUFFER, shadow_map.fbo);
+			glDisable(GL_CULL_FACE);
+			glEnable(GL_DEPTH_CLAMP);
+			bound = true;
+		}
+		shader->set1i("cascade", c);
 
-			shader->set_matrix("model", e.transform[handle].mat);
-			shader->set_matrix("view", view_matrix);
-			shader->set3f("light_color", le.diffuse);
-			shader->set1f("bloom_threshold", dgui::State::instance().bloom_threshold);
+		// The static layer goes stale when the cascade moves or a caster in it moves.
+		if (!cascade.static_drawn || cascade.static_settled_revision != e.settled_caster_revision
+			|| !same_view(cascade, cascade.static_key))
+		{
+			cascade.static_tick = e.bounds_tick;
+			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadow_map.texture, 0,
+									  MAX_SHADOW_CASCADES + c);
+			glClear(GL_DEPTH_BUFFER_BIT);
+			draw_shadow_casters(e, cascade, ShadowCasters_Settled, shader, queue, context, stats);
+
+			cascade.static_drawn = true;
+			cascade.static_key = cascade.key;
+			cascade.static_settled_revision = e.settled_caster_revision;
+			static_redrawn++;
+		}
 
-			if (handle == selected_entity)
-				glStencilMask(0xff);
+		// Start from the settled casters, then add the ones that moved since.
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadow_map.texture, 0, c);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, shadow_map.cache_fbo);
+		glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadow_map.texture, 0,
+								  MAX_SHADOW_CASCADES + c);
+		glBlitFramebuffer(0, 0, shadow_map.width, shadow_map.height, 0, 0, shadow_map.width, shadow_map.height,
+						  GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, shadow_map.fbo);
+		draw_shadow_casters(e, cascade, ShadowCasters_Moving, shader, queue, context, stats);
+
+		cascade.drawn = true;
+		cascade.drawn_key = cascade.key;
+		cascade.drawn_caster_revision = e.caster_revision;
+		redrawn++;
+	}
 
-			context.bind_vao(mesh->vao);
-			for (usize i = 0; i < mesh->submeshes.size(); i++)
+	if (bound)
+	{
+		context.unbind_vao();
+		glDisable(GL_DEPTH_CLAMP);
+		glEnable(GL_CULL_FACE);
+	}
+	auto &state = dgui::State::instance();
+	state.shadow_stats = stats;
+	state.shadow_cascades_redrawn = redrawn;
+	state.shadow_static_layers_redrawn = static_redrawn;
+}
+
+#define MAX_TEXTURE_UNITS 16
+
+// Pushes the entities inside the view frustum to the queue.
+lt_internal void
+build_render_queue(const Entities &e, const Camera &camera, const Mat4f &view_matrix, const OcclusionBuffer &occlusion,
+				   EntityHandle selected_entity, RenderQueue &queue, RenderStats &stats)
+{
+	const Vec3f camera_pos = camera.frustum.position;
+	const Vec3f camera_front = camera.frustum.front.v;
+	const f32 inv_zfar = 1.0f / camera.frustum.zfar;
+	const FrustumPlanes frustum = frustum_planes_from_matrix(camera.frustum.projection * view_matrix);
+
+	queue.clear();
+	for (const Archetype &arch : e.archetypes)
+	{
+		if (!arch.matches(RENDER_MASK))
+			continue;
+
+		const bool is_light = arch.matches(LIGHT_MASK);
+		// Occluders would only be tested against themselves.
+		const bool is_occluder = arch.matches(ComponentKind_Occluder);
+		const RenderPass pass = is_light ? RenderPass_Lights : RenderPass_Opaque;
+
+		for (const EntityChunk *chunk : arch.chunks)
+		{
+			const BoundsSoA bounds = {
+				{chunk->bounds_center[0], chunk->bounds_center[1], chunk->bounds_center[2]},
+				{chunk->bounds_extent[0], chunk->bounds_extent[1], chunk->bounds_extent[2]},
+			};
+			queue.visible.resize(chunk->count);
+			const i32 num_visible = frustum_cull(frustum, bounds, chunk->count, queue.visible.data());
+			stats.visible += num_visible;
+			stats.culled += chunk->count - num_visible;
+
+			for (i32 row = 0; row < chunk->count; row++)
 			{
-				Submesh sm = mesh->submeshes[i];
-				glDrawElements(GL_TRIANGLES, sm.num_indices, GL_UNSIGNED_INT, (const void*)sm.start_index);
-			}
-			context.unbind_vao();
-
-			context.use_shader(*le.shader);
-            for (isize i = 0; i < 4; ++i)
-            {
-				std::string i_str = std::to_string(i);
-				le.shader->set3f(("point_lights["+i_str+"].position").c_str(), le.position);
-				le.shader->set3f(("point_lights["+i_str+"].ambient").c_str(), le.ambient);
-				le.shader->set3f(("point_lights["+i_str+"].diffuse").c_str(), le.diffuse);
-				le.shader->set3f(("point_lights["+i_str+"].specular").c_str(), le.specular);
-				le.shader->set1f(("point_lights["+i_str+"].constant").c_str(), le.constant);
-				le.shader->set1f(("point_lights["+i_str+"].linear").c_str(), le.linear);
-				le.shader->set1f(("point_lights["+i_str+"].quadratic").c_str(), le.quadratic);
+				if (!queue.visible[row])
+					continue;
+
+				if (!is_occluder)
+				{
+					const Vec3f center(bounds.center[0][row], bounds.center[1][row], bounds.center[2][row]);
+					const Vec3f extent(bounds.extent[0][row], bounds.extent[1][row], bounds.extent[2][row]);
+					if (!is_box_visible(occlusion, center, extent))
+					{
+						stats.visible--;
+						stats.occluded++;
+						continue;
+					}
+				}
+
+				const Renderable &r = chunk->renderable[row];
+				const Mat4f &model = chunk->transform[row].mat;
+				const Vec3f position(model(0, 3), model(1, 3), model(2, 3));
+				const f32 depth = lt::dot(position - camera_pos, camera_front) * inv_zfar;
+
+				RenderItem item = {};
+				item.model = &model;
+				item.mesh = r.mesh;
+				item.shader = r.shader;
+				item.shininess = r.shininess;
+				item.selected = chunk->handles[row] == selected_entity;
+				if (is_light)
+					item.light = &chunk->light_emmiter[row];
+
+				for (const Submesh &sm : r.mesh->submeshes)
+				{
+					item.submesh = &sm;
+					queue.push(render_key(pass, r.shader->program, sm.material, r.mesh->vao, depth), item);
+				}
 			}
 		}
-		else if ((e.mask[handle] & RENDER_MASK) == RENDER_MASK)
-		{
-			using std::string;
+	}
+	queue.sort();
+}
 
-			Shader *shader = e.renderable[handle].shader;
-			Mesh *mesh = e.renderable[handle].mesh;
+lt_internal inline void
+bind_texture(u32 *bound_textures, u32 unit, GLenum target, u32 texture)
+{
+	LT_Assert(unit < MAX_TEXTURE_UNITS);
+	if (bound_textures[unit] != texture)
+	{
+		glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(target, texture);
+		bound_textures[unit] = texture;
+	}
+}
 
-			context.use_shader(*shader);
+// Opaque draws are merged into one instanced draw when nothing but the model matrix differs.
+lt_internal inline bool
+can_batch(const RenderItem &a, const RenderItem &b)
+{
+	return a.mesh == b.mesh && a.submesh == b.submesh && a.shader == b.shader
+		&& a.shininess == b.shininess && a.selected == b.selected;
+}
 
-			shader->set_matrix("model", e.transform[handle].mat);
-			shader->set_matrix("view", view_matrix);
-            shader->set3f("view_position", camera.frustum.position);
-            shader->set1f("material.shininess", e.renderable[handle].shininess);
-			shader->set1f("bloom_threshold", dgui::State::instance().bloom_threshold);
+// Shader the opaque draws of a submission run.
+enum OpaqueShading
+{
+	// Their own shader, lit with the shadow map and the light clusters.
+	OpaqueShading_Lit,
+	// The override shader, which writes the materials to the G-buffer.
+	OpaqueShading_GBuffer,
+	// The override shader without materials, for the depth pre-pass and the overdraw count.
+	OpaqueShading_Untextured,
+};
+
+//
+// Draws the sorted queue from begin to end, only issuing the state that differs from the
+// previous draw. The uniforms that are the same for the whole frame come from the uniform
+// buffers.
+//
+lt_internal void
+submit_render_queue(RenderQueue &queue, usize begin, usize end, GLContext &context, ShadowMap &shadow_map,
+					const LightClusters &clusters, OpaqueShading shading, Shader *override_shader,
+					RenderStats &stats)
+{
+	LT_Assert((shading == OpaqueShading_Lit) == (override_shader == nullptr));
+
+	const u32 NONE = 0xffffffff;
+
+	u32 bound_textures[MAX_TEXTURE_UNITS];
+	for (i32 i = 0; i < MAX_TEXTURE_UNITS; i++)
+		bound_textures[i] = NONE;
 
-			// Config the shadow map texture
+	Shader *shader = nullptr;
+	RenderPass pass = RenderPass_Count;
+	u32 material = NONE;
+	f32 shininess = -1.0f;
+
+	for (usize i = begin; i < end; )
+	{
+		const RenderItem &item = queue[i];
+		const Submesh &sm = *item.submesh;
+		const RenderPass item_pass = render_key_pass(queue.key(i));
+		Shader *item_shader = item_pass == RenderPass_Opaque && override_shader ? override_shader : item.shader;
+
+		if (item_shader != shader || item_pass != pass)
+		{
+			shader = item_shader;
+			pass = item_pass;
+			material = NONE;
+			shininess = -1.0f;
+
+			context.use_shader(*shader);
+			if (pass == RenderPass_Opaque && shading == OpaqueShading_Lit)
 			{
-				u32 tex_unit = shader->texture_unit("texture_shadow_map");
-				glActiveTexture(GL_TEXTURE0 + tex_unit);
-				// shader->set1i("texture_shadow_map", tex_unit);
-				glBindTexture(GL_TEXTURE_2D, shadow_map.texture);
+				bind_texture(bound_textures, shader->texture_unit("texture_shadow_map"), GL_TEXTURE_2D_ARRAY,
+							 shadow_map.texture);
+				for (i32 t = 0; t < ClusterTexture_Count; t++)
+					bind_texture(bound_textures, shader->texture_unit(cluster_texture_names[t]), GL_TEXTURE_BUFFER,
+								 clusters.textures[t]);
 			}
+			stats.shader_changes++;
+		}
 
-			if (handle == selected_entity)
-				glStencilMask(0xff);
+		if (context.bound_vao != item.mesh->vao)
+		{
+			context.bind_vao(item.mesh->vao);
+			stats.vao_changes++;
+		}
 
-			context.bind_vao(mesh->vao);
-			for (usize i = 0; i < mesh->submeshes.size(); i++)
+		if (item.selected)
+			glStencilMask(0xff);
+
+		if (pass == RenderPass_Lights)
+		{
+			// Lights have a color each, they are not worth instancing.
+			shader->set_matrix("model", *item.model);
+			shader->set3f("light_color", item.light->diffuse);
+			glDrawElements(GL_TRIANGLES, sm.num_indices, GL_UNSIGNED_INT, (const void*)sm.start_index);
+			stats.instances++;
+			i++;
+		}
+		else
+		{
+			// Untextured draws only need the vertices.
+			if (shading != OpaqueShading_Untextured && sm.material != material)
 			{
 				bool use_normal_map = false;
-				Submesh sm = mesh->submeshes[i];
-
-				for (usize t = 0; t < sm.textures.size(); t++)
+				for (const Texture &texture : sm.textures)
 				{
-					string name = sm.textures[t].type;
-					u32 texture_unit = shader->texture_unit(name);
-					glActiveTexture(GL_TEXTURE0 + texture_unit);
-
-					if (name == "material.texture_normal1")
+					if (texture.type == "material.texture_normal1")
 						use_normal_map = true;
-
-					// shader->set1i(name.c_str(), texture_unit);
-					glBindTexture(GL_TEXTURE_2D, sm.textures[t].id);
+					bind_texture(bound_textures, shader->texture_unit(texture.type), GL_TEXTURE_2D, texture.id);
 				}
 				shader->set1i("material.use_normal_map", use_normal_map);
+				material = sm.material;
+				stats.material_changes++;
+			}
 
-				glDrawElements(GL_TRIANGLES, sm.num_indices, GL_UNSIGNED_INT, (const void*)sm.start_index);
+			if (shading != OpaqueShading_Untextured && item.shininess != shininess)
+			{
+				shader->set1f("material.shininess", item.shininess);
+				shininess = item.shininess;
 			}
-			context.unbind_vao();
-			glActiveTexture(GL_TEXTURE0);
+
+			queue.instances.clear();
+			for (; i < end && render_key_pass(queue.key(i)) == pass && can_batch(queue[i], item); i++)
+				queue.instances.push_back(*queue[i].model);
+
+			upload_instances(*item.mesh, queue.instances);
+			glDrawElementsInstanced(GL_TRIANGLES, sm.num_indices, GL_UNSIGNED_INT,
+									(const void*)sm.start_index, queue.instances.size());
+			stats.instances += queue.instances.size();
+		}
+
+		if (item.selected)
+			glStencilMask(0x00);
+		stats.draw_calls++;
+	}
+
+	context.unbind_vao();
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void
+draw_entities(f64 lag_offset, const Entities &e, const Camera &camera, GLContext &context,
+			  ShadowMap &shadow_map, const LightClusters &clusters, const OcclusionBuffer &occlusion,
+			  RenderQueue &queue, Shader &depth_prepass_shader, Shader &overdraw_shader,
+			  EntityHandle selected_entity)
+{
+	const auto &state = dgui::State::instance();
+	const Mat4f view_matrix = camera.view_matrix();
+
+	RenderStats stats = {};
+	build_render_queue(e, camera, view_matrix, occlusion, selected_entity, queue, stats);
+
+	usize begin, end;
+	queue.pass_range(RenderPass_Opaque, begin, end);
+
+	// With the nearest depth of every pixel laid down first, the lighting only runs for the
+	// fragments that end up on screen.
+	if (state.enable_depth_prepass)
+	{
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		submit_render_queue(queue, begin, end, context, shadow_map, clusters, OpaqueShading_Untextured,
+							&depth_prepass_shader, stats);
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		glDepthFunc(GL_EQUAL);
+		glDepthMask(GL_FALSE);
+	}
+
+	if (state.showing_overdraw())
+	{
+		// Every fragment that passes the depth test adds one to the red channel.
+		const u32 hdr_color = GL_COLOR_ATTACHMENT0;
+		glDrawBuffers(1, &hdr_color);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_ONE, GL_ONE);
+		submit_render_queue(queue, begin, end, context, shadow_map, clusters, OpaqueShading_Untextured,
+							&overdraw_shader, stats);
+		glDisable(GL_BLEND);
+		const u32 attachments[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+		glDrawBuffers(2, attachments);
+	}
+	else
+	{
+		submit_render_queue(queue, begin, end, context, shadow_map, clusters, OpaqueShading_Lit, nullptr, stats);
+	}
+
+	glDepthFunc(GL_LESS);
+	glDepthMask(GL_TRUE);
+
+	if (!state.showing_overdraw())
+	{
+		queue.pass_range(RenderPass_Lights, begin, end);
+		submit_render_queue(queue, begin, end, context, shadow_map, clusters, OpaqueShading_Lit, nullptr, stats);
+	}
+	dgui::State::instance().render_stats = stats;
+}
+
+void
+draw_entities_deferred(const Application &app, const Entities &e, const Camera &camera, GLContext &context,
+					   ShadowMap &shadow_map, const LightClusters &clusters, const OcclusionBuffer &occlusion,
+					   RenderQueue &queue, Shader &gbuffer_shader, Shader &lighting_shader, const Mesh *light_volume,
+					   EntityHandle selected_entity)
+{
+	const Mat4f view_matrix = camera.view_matrix();
+	const i32 w = app.screen_width, h = app.screen_height;
+
+	RenderStats stats = {};
+	build_render_queue(e, camera, view_matrix, occlusion, selected_entity, queue, stats);
+
+	// Geometry pass, the selected entity still marks the stencil buffer.
+	usize begin, end;
+	queue.pass_range(RenderPass_Opaque, begin, end);
+	glBindFramebuffer(GL_FRAMEBUFFER, app.gbuffer_fbo);
+	glStencilMask(0xff);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+	glStencilMask(0x00);
+	submit_render_queue(queue, begin, end, context, shadow_map, clusters, OpaqueShading_GBuffer, &gbuffer_shader,
+						stats);
+
+	// Everything drawn after the lighting is tested against the depth and stencil of the G-buffer.
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, app.gbuffer_fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, app.hdr_fbo);
+	glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, app.hdr_fbo);
+
+	// Lighting pass, each light adds its contribution to the HDR color. The bright parts are
+	// extracted by the bloom afterwards, the sum isn't known while the lights are drawn.
+	const u32 hdr_color = GL_COLOR_ATTACHMENT0;
+	glDrawBuffers(1, &hdr_color);
+	glDepthMask(GL_FALSE);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);
+
+	context.use_shader(lighting_shader);
+	for (i32 i = 0; i < GBufferTarget_Count; i++)
+	{
+		glActiveTexture(GL_TEXTURE0 + lighting_shader.texture_unit(gbuffer_texture_names[i]));
+		glBindTexture(GL_TEXTURE_2D, app.gbuffer_textures[i]);
+	}
+	glActiveTexture(GL_TEXTURE0 + lighting_shader.texture_unit("texture_depth"));
+	glBindTexture(GL_TEXTURE_2D, app.gbuffer_depth);
+	glActiveTexture(GL_TEXTURE0 + lighting_shader.texture_unit("texture_shadow_map"));
+	glBindTexture(GL_TEXTURE_2D_ARRAY, shadow_map.texture);
+	glActiveTexture(GL_TEXTURE0 + lighting_shader.texture_unit(cluster_texture_names[ClusterTexture_LightData]));
+	glBindTexture(GL_TEXTURE_BUFFER, clusters.textures[ClusterTexture_LightData]);
+
+	// The directional light covers the whole screen.
+	glDisable(GL_DEPTH_TEST);
+	lighting_shader.set1i("point_lights", false);
+	context.bind_vao(app.render_quad->vao);
+	glDrawElements(GL_TRIANGLES, app.render_quad->number_of_indices(), GL_UNSIGNED_INT, 0);
+	stats.draw_calls++;
+	glEnable(GL_DEPTH_TEST);
+
+	// Point lights are boxes around their radius, all of them in one instanced draw. Only the
+	// back faces behind a surface are drawn, which covers every pixel the light reaches even
+	// with the camera inside the box, and depth clamping keeps the ones past the far plane.
+	if (!clusters.lights.empty())
+	{
+		queue.instances.clear();
+		for (const ClusterLight &light : clusters.lights)
+		{
+			const Vec4f &pr = light.position_radius;
+			Mat4f model = lt::translation(Mat4f(1), Vec3f(pr.x, pr.y, pr.z));
+			queue.instances.push_back(lt::scale(model, Vec3f(pr.w)));
 		}
-		glStencilMask(0x00);
+		upload_instances(*light_volume, queue.instances);
+
+		glCullFace(GL_FRONT);
+		glDepthFunc(GL_GEQUAL);
+		glEnable(GL_DEPTH_CLAMP);
+		lighting_shader.set1i("point_lights", true);
+		context.bind_vao(light_volume->vao);
+		glDrawElementsInstanced(GL_TRIANGLES, light_volume->number_of_indices(), GL_UNSIGNED_INT, 0,
+								queue.instances.size());
+		stats.draw_calls++;
+		glDisable(GL_DEPTH_CLAMP);
+		glDepthFunc(GL_LESS);
+		glCullFace(GL_BACK);
 	}
+	context.unbind_vao();
+	glActiveTexture(GL_TEXTURE0);
+
+	glDisable(GL_BLEND);
+	glDepthMask(GL_TRUE);
+	const u32 attachments[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+	glDrawBuffers(2, attachments);
+
+	// The light cubes are unlit, they go straight to the HDR framebuffer.
+	queue.pass_range(RenderPass_Lights, begin, end);
+	submit_render_queue(queue, begin, end, context, shadow_map, clusters, OpaqueShading_Lit, nullptr, stats);
+	dgui::State::instance().render_stats = stats;
 }
 
 void
-draw_skybox(const Mesh *mesh, Shader &shader, const Mat4f &view, GLContext &context)
+draw_skybox(const Mesh *mesh, Shader &shader, GLContext &context)
 {
 	glDepthFunc(GL_LEQUAL);
 
 	context.use_shader(shader);
-	shader.set_matrix("view", view);
 
     context.bind_vao(mesh->vao);
 	for (usize i = 0; i < mesh->submeshes.size(); i++)
@@ -263,16 +816,15 @@ draw_skybox(const Mesh *mesh, Shader &shader, const Mat4f &view, GLContext &cont
 
 void
 draw_selected_entity(const Entities &e, EntityHandle handle, Shader &selection_shader,
-					 const Mat4f &view, GLContext &context)
+					 GLContext &context)
 {
-	Mesh *mesh = e.renderable[handle].mesh;
-	Mat4f transform = e.transform[handle].mat;
+	const Mesh *mesh = e.renderable(handle)->mesh;
+	const Mat4f transform = e.transform(handle)->mat;
 
 	Mat4f new_transform = lt::scale(transform, Vec3f(1.04f));
 
 	// Draw selection upscaled with a simple shader
 	context.use_shader(selection_shader);
-	selection_shader.set_matrix("view", view);
 	selection_shader.set_matrix("model", new_transform);
 
     context.bind_vao(mesh->vao);
@@ -5,6 +5,7 @@
 #include "lt_math.hpp"
 #include "glad/glad.h"
 #include "entities.hpp"
+#include "uniform_blocks.hpp"
 
 struct Mesh;
 struct Shader;
@@ -13,32 +14,102 @@ struct CubemapMesh;
 struct Entities;
 struct Camera;
 struct Application;
+struct RenderQueue;
+struct LightClusters;
+struct Frustum;
+struct PostProcessChain;
+struct OcclusionBuffer;
+struct GpuProfiler;
 
+// Where a cascade sits in the light space, in whole snapping cells. Everything the cascade is
+// drawn with comes from it, so layers drawn with an equal key are still valid.
+struct ShadowCascadeKey
+{
+	Vec3f light_direction;
+	i32   cell[3];
+	i32   radius; // In 1/16 of a world unit.
+};
+
+struct ShadowCascade
+{
+	Mat4f            light_space;
+	// Casters are culled with the sides and far plane of the light volume, anything closer to
+	// the light than the near plane can still shadow the cascade.
+	FrustumPlanes    caster_planes;
+	f32              split_far; // View depth where the cascade ends.
+	ShadowCascadeKey key;
+
+	// What the layers were last drawn with, compared to the revisions of the entities.
+	bool             drawn;
+	ShadowCascadeKey drawn_key;
+	u64              drawn_caster_revision;
+	bool             static_drawn;
+	ShadowCascadeKey static_key;
+	u64              static_settled_revision;
+	u64              static_tick; // Casters that had settled by this tick are in the static layer.
+};
+
+//
+// Cascaded shadow map of the directional light. The camera frustum is split in depth up to
+// max_distance, and each split gets an orthographic projection fitted around it in its own
+// layer of the texture array.
+//
+// Layers are only redrawn when their light space or the shadow casters change. Settled
+// casters are cached in a static layer per cascade, which is copied under the moving ones.
+//
 struct ShadowMap
 {
 	Shader *shader;
 	u32 fbo;
+	u32 cache_fbo; // Reads the static layers.
+	// Depth texture array, the cascades in the first MAX_SHADOW_CASCADES layers and their
+	// static layers in the rest.
 	u32 texture;
 	i32 width, height;
 
+	i32 num_cascades;
+	// Blend between uniform (0) and logarithmic (1) split distances.
+	f32 split_lambda;
+	f32 max_distance;
+	ShadowCascade cascades[MAX_SHADOW_CASCADES];
+
 	~ShadowMap()
 	{
 		glDeleteFramebuffers(1, &fbo);
+		glDeleteFramebuffers(1, &cache_fbo);
 	}
 };
 
 ShadowMap create_shadow_map(i32 width, i32 height, Shader &shader);
+// Fits the cascades to the camera frustum and writes their light spaces to the block.
+void      fit_shadow_cascades(ShadowMap &shadow_map, const Frustum &camera, const Vec3f &light_direction,
+							  LightsBlock &block);
 
-void draw_skybox(const Mesh *skybox_mesh, Shader &shader, const Mat4f &view, GLContext &context);
+void draw_skybox(const Mesh *skybox_mesh, Shader &shader, GLContext &context);
+// Both draw every entity sharing a mesh and material with a single instanced draw call, and
+// skip the ones the occlusion buffer hides.
+// The opaque entities can go through a depth pre-pass first, or be drawn as an overdraw
+// count, see the rendering options.
 void draw_entities(f64 lag_offset, const Entities &e, const Camera &camera, GLContext &context,
-				   ShadowMap &shadow_map, EntityHandle selected_entity = -1);
-void draw_entities_for_shadow_map(const Entities &e, const Mat4f &light_view, const Vec3f &light_pos,
-								  ShadowMap &shadow_map, GLContext &context);
-void draw_unit_quad(Mesh *mesh, Shader &shader, GLContext &context);
+				   ShadowMap &shadow_map, const LightClusters &clusters, const OcclusionBuffer &occlusion,
+				   RenderQueue &queue, Shader &depth_prepass_shader, Shader &overdraw_shader,
+				   EntityHandle selected_entity = -1);
+// Same as draw_entities, but lights the opaque entities once per pixel from the G-buffer of
+// the application. Point lights are drawn as light volumes.
+void draw_entities_deferred(const Application &app, const Entities &e, const Camera &camera, GLContext &context,
+							ShadowMap &shadow_map, const LightClusters &clusters, const OcclusionBuffer &occlusion,
+							RenderQueue &queue, Shader &gbuffer_shader, Shader &lighting_shader,
+							const Mesh *light_volume,
+							EntityHandle selected_entity = -1);
+// Renders the cascades that changed, only with the casters inside their light volume.
+void draw_entities_for_shadow_map(const Entities &e, ShadowMap &shadow_map, RenderQueue &queue, GLContext &context);
+void draw_unit_quad(Mesh *mesh, Shader &shader, GLContext &context, GLenum texture_target = GL_TEXTURE_2D);
 void draw_selected_entity(const Entities &e, EntityHandle handle, Shader &selection_shader,
-						  const Mat4f &view, GLContext &context);
+						  GLContext &context);
 
-void draw_unit_quad_and_apply_bloom(const Application &app, Shader &render_shader,
-									Shader &bloom_shader, GLContext &context);
+// Applies the bloom if enabled, then draws the scene to the default framebuffer through the
+// post processing variant of the enabled stages.
+void draw_unit_quad_and_post_process(const Application &app, PostProcessChain &chain, Shader &bloom_shader,
+									 GpuProfiler &profiler, GLContext &context);
 
 #endif // DRAW_HPP
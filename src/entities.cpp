@@ -1,29 +1,509 @@
 #include "entities.hpp"
+#include <stdlib.h>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
 #include "lt_utils.hpp"
 #include "resources.hpp"
-#include "debug_gui.hpp"
+#include "matrix.hpp"
 
 lt_global_variable lt::Logger logger("entities");
 
+// Alignment of every component column inside a chunk.
+#define CHUNK_COLUMN_ALIGNMENT 16
+#define CHUNK_NUM_COLUMNS 10
+// Archetypes with these components also get the world bounds columns.
+#define BOUNDS_MASK (ComponentKind_Transform | ComponentKind_Renderable)
+// Extent of entities whose bounds were not computed yet, so they are never culled.
+#define UNKNOWN_BOUNDS_EXTENT 1e30f
+
+lt_internal inline isize
+align_up(isize value, isize alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+lt_internal isize
+row_size_for_mask(u32 mask)
+{
+	isize size = sizeof(EntityHandle);
+	if (mask & ComponentKind_Transform) size += sizeof(Transform);
+	if (mask & ComponentKind_Renderable) size += sizeof(Renderable);
+	if (mask & ComponentKind_LightEmmiter) size += sizeof(LightEmmiter);
+	if ((mask & BOUNDS_MASK) == BOUNDS_MASK) size += 6*sizeof(f32);
+	return size;
+}
+
+lt_internal EntityChunk *
+allocate_chunk(u32 mask, i32 capacity)
+{
+	EntityChunk *chunk = new EntityChunk();
+	chunk->count = 0;
+	chunk->capacity = capacity;
+	chunk->memory = (u8*)malloc(ENTITY_CHUNK_SIZE);
+
+	// Lay out each column one after the other, only for the components the archetype has.
+	isize offset = 0;
+	chunk->handles = (EntityHandle*)(chunk->memory + offset);
+	offset = align_up(offset + capacity*sizeof(EntityHandle), CHUNK_COLUMN_ALIGNMENT);
+
+	if (mask & ComponentKind_Transform)
+	{
+		chunk->transform = (Transform*)(chunk->memory + offset);
+		offset = align_up(offset + capacity*sizeof(Transform), CHUNK_COLUMN_ALIGNMENT);
+	}
+	if (mask & ComponentKind_Renderable)
+	{
+		chunk->renderable = (Renderable*)(chunk->memory + offset);
+		offset = align_up(offset + capacity*sizeof(Renderable), CHUNK_COLUMN_ALIGNMENT);
+	}
+	if (mask & ComponentKind_LightEmmiter)
+	{
+		chunk->light_emmiter = (LightEmmiter*)(chunk->memory + offset);
+		offset = align_up(offset + capacity*sizeof(LightEmmiter), CHUNK_COLUMN_ALIGNMENT);
+	}
+	if ((mask & BOUNDS_MASK) == BOUNDS_MASK)
+	{
+		// The alignment pads every column to a multiple of 4 floats, as the culling expects.
+		for (i32 axis = 0; axis < 3; axis++)
+		{
+			chunk->bounds_center[axis] = (f32*)(chunk->memory + offset);
+			offset = align_up(offset + capacity*sizeof(f32), CHUNK_COLUMN_ALIGNMENT);
+			chunk->bounds_extent[axis] = (f32*)(chunk->memory + offset);
+			offset = align_up(offset + capacity*sizeof(f32), CHUNK_COLUMN_ALIGNMENT);
+		}
+	}
+
+	LT_Assert(offset <= ENTITY_CHUNK_SIZE);
+	return chunk;
+}
+
+lt_internal void
+free_chunk(EntityChunk *chunk)
+{
+	LT_Free(chunk->memory);
+	delete chunk;
+}
+
+// Copies the components present in both chunks from one row to the other.
+lt_internal void
+copy_row(const EntityChunk *src, i32 src_row, EntityChunk *dst, i32 dst_row)
+{
+	dst->handles[dst_row] = src->handles[src_row];
+	if (dst->transform && src->transform) dst->transform[dst_row] = src->transform[src_row];
+	if (dst->renderable && src->renderable) dst->renderable[dst_row] = src->renderable[src_row];
+	if (dst->light_emmiter && src->light_emmiter) dst->light_emmiter[dst_row] = src->light_emmiter[src_row];
+	if (dst->bounds_center[0] && src->bounds_center[0])
+	{
+		for (i32 axis = 0; axis < 3; axis++)
+		{
+			dst->bounds_center[axis][dst_row] = src->bounds_center[axis][src_row];
+			dst->bounds_extent[axis][dst_row] = src->bounds_extent[axis][src_row];
+		}
+	}
+}
+
+Entities::~Entities()
+{
+	for (Archetype &arch : archetypes)
+		for (EntityChunk *chunk : arch.chunks)
+			free_chunk(chunk);
+}
+
+i32
+Entities::find_or_create_archetype(u32 components_mask)
+{
+	for (usize i = 0; i < archetypes.size(); i++)
+		if (archetypes[i].mask == components_mask)
+			return i;
+
+	Archetype arch = {};
+	arch.mask = components_mask;
+	arch.chunk_capacity = (ENTITY_CHUNK_SIZE - CHUNK_NUM_COLUMNS*CHUNK_COLUMN_ALIGNMENT) /
+		row_size_for_mask(components_mask);
+	archetypes.push_back(arch);
+	return archetypes.size() - 1;
+}
+
+EntityChunk *
+Entities::chunk_of(EntityHandle handle) const
+{
+	LT_Assert(is_valid(handle));
+	const EntityLocation &loc = locations[entity_index(handle)];
+	return archetypes[loc.archetype].chunks[loc.chunk];
+}
+
+bool
+Entities::is_valid(EntityHandle handle) const
+{
+	if (handle < 0)
+		return false;
+
+	const u32 index = entity_index(handle);
+	return index < locations.size()
+		&& generations[index] == entity_generation(handle)
+		&& locations[index].archetype != -1;
+}
+
+EntityLocation
+Entities::insert_row(i32 arch_index, EntityHandle handle)
+{
+	Archetype &arch = archetypes[arch_index];
+
+	if (arch.chunks.empty() || arch.chunks.back()->count == arch.chunk_capacity)
+		arch.chunks.push_back(allocate_chunk(arch.mask, arch.chunk_capacity));
+
+	EntityChunk *chunk = arch.chunks.back();
+	const i32 row = chunk->count++;
+
+	chunk->handles[row] = handle;
+	if (chunk->transform) chunk->transform[row] = Transform();
+	if (chunk->renderable) chunk->renderable[row] = Renderable();
+	if (chunk->light_emmiter) chunk->light_emmiter[row] = LightEmmiter();
+	if (chunk->bounds_center[0])
+	{
+		for (i32 axis = 0; axis < 3; axis++)
+		{
+			chunk->bounds_center[axis][row] = 0.0f;
+			chunk->bounds_extent[axis][row] = UNKNOWN_BOUNDS_EXTENT;
+		}
+	}
+
+	return EntityLocation{arch_index, (i32)arch.chunks.size() - 1, row};
+}
+
+void
+Entities::remove_row(const EntityLocation &loc)
+{
+	// Keep the archetype packed by moving its last entity into the freed row.
+	Archetype &arch = archetypes[loc.archetype];
+	EntityChunk *chunk = arch.chunks[loc.chunk];
+	EntityChunk *last_chunk = arch.chunks.back();
+	const i32 last_row = last_chunk->count - 1;
+
+	if (chunk != last_chunk || loc.row != last_row)
+	{
+		copy_row(last_chunk, last_row, chunk, loc.row);
+		locations[entity_index(chunk->handles[loc.row])] = loc;
+	}
+
+	last_chunk->count--;
+	if (last_chunk->count == 0)
+	{
+		free_chunk(last_chunk);
+		arch.chunks.pop_back();
+	}
+}
+
 EntityHandle
 Entities::create(u32 components_mask)
 {
-	for (EntityHandle handle = 0; handle < MAX_ENTITIES; handle++)
-		if (mask[handle] == ComponentKind_None)
+	u32 index;
+	if (!free_indices.empty())
+	{
+		index = free_indices.back();
+		free_indices.pop_back();
+	}
+	else
+	{
+		index = locations.size();
+		locations.push_back(EntityLocation{-1, -1, -1});
+		generations.push_back(0);
+		name.push_back(STRING_ID_NONE);
+		caster_moved_tick.push_back(0);
+	}
+
+	const EntityHandle handle = make_entity_handle(index, generations[index]);
+	locations[index] = insert_row(find_or_create_archetype(components_mask), handle);
+
+	// New casters count as moving, they go to the static shadow layer once they settle.
+	if (components_mask & ComponentKind_ShadowCaster)
+	{
+		caster_moved_tick[index] = bounds_tick;
+		caster_revision++;
+	}
+
+	if (components_mask & ComponentKind_Transform)
+		hierarchy.add(handle);
+	return handle;
+}
+
+void
+Entities::destroy(EntityHandle handle)
+{
+	LT_Assert(is_valid(handle));
+	const u32 index = entity_index(handle);
+
+	if (has(handle, ComponentKind_ShadowCaster))
+		caster_moved(index);
+	if (has(handle, ComponentKind_Transform))
+		hierarchy.remove(*this, handle);
+	if (bvh.contains(handle))
+		bvh.remove(handle);
+	remove_row(locations[index]);
+
+	set_name(handle, nullptr);
+	locations[index] = EntityLocation{-1, -1, -1};
+	generations[index] = (generations[index] + 1) & ENTITY_GENERATION_MASK;
+	free_indices.push_back(index);
+}
+
+void
+Entities::add_components(EntityHandle handle, u32 components_mask)
+{
+	LT_Assert(is_valid(handle));
+	const u32 index = entity_index(handle);
+	const EntityLocation old_loc = locations[index];
+	const u32 new_mask = archetypes[old_loc.archetype].mask | components_mask;
+
+	if (new_mask == archetypes[old_loc.archetype].mask)
+		return;
+
+	// Move the entity to the archetype of its new mask, keeping the components it already had.
+	const EntityLocation new_loc = insert_row(find_or_create_archetype(new_mask), handle);
+	copy_row(archetypes[old_loc.archetype].chunks[old_loc.chunk], old_loc.row,
+			 archetypes[new_loc.archetype].chunks[new_loc.chunk], new_loc.row);
+
+	remove_row(old_loc);
+	locations[index] = new_loc;
+
+	if ((components_mask & ComponentKind_Transform) && !(archetypes[old_loc.archetype].mask & ComponentKind_Transform))
+		hierarchy.add(handle);
+	if ((components_mask & ComponentKind_ShadowCaster) && !(archetypes[old_loc.archetype].mask & ComponentKind_ShadowCaster))
+	{
+		caster_moved_tick[index] = bounds_tick;
+		caster_revision++;
+	}
+}
+
+void
+Entities::caster_moved(u32 index)
+{
+	// The static layer of the shadow map may have drawn a settled caster, it has to be redrawn.
+	if (bounds_tick - caster_moved_tick[index] >= SHADOW_CASTER_SETTLE_TICKS)
+		settled_caster_revision++;
+	caster_moved_tick[index] = bounds_tick;
+	caster_revision++;
+}
+
+bool
+Entities::set_name(EntityHandle h, const char *new_name)
+{
+	LT_Assert(is_valid(h));
+	const u32 index = entity_index(h);
+
+	if (new_name)
+	{
+		const EntityHandle owner = find(new_name);
+		if (owner == h)
+			return true;
+		if (is_valid(owner))
 		{
-			mask[handle] = components_mask;
-			return handle;
+			logger.error("Entity name ", new_name, " is already used, entity ", index, " keeps its name.");
+			return false;
 		}
-	
-	logger.error("Cannot create more entities!");
-	return -1;
+	}
+
+	// Only drop the index entry if it still points to this entity.
+	const StringId old_id = name[index];
+	if (old_id != STRING_ID_NONE && m_handle_by_name[old_id] == h)
+		m_handle_by_name[old_id] = -1;
+
+	if (!new_name)
+	{
+		name[index] = STRING_ID_NONE;
+		return true;
+	}
+
+	const StringId id = names.intern(new_name);
+	if (id >= m_handle_by_name.size())
+		m_handle_by_name.resize(id + 1, -1);
+
+	name[index] = id;
+	m_handle_by_name[id] = h;
+	return true;
+}
+
+const char *
+Entities::get_name(EntityHandle h) const
+{
+	const StringId id = is_valid(h) ? name[entity_index(h)] : STRING_ID_NONE;
+	return id != STRING_ID_NONE ? names.get(id) : nullptr;
+}
+
+EntityHandle
+Entities::find(const char *entity_name) const
+{
+	const StringId id = names.find(entity_name);
+	if (id == STRING_ID_NONE || id >= m_handle_by_name.size())
+		return -1;
+	return m_handle_by_name[id];
+}
+
+u32
+Entities::mask(EntityHandle handle) const
+{
+	if (!is_valid(handle))
+		return ComponentKind_None;
+	return archetypes[locations[entity_index(handle)].archetype].mask;
+}
+
+Transform *
+Entities::transform(EntityHandle h)
+{
+	EntityChunk *chunk = chunk_of(h);
+	LT_Assert(chunk->transform);
+	return &chunk->transform[locations[entity_index(h)].row];
+}
+
+Renderable *
+Entities::renderable(EntityHandle h)
+{
+	EntityChunk *chunk = chunk_of(h);
+	LT_Assert(chunk->renderable);
+	return &chunk->renderable[locations[entity_index(h)].row];
+}
+
+LightEmmiter *
+Entities::light_emmiter(EntityHandle h)
+{
+	EntityChunk *chunk = chunk_of(h);
+	LT_Assert(chunk->light_emmiter);
+	return &chunk->light_emmiter[locations[entity_index(h)].row];
+}
+
+const Transform *
+Entities::transform(EntityHandle h) const
+{
+	return const_cast<Entities*>(this)->transform(h);
+}
+
+const Renderable *
+Entities::renderable(EntityHandle h) const
+{
+	return const_cast<Entities*>(this)->renderable(h);
+}
+
+const LightEmmiter *
+Entities::light_emmiter(EntityHandle h) const
+{
+	return const_cast<Entities*>(this)->light_emmiter(h);
 }
 
 void
-Entities::destroy(EntityHandle handle)
+Entities::set_world_bounds(EntityHandle h, const AABB &box)
+{
+	EntityChunk *chunk = chunk_of(h);
+	LT_Assert(chunk->bounds_center[0]);
+
+	const i32 row = locations[entity_index(h)].row;
+	for (i32 axis = 0; axis < 3; axis++)
+	{
+		chunk->bounds_center[axis][row] = (box.min.val[axis] + box.max.val[axis]) * 0.5f;
+		chunk->bounds_extent[axis][row] = (box.max.val[axis] - box.min.val[axis]) * 0.5f;
+	}
+}
+
+void
+update_light_positions(Entities &entities)
+{
+	const u32 light_mask = ComponentKind_LightEmmiter | ComponentKind_Transform;
+
+	for (Archetype &arch : entities.archetypes)
+	{
+		if (!arch.matches(light_mask))
+			continue;
+
+		for (EntityChunk *chunk : arch.chunks)
+			for (i32 row = 0; row < chunk->count; row++)
+				chunk->light_emmiter[row].position = Vec3f(chunk->transform[row].mat.col(3));
+	}
+}
+
+void
+update_entity_bounds(Entities &entities)
+{
+	entities.bounds_tick++;
+	for (EntityHandle h : entities.hierarchy.changed)
+	{
+		if (!entities.has(h, ComponentKind_Renderable))
+			continue;
+		if (entities.has(h, ComponentKind_ShadowCaster))
+			entities.caster_moved(entity_index(h));
+
+		const Mesh *mesh = entities.renderable(h)->mesh;
+		if (!mesh)
+			continue;
+
+		const AABB box = aabb_transform(mesh->bounds, entities.transform(h)->mat);
+		entities.bvh.insert(h, box);
+		entities.set_world_bounds(h, box);
+	}
+}
+
+EntityHandle
+pick_entity(const Entities &entities, const Ray &ray, f32 *distance)
+{
+	struct Candidate
+	{
+		EntityHandle handle;
+		f32          t_entry;
+	};
+
+	std::vector<EntityHandle> handles;
+	entities.bvh.query_ray(ray, handles);
+
+	// Test the candidates front to back, so the ones behind the closest hit are skipped.
+	std::vector<Candidate> candidates;
+	candidates.reserve(handles.size());
+	for (EntityHandle h : handles)
+	{
+		const Mesh *mesh = entities.renderable(h)->mesh;
+		f32 t_entry;
+		if (mesh && aabb_ray_intersect(aabb_transform(mesh->bounds, entities.transform(h)->mat), ray, &t_entry))
+			candidates.push_back(Candidate{h, t_entry});
+	}
+	std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) {
+		return a.t_entry < b.t_entry;
+	});
+
+	EntityHandle closest = -1;
+	f32 closest_t = ray.max_distance;
+	for (const Candidate &c : candidates)
+	{
+		if (c.t_entry > closest_t)
+			break;
+
+		// Test in model space, with the direction left unnormalized so distances stay
+		// in world units.
+		const Mesh *mesh = entities.renderable(c.handle)->mesh;
+		const Mat4f inv = affine_inverse(entities.transform(c.handle)->mat);
+
+		Ray local;
+		local.origin = transform_vector(inv, ray.origin, 1.0f);
+		local.direction = transform_vector(inv, ray.direction, 0.0f);
+		local.max_distance = closest_t;
+
+		f32 t;
+		if (mesh->triangle_bvh.raycast(local, mesh->vertices, mesh->faces, &t))
+		{
+			closest = c.handle;
+			closest_t = t;
+		}
+	}
+
+	if (distance && closest != -1)
+		*distance = closest_t;
+	return closest;
+}
+
+// Names the entity "<prefix>_<index>" without any heap allocation.
+lt_internal void
+set_indexed_name(Entities &entities, EntityHandle h, const char *prefix, usize prefix_len)
 {
-	LT_Assert(handle < MAX_ENTITIES && handle >= 0);
-	mask[handle] = ComponentKind_None;
+	char buf[256];
+	snprintf(buf, sizeof(buf), "%.*s_%u", (i32)prefix_len, prefix, entity_index(h));
+	entities.set_name(h, buf);
 }
 
 EntityHandle
@@ -36,13 +516,12 @@ create_textured_cube(Entities &entities, Resources &resources, Shader *shader,
 									  ComponentKind_ShadowCaster);
 	LT_Assert(h >= 0);
 
-	entities.renderable[h].mesh = resources.load_unit_cube(diffuse_texture, specular_texture, normal_texture);
-	entities.renderable[h].shader = shader;
-	entities.renderable[h].shininess = shininess;
-	entities.transform[h].mat = transform;
-	entities.name[h] = std::string("cube_") + std::to_string(h);
-
-	dgui::State::instance().entities_map.insert(std::make_pair(h, entities.name[h]));
+	entities.renderable(h)->mesh = resources.load_unit_cube(diffuse_texture, specular_texture, normal_texture);
+	entities.renderable(h)->shader = shader;
+	entities.renderable(h)->shininess = shininess;
+	entities.transform(h)->mat = transform;
+	entities.hierarchy.set_local_matrix(h, transform);
+	set_indexed_name(entities, h, "cube", 4);
 	return h;
 }
 
@@ -56,17 +535,16 @@ create_entity_from_model(Entities &entities, Resources &resources, const char *p
 									 ComponentKind_ShadowCaster);
 	LT_Assert(h >= 0);
 
-	entities.renderable[h].mesh = resources.load_mesh_from_model(path, texture_diffuse, texture_specular,
-																 texture_normal, resources);
-	entities.renderable[h].shader = shader;
-	entities.renderable[h].shininess = shininess;
-	entities.transform[h].mat = transform;
+	entities.renderable(h)->mesh = resources.load_mesh_from_model(path, texture_diffuse, texture_specular,
+																  texture_normal, resources);
+	entities.renderable(h)->shader = shader;
+	entities.renderable(h)->shininess = shininess;
+	entities.transform(h)->mat = transform;
+	entities.hierarchy.set_local_matrix(h, transform);
 
-	std::string path_str(path);
-	i32 dot_pos = path_str.find_first_of(".");
-	entities.name[h] = path_str.substr(0, dot_pos) + "_" + std::to_string(h);
-
-	dgui::State::instance().entities_map.insert(std::make_pair(h, entities.name[h]));
+	// Name the entity after the model file, without its extension.
+	const char *dot = strchr(path, '.');
+	set_indexed_name(entities, h, path, dot ? dot - path : strlen(path));
 	return h;
 }
 
@@ -79,13 +557,12 @@ create_point_light(Entities &entities, Resources &resources, Shader *shader, con
 									  ComponentKind_LightEmmiter);
 
 	LT_Assert(h >= 0);
-	entities.renderable[h].mesh = resources.load_unit_cube(diffuse_texture, specular_texture);
-	entities.renderable[h].shader = shader;
-	entities.transform[h].mat = transform;
-	entities.light_emmiter[h] = light_emmiter;
-	entities.name[h] = std::string("point_light_") + std::to_string(h);
-
-	dgui::State::instance().entities_map.insert(std::make_pair(h, entities.name[h]));
+	entities.renderable(h)->mesh = resources.load_unit_cube(diffuse_texture, specular_texture);
+	entities.renderable(h)->shader = shader;
+	entities.transform(h)->mat = transform;
+	entities.hierarchy.set_local_matrix(h, transform);
+	*entities.light_emmiter(h) = light_emmiter;
+	set_indexed_name(entities, h, "point_light", 11);
 	return h;
 }
 
@@ -98,14 +575,13 @@ create_plane(Entities &entities, Resources &resources, Shader *shader, const Mat
 									  ComponentKind_ShadowCaster);
 	LT_Assert(h >= 0);
 
-	entities.renderable[h].mesh = resources.load_unit_plane(tex_coords_scale, diffuse_texture,
-															  specular_texture, normal_texture);
-	entities.renderable[h].shader = shader;
-	entities.renderable[h].shininess = shininess;
-	entities.transform[h].mat = transform;
-	entities.name[h] = std::string("plane_") + std::to_string(h);
-
-	dgui::State::instance().entities_map.insert(std::make_pair(h, entities.name[h]));
+	entities.renderable(h)->mesh = resources.load_unit_plane(tex_coords_scale, diffuse_texture,
+															   specular_texture, normal_texture);
+	entities.renderable(h)->shader = shader;
+	entities.renderable(h)->shininess = shininess;
+	entities.transform(h)->mat = transform;
+	entities.hierarchy.set_local_matrix(h, transform);
+	set_indexed_name(entities, h, "plane", 5);
 	return h;
 }
 
@@ -115,10 +591,8 @@ create_skybox(Entities &entities, Resources &resources, Shader *shader, u32 skyb
 	EntityHandle h = entities.create(ComponentKind_Renderable);
 	LT_Assert(h >= 0);
 
-	entities.renderable[h].mesh = resources.load_cubemap(skybox_texture);
-	entities.renderable[h].shader = shader;
-	entities.name[h] = std::string("skybox_") + std::to_string(h);
-
-	dgui::State::instance().entities_map.insert(std::make_pair(h, entities.name[h]));
+	entities.renderable(h)->mesh = resources.load_cubemap(skybox_texture);
+	entities.renderable(h)->shader = shader;
+	set_indexed_name(entities, h, "skybox", 6);
 	return h;
 }
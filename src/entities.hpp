@@ -1,10 +1,19 @@
 #ifndef __ENTITIES_HPP__
 #define __ENTITIES_HPP__
 
+#include <vector>
 #include "lt_core.hpp"
 #include "lt_math.hpp"
+#include "hierarchy.hpp"
+#include "bvh.hpp"
+#include "string_table.hpp"
 
-#define MAX_ENTITIES 100
+// Size in bytes of every archetype chunk. The number of entities a chunk holds depends
+// on which components its archetype has, so memory only grows with live components.
+#define ENTITY_CHUNK_SIZE (16 * 1024)
+// Shadow casters that haven't moved for this many calls to update_entity_bounds are drawn
+// to the cached static layer of the shadow map.
+#define SHADOW_CASTER_SETTLE_TICKS 60
 
 struct Mesh;
 struct Resources;
@@ -17,6 +26,13 @@ enum ComponentKind : u32
 	ComponentKind_Renderable = (1 << 1),
 	ComponentKind_LightEmmiter = (1 << 2),
 	ComponentKind_ShadowCaster = (1 << 3),
+	// Large meshes rasterized by the occlusion culling to hide what is behind them.
+	ComponentKind_Occluder = (1 << 4),
+	// Not components entities have, systems declare with them that they access shared data.
+	// The world bounds column of the chunks, the BVH and the shadow caster change tracking.
+	ComponentKind_Bounds = (1 << 5),
+	// The camera and the debug gui state it updates.
+	ComponentKind_Camera = (1 << 6),
 };
 
 struct Transform
@@ -43,25 +59,150 @@ struct LightEmmiter
 	Shader *shader;
 };
 
+//
+// An entity handle packs the slot index in the lower 32 bits and the slot generation in the
+// upper bits. The generation is bumped every time the slot is freed, so handles kept around
+// after an entity is destroyed never alias the entity that reuses the slot.
+//
 typedef isize EntityHandle;
 
+#define ENTITY_GENERATION_MASK 0x7fffffff
+
+inline EntityHandle
+make_entity_handle(u32 index, u32 generation)
+{
+	return ((EntityHandle)(generation & ENTITY_GENERATION_MASK) << 32) | (EntityHandle)index;
+}
+
+inline u32 entity_index(EntityHandle h) { return (u32)(h & 0xffffffff); }
+inline u32 entity_generation(EntityHandle h) { return (u32)(h >> 32) & ENTITY_GENERATION_MASK; }
+
+//
+// A chunk stores the components of entities that share the same mask as parallel
+// arrays. Columns for components not present in the archetype are nullptr.
+//
+struct EntityChunk
+{
+	i32           count;
+	i32           capacity;
+	EntityHandle *handles;
+	Transform    *transform;
+	Renderable   *renderable;
+	LightEmmiter *light_emmiter;
+	// World bounds of the entities with a Transform and a Renderable, one column per
+	// component of the box center and half extent, so they can be culled with SIMD.
+	f32          *bounds_center[3];
+	f32          *bounds_extent[3];
+	u8           *memory;
+};
+
+struct Archetype
+{
+	u32                       mask;
+	i32                       chunk_capacity;
+	std::vector<EntityChunk*> chunks;
+
+	inline bool matches(u32 required_mask) const
+	{
+		return (mask & required_mask) == required_mask;
+	}
+};
+
+struct EntityLocation
+{
+	i32 archetype; // -1 when the slot is not used by any entity.
+	i32 chunk;
+	i32 row;
+};
+
 struct Entities
 {
-	u32           mask[MAX_ENTITIES];
-	Transform     transform[MAX_ENTITIES];
-	Renderable    renderable[MAX_ENTITIES];
-	LightEmmiter  light_emmiter[MAX_ENTITIES];
-	std::string   name[MAX_ENTITIES];
+	std::vector<Archetype>      archetypes;
+	// Indexed by entity_index(handle).
+	std::vector<EntityLocation> locations;
+	std::vector<u32>            generations;
+	std::vector<StringId>       name;
+	// Stack of slot indexes that can be reused by create.
+	std::vector<u32>            free_indices;
+	// Parent/child links and local transforms of the entities with a Transform.
+	TransformHierarchy          hierarchy;
+	// World bounds of the renderable entities, kept up to date by update_entity_bounds.
+	EntityBVH                   bvh;
+	// Arena for the entity names, shared by all entities.
+	StringTable                 names;
+
+	// Revision counters for the shadow map cache. Ticks count the calls to update_entity_bounds.
+	u64                         bounds_tick = 0;
+	// Bumped when a shadow caster moves, is created or is destroyed.
+	u64                         caster_revision = 0;
+	// Bumped when a shadow caster that was settled moves or is destroyed.
+	u64                         settled_caster_revision = 0;
+	// Tick of the last move of each shadow caster, indexed by entity_index(handle).
+	std::vector<u64>            caster_moved_tick;
+
+	Entities() = default;
+	Entities(const Entities&) = delete;
+	Entities &operator=(const Entities&) = delete;
+	~Entities();
 
 	EntityHandle create(u32 components_mask);
 	void         destroy(EntityHandle id);
+	// Moves the entity to the archetype with the added components, which start default initialized.
+	void         add_components(EntityHandle h, u32 components_mask);
+
+	// Names are unique, naming an entity with the name of another one is rejected with an
+	// error and returns false, the entity keeps its name. A nullptr name removes it.
+	bool          set_name(EntityHandle h, const char *name);
+	// Returns nullptr when the entity has no name.
+	const char   *get_name(EntityHandle h) const;
+	// Returns -1 if no entity has the name.
+	EntityHandle  find(const char *name) const;
+
+	bool          is_valid(EntityHandle h) const;
+	u32           mask(EntityHandle h) const;
+	Transform    *transform(EntityHandle h);
+	Renderable   *renderable(EntityHandle h);
+	LightEmmiter *light_emmiter(EntityHandle h);
+
+	const Transform    *transform(EntityHandle h) const;
+	const Renderable   *renderable(EntityHandle h) const;
+	const LightEmmiter *light_emmiter(EntityHandle h) const;
+
+	// Stores the world bounds used for culling, the entity needs a Transform and a Renderable.
+	void set_world_bounds(EntityHandle h, const AABB &box);
+	// Records a move of a shadow caster for the shadow map cache.
+	void caster_moved(u32 index);
 
 	inline bool has(EntityHandle h, ComponentKind kind) const
 	{
-		return (mask[h] & kind) != 0;
+		return (mask(h) & kind) != 0;
 	}
+	inline bool has_all(EntityHandle h, u32 components_mask) const
+	{
+		return (mask(h) & components_mask) == components_mask;
+	}
+
+	inline isize num_slots() const { return locations.size(); }
+
+private:
+	// Indexed by StringId, -1 for names not used by any entity.
+	std::vector<EntityHandle> m_handle_by_name;
+
+	i32            find_or_create_archetype(u32 components_mask);
+	EntityLocation insert_row(i32 arch_index, EntityHandle handle);
+	void           remove_row(const EntityLocation &loc);
+	EntityChunk   *chunk_of(EntityHandle h) const;
 };
 
+// Copies the translation of every light's transform into its LightEmmiter position.
+void update_light_positions(Entities &entities);
+// Returns the renderable entity closest to the ray origin whose mesh is hit by the ray, or -1.
+// The bounds tree gives the candidates, then each one is tested against its mesh triangles.
+EntityHandle pick_entity(const Entities &entities, const Ray &ray, f32 *distance = nullptr);
+// Updates the bounds in the BVH and in the chunks of the renderable entities whose transform
+// changed in the last hierarchy update.
+void update_entity_bounds(Entities &entities);
+
 EntityHandle create_textured_cube(Entities &entities, Resources &resources, Shader *shader,
 								  const Mat4f &transform, f32 shininess, u32 diffuse_texture,
 								  u32 specular_texture, u32 normal_texture = 0);
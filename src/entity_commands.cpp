@@ -0,0 +1,197 @@
+#include "entity_commands.hpp"
+#include <algorithm>
+#include <string.h>
+#include "lt_utils.hpp"
+#include "jobs.hpp"
+
+lt_global_variable lt::Logger logger("entity_commands");
+
+// Deferred handles are negative, starting at -2 so they never collide with -1 (no entity).
+lt_internal inline EntityHandle deferred_handle(i32 index) { return -2 - (EntityHandle)index; }
+lt_internal inline bool         is_deferred(EntityHandle h) { return h <= -2; }
+lt_internal inline i32          deferred_index(EntityHandle h) { return (i32)(-2 - h); }
+
+EntityCommand &
+EntityCommandBuffer::push(EntityCommandKind kind, EntityHandle h)
+{
+	EntityCommand cmd = {};
+	cmd.kind = kind;
+	cmd.sort_key = sort_key;
+	cmd.payload = -1;
+	cmd.handle = h;
+	commands.push_back(cmd);
+	return commands.back();
+}
+
+EntityHandle
+EntityCommandBuffer::create(u32 components_mask, const char *name)
+{
+	const EntityHandle h = deferred_handle(num_created++);
+	EntityCommand &cmd = push(EntityCommandKind_Create, h);
+	cmd.mask = components_mask;
+
+	if (name)
+	{
+		const usize len = strlen(name);
+		cmd.payload = names.size();
+		names.insert(names.end(), name, name + len + 1);
+	}
+	return h;
+}
+
+void
+EntityCommandBuffer::destroy(EntityHandle h)
+{
+	push(EntityCommandKind_Destroy, h);
+}
+
+void
+EntityCommandBuffer::add_components(EntityHandle h, u32 components_mask)
+{
+	push(EntityCommandKind_AddComponents, h).mask = components_mask;
+}
+
+void
+EntityCommandBuffer::set_transform(EntityHandle h, const Mat4f &mat)
+{
+	push(EntityCommandKind_SetTransform, h).payload = transforms.size();
+	transforms.push_back(Transform{mat});
+}
+
+void
+EntityCommandBuffer::set_renderable(EntityHandle h, const Renderable &renderable)
+{
+	push(EntityCommandKind_SetRenderable, h).payload = renderables.size();
+	renderables.push_back(renderable);
+}
+
+void
+EntityCommandBuffer::set_light_emmiter(EntityHandle h, const LightEmmiter &light_emmiter)
+{
+	push(EntityCommandKind_SetLightEmmiter, h).payload = light_emmiters.size();
+	light_emmiters.push_back(light_emmiter);
+}
+
+void
+EntityCommandBuffer::clear()
+{
+	// Keeps the capacity, so steady state recording does not allocate.
+	commands.clear();
+	transforms.clear();
+	renderables.clear();
+	light_emmiters.clear();
+	names.clear();
+	num_created = 0;
+}
+
+EntityCommands::EntityCommands()
+	: buffers(jobs::num_threads())
+{
+}
+
+EntityCommandBuffer &
+EntityCommands::local()
+{
+	const i32 thread = jobs::thread_index();
+	LT_Assert(thread >= 0 && thread < (i32)buffers.size());
+	return buffers[thread];
+}
+
+void
+EntityCommands::playback(Entities &entities)
+{
+	m_sorted.clear();
+	for (usize b = 0; b < buffers.size(); b++)
+		for (usize i = 0; i < buffers[b].commands.size(); i++)
+			m_sorted.push_back(CommandRef{buffers[b].commands[i].sort_key, (u32)b, (u32)i});
+
+	if (m_sorted.empty())
+		return;
+
+	// Merge all buffers in a deterministic order. Commands with the same key recorded on
+	// different threads are ordered by thread, so systems should use distinct keys.
+	std::sort(m_sorted.begin(), m_sorted.end(), [](const CommandRef &a, const CommandRef &b) {
+		if (a.sort_key != b.sort_key) return a.sort_key < b.sort_key;
+		if (a.buffer != b.buffer) return a.buffer < b.buffer;
+		return a.index < b.index;
+	});
+
+	m_created.resize(buffers.size());
+	for (usize b = 0; b < buffers.size(); b++)
+		m_created[b].assign(buffers[b].num_created, -1);
+
+	// Creations are played first, so commands on a deferred handle resolve it even when they
+	// were recorded with a lower key than the creation.
+	for (const CommandRef &ref : m_sorted)
+	{
+		const EntityCommandBuffer &buffer = buffers[ref.buffer];
+		const EntityCommand &cmd = buffer.commands[ref.index];
+		if (cmd.kind != EntityCommandKind_Create)
+			continue;
+
+		const EntityHandle h = entities.create(cmd.mask);
+		m_created[ref.buffer][deferred_index(cmd.handle)] = h;
+		if (cmd.payload >= 0)
+			entities.set_name(h, &buffer.names[cmd.payload]);
+	}
+
+	for (const CommandRef &ref : m_sorted)
+	{
+		const EntityCommandBuffer &buffer = buffers[ref.buffer];
+		const EntityCommand &cmd = buffer.commands[ref.index];
+		if (cmd.kind == EntityCommandKind_Create)
+			continue;
+
+		EntityHandle h = cmd.handle;
+		if (is_deferred(h))
+			h = m_created[ref.buffer][deferred_index(h)];
+
+		if (!entities.is_valid(h))
+		{
+			logger.error("Skipping command on an invalid entity handle.");
+			continue;
+		}
+
+		switch (cmd.kind)
+		{
+		case EntityCommandKind_Destroy:
+			entities.destroy(h);
+			break;
+
+		case EntityCommandKind_AddComponents:
+			entities.add_components(h, cmd.mask);
+			// The world matrix and the bounds are only computed for dirty entities.
+			if (entities.has(h, ComponentKind_Transform))
+				entities.hierarchy.mark_dirty(h);
+			break;
+
+		case EntityCommandKind_SetTransform:
+			if (entities.has(h, ComponentKind_Transform))
+			{
+				*entities.transform(h) = buffer.transforms[cmd.payload];
+				entities.hierarchy.set_local_matrix(h, buffer.transforms[cmd.payload].mat);
+			}
+			break;
+
+		case EntityCommandKind_SetRenderable:
+			if (entities.has(h, ComponentKind_Renderable))
+			{
+				*entities.renderable(h) = buffer.renderables[cmd.payload];
+				// A new mesh means new bounds.
+				if (entities.has(h, ComponentKind_Transform))
+					entities.hierarchy.mark_dirty(h);
+			}
+			break;
+
+		case EntityCommandKind_SetLightEmmiter:
+			if (entities.has(h, ComponentKind_LightEmmiter))
+				*entities.light_emmiter(h) = buffer.light_emmiters[cmd.payload];
+			break;
+
+		default: LT_Assert(false);
+		}
+	}
+
+	for (EntityCommandBuffer &buffer : buffers)
+		buffer.clear();
+}
@@ -0,0 +1,91 @@
+#ifndef __ENTITY_COMMANDS_HPP__
+#define __ENTITY_COMMANDS_HPP__
+
+#include <vector>
+#include "lt_core.hpp"
+#include "entities.hpp"
+
+enum EntityCommandKind : u8
+{
+	EntityCommandKind_Create,
+	EntityCommandKind_Destroy,
+	EntityCommandKind_AddComponents,
+	EntityCommandKind_SetTransform,
+	EntityCommandKind_SetRenderable,
+	EntityCommandKind_SetLightEmmiter,
+};
+
+struct EntityCommand
+{
+	EntityCommandKind kind;
+	u32               sort_key;
+	// Index into the payload array of the command kind (or the name offset for Create).
+	i32               payload;
+	u32               mask;
+	EntityHandle      handle;
+};
+
+//
+// Records structural changes to the entities so they can be issued from any thread
+// and applied later at a sync point, with EntityCommands::playback.
+//
+// Entities created through a buffer get a deferred handle, valid only for further
+// commands on the same buffer until the buffer is played back.
+//
+struct EntityCommandBuffer
+{
+	// Commands are played back ordered by this key first, then by recording order. Creations
+	// are all played before the other commands.
+	u32 sort_key = 0;
+
+	EntityHandle create(u32 components_mask, const char *name = nullptr);
+	void         destroy(EntityHandle h);
+	void         add_components(EntityHandle h, u32 components_mask);
+	// Sets the transform relative to the parent of the entity.
+	void         set_transform(EntityHandle h, const Mat4f &mat);
+	void         set_renderable(EntityHandle h, const Renderable &renderable);
+	void         set_light_emmiter(EntityHandle h, const LightEmmiter &light_emmiter);
+
+	void         clear();
+	inline bool  empty() const { return commands.empty(); }
+
+	std::vector<EntityCommand> commands;
+	std::vector<Transform>     transforms;
+	std::vector<Renderable>    renderables;
+	std::vector<LightEmmiter>  light_emmiters;
+	std::vector<char>          names;
+	i32                        num_created = 0;
+
+private:
+	EntityCommand &push(EntityCommandKind kind, EntityHandle h);
+};
+
+//
+// One command buffer per job system thread, so recording never takes a lock.
+//
+struct EntityCommands
+{
+	EntityCommands();
+
+	// Command buffer of the calling thread.
+	EntityCommandBuffer &local();
+	// Applies every recorded command to the entities and clears the buffers.
+	// Has to be called from the main thread while no job is recording.
+	void                 playback(Entities &entities);
+
+	std::vector<EntityCommandBuffer> buffers;
+
+private:
+	struct CommandRef
+	{
+		u32 sort_key;
+		u32 buffer;
+		u32 index;
+	};
+
+	// Scratch memory kept between playbacks.
+	std::vector<CommandRef>                m_sorted;
+	std::vector<std::vector<EntityHandle>> m_created;
+};
+
+#endif // __ENTITY_COMMANDS_HPP__
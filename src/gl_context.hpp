@@ -9,7 +9,7 @@ struct GLContext
     GLuint bound_program;
     GLuint bound_vao;
 
-    explicit GLContext() : bound_program(0) {}
+    explicit GLContext() : bound_program(0), bound_vao(0) {}
 
     void
     use_shader(const Shader& shader)
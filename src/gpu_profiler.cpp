@@ -0,0 +1,103 @@
+#include "gpu_profiler.hpp"
+#include "glad/glad.h"
+#include "lt_utils.hpp"
+
+const char *const gpu_pass_names[GpuPass_Count] = {
+#define GPU_PASS(e, s) s
+	GPU_PASSES
+#undef GPU_PASS
+};
+
+GpuProfiler
+create_gpu_profiler()
+{
+	GpuProfiler profiler = {};
+	glGenQueries(GPU_PROFILER_FRAMES * GpuPass_Count * 2, &profiler.queries[0][0][0]);
+	return profiler;
+}
+
+void
+destroy_gpu_profiler(GpuProfiler &profiler)
+{
+	glDeleteQueries(GPU_PROFILER_FRAMES * GpuPass_Count * 2, &profiler.queries[0][0][0]);
+}
+
+void
+gpu_profiler_begin_frame(GpuProfiler &profiler)
+{
+	const i32 slot = profiler.frame % GPU_PROFILER_FRAMES;
+
+	// Only read the results that are there, waiting for the rest would stall the pipeline.
+	bool available = true;
+	for (i32 pass = 0; pass < GpuPass_Count && available; pass++)
+	{
+		if (!profiler.issued[slot][pass])
+			continue;
+		GLint done = 0;
+		glGetQueryObjectiv(profiler.queries[slot][pass][1], GL_QUERY_RESULT_AVAILABLE, &done);
+		available = done != 0;
+	}
+
+	if (available && profiler.issued[slot][GpuPass_Frame])
+	{
+		for (i32 pass = 0; pass < GpuPass_Count; pass++)
+		{
+			if (!profiler.issued[slot][pass])
+				continue;
+
+			GLuint64 begin, end;
+			glGetQueryObjectui64v(profiler.queries[slot][pass][0], GL_QUERY_RESULT, &begin);
+			glGetQueryObjectui64v(profiler.queries[slot][pass][1], GL_QUERY_RESULT, &end);
+
+			const i32 h = profiler.history_next[pass];
+			f32 *history = profiler.history[pass];
+			history[h] = (end - begin) / 1.0e6f;
+			profiler.history_next[pass] = (h + 1) % GPU_PROFILER_HISTORY;
+
+			GpuPassTiming &t = profiler.timings[pass];
+			if (t.samples < GPU_PROFILER_HISTORY)
+				t.samples++;
+			t.last = history[h];
+			t.average = 0.0f;
+			t.max = 0.0f;
+			for (i32 i = 0; i < t.samples; i++)
+			{
+				t.average += history[i];
+				if (history[i] > t.max)
+					t.max = history[i];
+			}
+			t.average /= t.samples;
+		}
+	}
+	else if (!available)
+	{
+		profiler.dropped_frames++;
+	}
+
+	for (i32 pass = 0; pass < GpuPass_Count; pass++)
+		profiler.issued[slot][pass] = false;
+	gpu_pass_begin(profiler, GpuPass_Frame);
+}
+
+void
+gpu_profiler_end_frame(GpuProfiler &profiler)
+{
+	gpu_pass_end(profiler, GpuPass_Frame);
+	profiler.frame++;
+}
+
+void
+gpu_pass_begin(GpuProfiler &profiler, GpuPass pass)
+{
+	const i32 slot = profiler.frame % GPU_PROFILER_FRAMES;
+	LT_Assert(!profiler.issued[slot][pass]);
+	glQueryCounter(profiler.queries[slot][pass][0], GL_TIMESTAMP);
+}
+
+void
+gpu_pass_end(GpuProfiler &profiler, GpuPass pass)
+{
+	const i32 slot = profiler.frame % GPU_PROFILER_FRAMES;
+	glQueryCounter(profiler.queries[slot][pass][1], GL_TIMESTAMP);
+	profiler.issued[slot][pass] = true;
+}
@@ -0,0 +1,70 @@
+#ifndef __GPU_PROFILER_HPP__
+#define __GPU_PROFILER_HPP__
+
+#include "lt_core.hpp"
+
+#define GPU_PASSES \
+	GPU_PASS(GpuPass_Frame = 0, "Frame"), \
+	GPU_PASS(GpuPass_ShadowMap, "Shadow map"), \
+	GPU_PASS(GpuPass_Scene, "Scene"), \
+	GPU_PASS(GpuPass_Selection, "Selection"), \
+	GPU_PASS(GpuPass_Skybox, "Skybox"), \
+	GPU_PASS(GpuPass_Bloom, "Bloom"), \
+	GPU_PASS(GpuPass_PostProcess, "Post processing"),
+
+enum GpuPass
+{
+#define GPU_PASS(e, s) e
+	GPU_PASSES
+#undef GPU_PASS
+
+	GpuPass_Count,
+};
+
+extern const char *const gpu_pass_names[GpuPass_Count];
+
+// Frames of queries in flight. The results of a frame are read when its queries are about to
+// be reused, by then the GPU is done with them and reading doesn't stall.
+#define GPU_PROFILER_FRAMES 4
+// Samples of a pass the average and the maximum are taken over.
+#define GPU_PROFILER_HISTORY 64
+
+struct GpuPassTiming
+{
+	// Milliseconds, of the last frame that issued the pass. Results are read when their
+	// queries are reused, GPU_PROFILER_FRAMES frames after they were issued.
+	f32 last;
+	f32 average;
+	f32 max;
+	i32 samples; // In the history, 0 when the pass was never issued.
+};
+
+//
+// Measures the GPU time of the passes of a frame with timestamp queries around them, so
+// passes can nest (the frame contains all the others).
+//
+struct GpuProfiler
+{
+	// Begin and end timestamp of every pass, for every frame of the ring.
+	u32           queries[GPU_PROFILER_FRAMES][GpuPass_Count][2];
+	bool          issued[GPU_PROFILER_FRAMES][GpuPass_Count];
+	u64           frame;
+
+	// Only the frames that issued a pass add a sample to its history.
+	f32           history[GpuPass_Count][GPU_PROFILER_HISTORY];
+	i32           history_next[GpuPass_Count];
+	GpuPassTiming timings[GpuPass_Count];
+	// Frames whose results weren't ready when their queries were reused.
+	u64           dropped_frames;
+};
+
+GpuProfiler create_gpu_profiler();
+void        destroy_gpu_profiler(GpuProfiler &profiler);
+
+// Collects the results of the oldest frame of the ring, which the new frame reuses.
+void gpu_profiler_begin_frame(GpuProfiler &profiler);
+void gpu_profiler_end_frame(GpuProfiler &profiler);
+void gpu_pass_begin(GpuProfiler &profiler, GpuPass pass);
+void gpu_pass_end(GpuProfiler &profiler, GpuPass pass);
+
+#endif // __GPU_PROFILER_HPP__
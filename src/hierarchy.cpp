@@ -0,0 +1,301 @@
+#include "hierarchy.hpp"
+#include <math.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+#include "lt_utils.hpp"
+#include "entities.hpp"
+#include "jobs.hpp"
+
+lt_global_variable lt::Logger logger("hierarchy");
+
+// Number of entities of a level processed by a single job.
+#define HIERARCHY_BATCH_SIZE 256
+
+lt_internal inline f32 to_radians(f32 degrees) { return degrees * (f32)M_PI / 180.0f; }
+lt_internal inline f32 to_degrees(f32 radians) { return radians * 180.0f / (f32)M_PI; }
+
+Mat4f
+local_transform_matrix(const LocalTransform &t)
+{
+	const f32 cx = cosf(to_radians(t.rotation.x)), sx = sinf(to_radians(t.rotation.x));
+	const f32 cy = cosf(to_radians(t.rotation.y)), sy = sinf(to_radians(t.rotation.y));
+	const f32 cz = cosf(to_radians(t.rotation.z)), sz = sinf(to_radians(t.rotation.z));
+
+	// T * Rz * Ry * Rx * S
+	Mat4f m(1);
+	m(0, 0) = cy*cz * t.scale.x;
+	m(1, 0) = cy*sz * t.scale.x;
+	m(2, 0) = -sy * t.scale.x;
+
+	m(0, 1) = (cz*sy*sx - sz*cx) * t.scale.y;
+	m(1, 1) = (sz*sy*sx + cz*cx) * t.scale.y;
+	m(2, 1) = cy*sx * t.scale.y;
+
+	m(0, 2) = (cz*sy*cx + sz*sx) * t.scale.z;
+	m(1, 2) = (sz*sy*cx - cz*sx) * t.scale.z;
+	m(2, 2) = cy*cx * t.scale.z;
+
+	m(0, 3) = t.position.x;
+	m(1, 3) = t.position.y;
+	m(2, 3) = t.position.z;
+	return m;
+}
+
+LocalTransform
+local_transform_from_matrix(const Mat4f &m)
+{
+	LocalTransform t;
+	t.position = Vec3f(m(0, 3), m(1, 3), m(2, 3));
+	t.scale = Vec3f(sqrtf(m(0, 0)*m(0, 0) + m(1, 0)*m(1, 0) + m(2, 0)*m(2, 0)),
+					sqrtf(m(0, 1)*m(0, 1) + m(1, 1)*m(1, 1) + m(2, 1)*m(2, 1)),
+					sqrtf(m(0, 2)*m(0, 2) + m(1, 2)*m(1, 2) + m(2, 2)*m(2, 2)));
+
+	// Remove the scale to get the pure rotation matrix. An axis collapsed to zero scale has no
+	// direction left, it keeps the one of the identity instead of turning into NaNs.
+	const f32 eps = 1e-6f;
+	const bool has_x = t.scale.x > eps, has_y = t.scale.y > eps, has_z = t.scale.z > eps;
+	const f32 r00 = has_x ? m(0, 0) / t.scale.x : 1.0f;
+	const f32 r10 = has_x ? m(1, 0) / t.scale.x : 0.0f;
+	const f32 r20 = has_x ? m(2, 0) / t.scale.x : 0.0f;
+	const f32 r11 = has_y ? m(1, 1) / t.scale.y : 1.0f;
+	const f32 r21 = has_y ? m(2, 1) / t.scale.y : 0.0f;
+	const f32 r12 = has_z ? m(1, 2) / t.scale.z : 0.0f;
+	const f32 r22 = has_z ? m(2, 2) / t.scale.z : 1.0f;
+
+	const f32 sy = -r20;
+	const f32 cy = sqrtf(r00*r00 + r10*r10);
+
+	if (cy > 1e-6f)
+	{
+		t.rotation.x = to_degrees(atan2f(r21, r22));
+		t.rotation.y = to_degrees(atan2f(sy, cy));
+		t.rotation.z = to_degrees(atan2f(r10, r00));
+	}
+	else
+	{
+		// Gimbal lock, the z rotation can be folded into the x one.
+		t.rotation.x = to_degrees(atan2f(-r12, r11));
+		t.rotation.y = to_degrees(atan2f(sy, cy));
+		t.rotation.z = 0;
+	}
+	return t;
+}
+
+lt_internal inline void
+multiply_matrices(const Mat4f &a, const Mat4f &b, Mat4f &out)
+{
+#ifdef __SSE__
+	// Matrices are column major, so each column of the result is a combination of the columns of a.
+	const f32 *pa = a.data();
+	const f32 *pb = b.data();
+	f32 *po = const_cast<f32*>(out.data());
+
+	const __m128 a0 = _mm_loadu_ps(pa + 0);
+	const __m128 a1 = _mm_loadu_ps(pa + 4);
+	const __m128 a2 = _mm_loadu_ps(pa + 8);
+	const __m128 a3 = _mm_loadu_ps(pa + 12);
+
+	for (i32 col = 0; col < 4; col++)
+	{
+		__m128 r = _mm_mul_ps(a0, _mm_set1_ps(pb[4*col + 0]));
+		r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(pb[4*col + 1])));
+		r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(pb[4*col + 2])));
+		r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(pb[4*col + 3])));
+		_mm_storeu_ps(po + 4*col, r);
+	}
+#else
+	out = a * b;
+#endif
+}
+
+void
+TransformHierarchy::add(EntityHandle h)
+{
+	const u32 index = entity_index(h);
+	if (index >= local.size())
+	{
+		local.resize(index + 1);
+		parent.resize(index + 1);
+		first_child.resize(index + 1);
+		next_sibling.resize(index + 1);
+		dirty.resize(index + 1);
+	}
+
+	LocalTransform identity;
+	identity.position = Vec3f(0);
+	identity.rotation = Vec3f(0);
+	identity.scale = Vec3f(1);
+
+	local[index] = identity;
+	parent[index] = -1;
+	first_child[index] = -1;
+	next_sibling[index] = -1;
+	dirty[index] = 0;
+}
+
+void
+TransformHierarchy::remove(Entities &entities, EntityHandle h)
+{
+	const u32 index = entity_index(h);
+	unlink_from_parent(h);
+
+	// Orphan the children, keeping them where they are in the world.
+	EntityHandle child = first_child[index];
+	while (child != -1)
+	{
+		const u32 child_index = entity_index(child);
+		const EntityHandle next = next_sibling[child_index];
+
+		parent[child_index] = -1;
+		next_sibling[child_index] = -1;
+		local[child_index] = local_transform_from_matrix(entities.transform(child)->mat);
+
+		child = next;
+	}
+
+	first_child[index] = -1;
+	dirty[index] = 0;
+}
+
+void
+TransformHierarchy::set_local(EntityHandle h, const LocalTransform &t)
+{
+	local[entity_index(h)] = t;
+	mark_dirty(h);
+}
+
+void
+TransformHierarchy::set_local_matrix(EntityHandle h, const Mat4f &m)
+{
+	set_local(h, local_transform_from_matrix(m));
+}
+
+void
+TransformHierarchy::unlink_from_parent(EntityHandle child)
+{
+	const u32 child_index = entity_index(child);
+	const EntityHandle p = parent[child_index];
+	if (p == -1)
+		return;
+
+	EntityHandle *link = &first_child[entity_index(p)];
+	while (*link != child)
+	{
+		LT_Assert(*link != -1);
+		link = &next_sibling[entity_index(*link)];
+	}
+	*link = next_sibling[child_index];
+
+	parent[child_index] = -1;
+	next_sibling[child_index] = -1;
+}
+
+void
+TransformHierarchy::set_parent(EntityHandle child, EntityHandle new_parent)
+{
+	const u32 child_index = entity_index(child);
+
+	// The child can't become a descendant of itself.
+	for (EntityHandle p = new_parent; p != -1; p = parent[entity_index(p)])
+	{
+		if (p == child)
+		{
+			logger.error("Cannot parent an entity to one of its descendants.");
+			return;
+		}
+	}
+
+	unlink_from_parent(child);
+
+	if (new_parent != -1)
+	{
+		const u32 parent_index = entity_index(new_parent);
+		parent[child_index] = new_parent;
+		next_sibling[child_index] = first_child[parent_index];
+		first_child[parent_index] = child;
+	}
+
+	mark_dirty(child);
+}
+
+void
+TransformHierarchy::mark_dirty(EntityHandle h)
+{
+	const u32 index = entity_index(h);
+	if (!dirty[index])
+	{
+		dirty[index] = 1;
+		m_dirty_list.push_back(h);
+	}
+}
+
+void
+TransformHierarchy::update(Entities &entities)
+{
+	changed.clear();
+	if (m_dirty_list.empty())
+		return;
+
+	for (auto &level : m_levels)
+		level.clear();
+	if (m_levels.empty())
+		m_levels.resize(1);
+
+	// The first level holds the dirty entities without a dirty ancestor, since the
+	// others are going to be updated anyway as part of the subtree of that ancestor.
+	for (EntityHandle h : m_dirty_list)
+	{
+		if (!entities.is_valid(h))
+			continue;
+
+		bool covered = false;
+		for (EntityHandle p = parent[entity_index(h)]; p != -1 && !covered; p = parent[entity_index(p)])
+			covered = dirty[entity_index(p)];
+
+		if (!covered)
+			m_levels[0].push_back(h);
+	}
+
+	// Gather the dirty subtrees breadth first, one vector per level.
+	usize num_levels = 0;
+	while (num_levels < m_levels.size() && !m_levels[num_levels].empty())
+	{
+		if (num_levels + 1 == m_levels.size())
+			m_levels.emplace_back();
+
+		for (EntityHandle h : m_levels[num_levels])
+			for (EntityHandle c = first_child[entity_index(h)]; c != -1; c = next_sibling[entity_index(c)])
+				m_levels[num_levels + 1].push_back(c);
+
+		num_levels++;
+	}
+
+	// Every entity of a level only depends on its parent, which is either clean or was
+	// updated in the previous level, so each level is processed in parallel.
+	for (usize l = 0; l < num_levels; l++)
+	{
+		const std::vector<EntityHandle> &level = m_levels[l];
+
+		jobs::parallel_for(level.size(), HIERARCHY_BATCH_SIZE, [&](isize begin, isize end) {
+			for (isize i = begin; i < end; i++)
+			{
+				const EntityHandle h = level[i];
+				const u32 index = entity_index(h);
+				const Mat4f local_mat = local_transform_matrix(local[index]);
+				Transform *world = entities.transform(h);
+
+				if (parent[index] != -1)
+					multiply_matrices(entities.transform(parent[index])->mat, local_mat, world->mat);
+				else
+					world->mat = local_mat;
+			}
+		});
+
+		changed.insert(changed.end(), level.begin(), level.end());
+	}
+
+	for (EntityHandle h : m_dirty_list)
+		dirty[entity_index(h)] = 0;
+	m_dirty_list.clear();
+}
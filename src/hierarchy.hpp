@@ -0,0 +1,60 @@
+#ifndef __HIERARCHY_HPP__
+#define __HIERARCHY_HPP__
+
+#include <vector>
+#include "lt_core.hpp"
+#include "lt_math.hpp"
+
+struct Entities;
+typedef isize EntityHandle;
+
+struct LocalTransform
+{
+	Vec3f position;
+	Vec3f rotation; // Euler angles in degrees, applied in the order x, y, z.
+	Vec3f scale;
+};
+
+Mat4f          local_transform_matrix(const LocalTransform &t);
+LocalTransform local_transform_from_matrix(const Mat4f &m);
+
+//
+// Parent/child relationships between entities with a Transform. Every entity stores its
+// transform relative to its parent, and Transform::mat holds the resulting world matrix.
+//
+// World matrices are only recomputed for entities marked dirty and their descendants,
+// so static hierarchies cost nothing per frame.
+//
+struct TransformHierarchy
+{
+	// All indexed by entity_index(handle).
+	std::vector<LocalTransform> local;
+	std::vector<EntityHandle>   parent;
+	std::vector<EntityHandle>   first_child;
+	std::vector<EntityHandle>   next_sibling;
+	std::vector<u8>             dirty;
+
+	// Entities whose world matrix changed in the last call to update.
+	std::vector<EntityHandle>   changed;
+
+	void add(EntityHandle h);
+	void remove(Entities &entities, EntityHandle h);
+
+	void set_local(EntityHandle h, const LocalTransform &t);
+	void set_local_matrix(EntityHandle h, const Mat4f &m);
+	// Attaches child to parent, or detaches it when parent is -1. The local transform
+	// is kept, so the child becomes relative to its new parent.
+	void set_parent(EntityHandle child, EntityHandle parent);
+	void mark_dirty(EntityHandle h);
+
+	// Recomputes the world matrices of the dirty subtrees, one tree level at a time.
+	void update(Entities &entities);
+
+private:
+	std::vector<EntityHandle>              m_dirty_list;
+	std::vector<std::vector<EntityHandle>> m_levels;
+
+	void unlink_from_parent(EntityHandle child);
+};
+
+#endif // __HIERARCHY_HPP__
@@ -0,0 +1,403 @@
+#include "jobs.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "lt_utils.hpp"
+
+// Both have to be powers of two.
+#define MAX_JOBS_PER_THREAD 4096
+#define JOB_QUEUE_SIZE MAX_JOBS_PER_THREAD
+
+//
+// Chase-Lev work stealing deque. The owner thread pushes and pops at the bottom without
+// taking a lock, other threads steal the oldest jobs from the top with a compare and swap.
+// Only the last job left is contended between the owner and the thieves.
+//
+struct JobQueue
+{
+	std::atomic<Job*>  jobs[JOB_QUEUE_SIZE];
+	std::atomic<isize> top;
+	// Keeps the index the thieves write away from the one the owner writes.
+	u8                 _pad[64];
+	std::atomic<isize> bottom;
+};
+
+struct Worker
+{
+	JobQueue             queue;
+	Job                 *job_pool;
+	u32                  next_job;
+	u32                  random_state;
+	std::atomic<u64>     executed;
+	std::atomic<u64>     stolen;
+	pthread_t            thread;
+};
+
+lt_global_variable lt::Logger       logger("jobs");
+lt_global_variable Worker          *g_workers = nullptr;
+lt_global_variable i32              g_num_threads = 1;
+lt_global_variable std::atomic<bool> g_running(false);
+// Number of jobs sitting in any of the queues, used to put idle workers to sleep.
+lt_global_variable std::atomic<i32> g_pending(0);
+// Workers waiting on the condition, run only takes the sleep mutex to wake one up.
+lt_global_variable std::atomic<i32> g_sleeping(0);
+lt_global_variable pthread_mutex_t  g_sleep_mutex;
+lt_global_variable pthread_cond_t   g_sleep_cond;
+
+// -1 on threads that don't belong to the job system, they can't create or run jobs.
+lt_global_variable thread_local i32 t_thread_index = -1;
+
+lt_internal void
+queue_push(JobQueue *q, Job *job)
+{
+	const isize b = q->bottom.load(std::memory_order_relaxed);
+	const isize t = q->top.load(std::memory_order_acquire);
+	LT_Assert(b - t < JOB_QUEUE_SIZE);
+	q->jobs[b & (JOB_QUEUE_SIZE - 1)].store(job, std::memory_order_relaxed);
+	// The job has to be visible before the thieves can see the new bottom.
+	q->bottom.store(b + 1, std::memory_order_release);
+}
+
+// Only called by the owner of the queue.
+lt_internal Job *
+queue_pop(JobQueue *q)
+{
+	const isize b = q->bottom.load(std::memory_order_relaxed) - 1;
+	q->bottom.store(b, std::memory_order_relaxed);
+	// Orders the reservation of the bottom job with the read of the top, against steal.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	isize t = q->top.load(std::memory_order_relaxed);
+
+	if (t > b)
+	{
+		// Empty.
+		q->bottom.store(b + 1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	Job *job = q->jobs[b & (JOB_QUEUE_SIZE - 1)].load(std::memory_order_relaxed);
+	if (t == b)
+	{
+		// Last job, race the thieves for it.
+		if (!q->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			job = nullptr;
+		q->bottom.store(b + 1, std::memory_order_relaxed);
+	}
+	return job;
+}
+
+lt_internal Job *
+queue_steal(JobQueue *q)
+{
+	isize t = q->top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	const isize b = q->bottom.load(std::memory_order_acquire);
+	if (t >= b)
+		return nullptr;
+
+	Job *job = q->jobs[t & (JOB_QUEUE_SIZE - 1)].load(std::memory_order_relaxed);
+	// Lost against the owner or another thief, the caller moves on to the next victim.
+	if (!q->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		return nullptr;
+	return job;
+}
+
+lt_internal inline u32
+next_random(u32 &state)
+{
+	// xorshift32
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+lt_internal Job *
+get_job()
+{
+	LT_Assert(t_thread_index >= 0);
+	Worker &self = g_workers[t_thread_index];
+
+	Job *job = queue_pop(&self.queue);
+	if (job)
+	{
+		g_pending--;
+		return job;
+	}
+
+	// Our queue is empty, try stealing from the others starting at a random one.
+	const u32 first = next_random(self.random_state) % g_num_threads;
+	for (i32 i = 0; i < g_num_threads; i++)
+	{
+		const i32 victim = (first + i) % g_num_threads;
+		if (victim == t_thread_index)
+			continue;
+
+		job = queue_steal(&g_workers[victim].queue);
+		if (job)
+		{
+			g_pending--;
+			self.stolen.fetch_add(1, std::memory_order_relaxed);
+			return job;
+		}
+	}
+	return nullptr;
+}
+
+lt_internal void
+finish(Job *job)
+{
+	// Once the count reaches 0 the slot of the job can be reused by create, the parent has to
+	// be read before.
+	Job *parent = job->parent;
+	const i32 unfinished = job->unfinished.fetch_sub(1, std::memory_order_acq_rel) - 1;
+	if (unfinished == 0 && parent)
+		finish(parent);
+}
+
+lt_internal void
+execute(Job *job)
+{
+	if (job->function)
+		job->function(job, job->data);
+	finish(job);
+	g_workers[t_thread_index].executed.fetch_add(1, std::memory_order_relaxed);
+}
+
+// @ThreadEntry
+lt_internal void *
+worker_main(void *arg)
+{
+	t_thread_index = (i32)(isize)arg;
+
+	while (g_running.load())
+	{
+		Job *job = get_job();
+		if (job)
+		{
+			execute(job);
+			continue;
+		}
+
+		// Counted as sleeping before checking for jobs, a run that missed the count has pushed
+		// its job before, and the check sees it.
+		pthread_mutex_lock(&g_sleep_mutex);
+		g_sleeping++;
+		while (g_running.load() && g_pending.load() == 0)
+			pthread_cond_wait(&g_sleep_cond, &g_sleep_mutex);
+		g_sleeping--;
+		pthread_mutex_unlock(&g_sleep_mutex);
+	}
+	return nullptr;
+}
+
+void
+jobs::init(i32 num_workers)
+{
+	LT_Assert(g_workers == nullptr);
+
+	if (num_workers < 0)
+	{
+		const i32 num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+		num_workers = (num_cores > 1) ? num_cores - 1 : 0;
+	}
+
+	logger.log("Starting job system with ", num_workers, " workers.");
+
+	g_num_threads = num_workers + 1;
+	g_workers = new Worker[g_num_threads];
+	g_running = true;
+	g_pending = 0;
+	g_sleeping = 0;
+	pthread_mutex_init(&g_sleep_mutex, nullptr);
+	pthread_cond_init(&g_sleep_cond, nullptr);
+
+	for (i32 i = 0; i < g_num_threads; i++)
+	{
+		Worker &w = g_workers[i];
+		w.queue.top.store(0, std::memory_order_relaxed);
+		w.queue.bottom.store(0, std::memory_order_relaxed);
+		w.job_pool = new Job[MAX_JOBS_PER_THREAD];
+		for (i32 j = 0; j < MAX_JOBS_PER_THREAD; j++)
+			w.job_pool[j].unfinished.store(0, std::memory_order_relaxed);
+		w.next_job = 0;
+		w.random_state = 0x9e3779b9u * (i + 1);
+		w.executed = 0;
+		w.stolen = 0;
+	}
+
+	// The main thread is the thread 0, it does not need a pthread.
+	t_thread_index = 0;
+	for (i32 i = 1; i < g_num_threads; i++)
+		pthread_create(&g_workers[i].thread, nullptr, worker_main, (void*)(isize)i);
+}
+
+void
+jobs::shutdown()
+{
+	logger.log("Stopping job system.");
+
+	pthread_mutex_lock(&g_sleep_mutex);
+	g_running = false;
+	pthread_cond_broadcast(&g_sleep_cond);
+	pthread_mutex_unlock(&g_sleep_mutex);
+
+	for (i32 i = 1; i < g_num_threads; i++)
+		pthread_join(g_workers[i].thread, nullptr);
+
+	for (i32 i = 0; i < g_num_threads; i++)
+		delete[] g_workers[i].job_pool;
+
+	pthread_cond_destroy(&g_sleep_cond);
+	pthread_mutex_destroy(&g_sleep_mutex);
+
+	delete[] g_workers;
+	g_workers = nullptr;
+	g_num_threads = 1;
+	t_thread_index = -1;
+}
+
+Job *
+jobs::create(JobFunction function, const void *data, usize data_size)
+{
+	LT_Assert(data_size <= JOB_DATA_SIZE);
+	LT_Assert(t_thread_index >= 0);
+
+	Worker &self = g_workers[t_thread_index];
+	Job *job = &self.job_pool[self.next_job++ & (MAX_JOBS_PER_THREAD - 1)];
+	// The ring wrapped around onto a job that is still alive.
+	LT_Assert(job->unfinished.load(std::memory_order_acquire) == 0);
+
+	job->function = function;
+	job->parent = nullptr;
+	job->unfinished.store(1, std::memory_order_relaxed);
+	if (data_size > 0)
+		memcpy(job->data, data, data_size);
+
+	return job;
+}
+
+Job *
+jobs::create_child(Job *parent, JobFunction function, const void *data, usize data_size)
+{
+	parent->unfinished.fetch_add(1, std::memory_order_relaxed);
+
+	Job *job = create(function, data, data_size);
+	job->parent = parent;
+	return job;
+}
+
+void
+jobs::run(Job *job)
+{
+	LT_Assert(t_thread_index >= 0);
+	queue_push(&g_workers[t_thread_index].queue, job);
+	g_pending++;
+
+	if (g_sleeping.load() > 0)
+	{
+		pthread_mutex_lock(&g_sleep_mutex);
+		pthread_cond_signal(&g_sleep_cond);
+		pthread_mutex_unlock(&g_sleep_mutex);
+	}
+}
+
+bool
+jobs::is_finished(const Job *job)
+{
+	return job->unfinished.load(std::memory_order_acquire) == 0;
+}
+
+void
+jobs::wait(const Job *job)
+{
+	// Instead of blocking, execute other jobs until the one we wait for is done.
+	while (!is_finished(job))
+	{
+		Job *next = get_job();
+		if (next)
+			execute(next);
+		else
+			sched_yield();
+	}
+}
+
+struct ParallelForRange
+{
+	const ParallelForFunction *function;
+	isize begin;
+	isize end;
+	isize batch_size;
+};
+
+static_assert(sizeof(ParallelForRange) <= JOB_DATA_SIZE, "range should fit inside the job");
+
+lt_internal void
+parallel_for_job(Job *job, const void *data)
+{
+	const ParallelForRange *range = (const ParallelForRange*)data;
+
+	if (range->end - range->begin > range->batch_size)
+	{
+		// Split the range in two, so idle threads can steal big halves of the work.
+		const isize middle = range->begin + (range->end - range->begin) / 2;
+
+		ParallelForRange left = *range;
+		left.end = middle;
+		ParallelForRange right = *range;
+		right.begin = middle;
+
+		jobs::run(jobs::create_child(job, parallel_for_job, &left, sizeof(left)));
+		jobs::run(jobs::create_child(job, parallel_for_job, &right, sizeof(right)));
+	}
+	else
+	{
+		(*range->function)(range->begin, range->end);
+	}
+}
+
+void
+jobs::parallel_for(isize count, isize batch_size, const ParallelForFunction &fn)
+{
+	if (count <= 0)
+		return;
+
+	if (batch_size < 1)
+		batch_size = 1;
+
+	if (count <= batch_size || g_num_threads == 1)
+	{
+		fn(0, count);
+		return;
+	}
+
+	ParallelForRange range = {&fn, 0, count, batch_size};
+	Job *root = create(parallel_for_job, &range, sizeof(range));
+	run(root);
+	wait(root);
+}
+
+i32
+jobs::num_threads()
+{
+	return g_num_threads;
+}
+
+i32
+jobs::thread_index()
+{
+	return t_thread_index;
+}
+
+JobWorkerStats
+jobs::worker_stats(i32 thread_index)
+{
+	LT_Assert(thread_index >= 0 && thread_index < g_num_threads);
+	JobWorkerStats stats;
+	stats.executed = g_workers[thread_index].executed.load(std::memory_order_relaxed);
+	stats.stolen = g_workers[thread_index].stolen.load(std::memory_order_relaxed);
+	return stats;
+}
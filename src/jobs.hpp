@@ -0,0 +1,68 @@
+#ifndef __JOBS_HPP__
+#define __JOBS_HPP__
+
+#include <atomic>
+#include <functional>
+#include "lt_core.hpp"
+
+// Bytes of user data that can be copied inside a job.
+#define JOB_DATA_SIZE 48
+
+struct Job;
+
+typedef void (*JobFunction)(Job *job, const void *data);
+
+//
+// A job is a function plus a copy of its data. A job is only finished once itself and
+// all of its children have finished, so waiting on a parent waits on the whole tree.
+//
+struct Job
+{
+	JobFunction       function;
+	Job              *parent;
+	std::atomic<i32>  unfinished;
+	alignas(16) u8    data[JOB_DATA_SIZE];
+};
+
+typedef std::function<void(isize begin, isize end)> ParallelForFunction;
+
+struct JobWorkerStats
+{
+	u64 executed;
+	u64 stolen;
+};
+
+//
+// Work stealing job system. Every thread (the main thread included) owns a lock free deque of
+// jobs, pushing and popping at the bottom while idle threads steal from the top of the others.
+//
+// Jobs are allocated from per thread ring buffers and are reused without being freed,
+// so a thread should not have more than MAX_JOBS_PER_THREAD jobs alive at the same time.
+//
+namespace jobs
+{
+
+void  init(i32 num_workers = -1);
+void  shutdown();
+
+Job  *create(JobFunction function, const void *data = nullptr, usize data_size = 0);
+Job  *create_child(Job *parent, JobFunction function, const void *data = nullptr, usize data_size = 0);
+void  run(Job *job);
+void  wait(const Job *job);
+bool  is_finished(const Job *job);
+
+// Calls fn over [0, count) in ranges of at most batch_size elements, and returns when all
+// of them are done.
+void  parallel_for(isize count, isize batch_size, const ParallelForFunction &fn);
+
+// Number of threads that execute jobs, including the main thread.
+i32   num_threads();
+// Index of the calling thread in [0, num_threads()), the main thread being 0. -1 on threads
+// outside of the job system.
+i32   thread_index();
+
+JobWorkerStats worker_stats(i32 thread_index);
+
+};
+
+#endif // __JOBS_HPP__
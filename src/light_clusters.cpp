@@ -0,0 +1,300 @@
+#include "light_clusters.hpp"
+#include <math.h>
+#include <xmmintrin.h>
+#include "glad/glad.h"
+#include "entities.hpp"
+#include "camera.hpp"
+#include "jobs.hpp"
+#include "uniform_blocks.hpp"
+#include "profiler.hpp"
+
+// Every cluster index fits in the upper half of a binned pair, and every light in the lower.
+#define MAX_CLUSTER_LIGHTS 0xffff
+static_assert(CLUSTER_GRID_X * CLUSTER_GRID_Y <= 0xffff, "Clusters of a slice don't fit in 16 bits.");
+
+const char *const cluster_texture_names[ClusterTexture_Count] = {
+	"light_data",
+	"cluster_grid",
+	"light_indices",
+};
+
+lt_internal const GLenum cluster_texture_formats[ClusterTexture_Count] = {
+	GL_RGBA32F,
+	GL_RG32UI,
+	GL_R32UI,
+};
+
+f32
+point_light_radius(const LightEmmiter &le)
+{
+	f32 brightest = 0.0f;
+	for (i32 i = 0; i < 3; i++)
+	{
+		brightest = fmaxf(brightest, le.diffuse.val[i]);
+		brightest = fmaxf(brightest, le.specular.val[i]);
+	}
+
+	// Solve constant + linear*d + quadratic*d^2 = 256 * brightest for d.
+	const f32 target = 256.0f * brightest;
+	if (le.constant >= target)
+		return 0.0f;
+	if (le.quadratic > 0.0f)
+		return (-le.linear + sqrtf(le.linear*le.linear - 4.0f*le.quadratic*(le.constant - target)))
+			/ (2.0f * le.quadratic);
+	if (le.linear > 0.0f)
+		return (target - le.constant) / le.linear;
+	// Lights without falloff reach everything.
+	return 1e30f;
+}
+
+LightClusters
+create_light_clusters()
+{
+	LightClusters clusters = {};
+	glGenBuffers(ClusterTexture_Count, clusters.buffers);
+	glGenTextures(ClusterTexture_Count, clusters.textures);
+
+	const u32 zeros[4] = {};
+	for (i32 i = 0; i < ClusterTexture_Count; i++)
+	{
+		glBindBuffer(GL_TEXTURE_BUFFER, clusters.buffers[i]);
+		glBufferData(GL_TEXTURE_BUFFER, sizeof(zeros), zeros, GL_STREAM_DRAW);
+		glBindTexture(GL_TEXTURE_BUFFER, clusters.textures[i]);
+		glTexBuffer(GL_TEXTURE_BUFFER, cluster_texture_formats[i], clusters.buffers[i]);
+	}
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	return clusters;
+}
+
+// Distance to the camera where a depth slice starts, slices are exponential so clusters
+// stay roughly cubic.
+lt_internal inline f32
+slice_depth(const Frustum &f, i32 slice)
+{
+	return f.znear * powf(f.zfar / f.znear, (f32)slice / CLUSTER_GRID_Z);
+}
+
+lt_internal void
+compute_cluster_bounds(LightClusters &c, const Frustum &f)
+{
+	c.fovy = f.fovy;
+	c.ratio = f.ratio;
+	c.znear = f.znear;
+	c.zfar = f.zfar;
+	c.cluster_bounds.resize(CLUSTER_COUNT);
+
+	const f32 tan_y = tanf(lt::radians(f.fovy) * 0.5f);
+	const f32 tan_x = tan_y * f.ratio;
+
+	for (i32 k = 0; k < CLUSTER_GRID_Z; k++)
+	{
+		const f32 near = slice_depth(f, k);
+		const f32 far = slice_depth(f, k + 1);
+
+		for (i32 j = 0; j < CLUSTER_GRID_Y; j++)
+		{
+			const f32 y0 = (2.0f * j / CLUSTER_GRID_Y - 1.0f) * tan_y;
+			const f32 y1 = (2.0f * (j + 1) / CLUSTER_GRID_Y - 1.0f) * tan_y;
+
+			for (i32 i = 0; i < CLUSTER_GRID_X; i++)
+			{
+				const f32 x0 = (2.0f * i / CLUSTER_GRID_X - 1.0f) * tan_x;
+				const f32 x1 = (2.0f * (i + 1) / CLUSTER_GRID_X - 1.0f) * tan_x;
+
+				// The tile widens with depth, so take the extremes at both ends of the slice.
+				AABB &box = c.cluster_bounds[(k*CLUSTER_GRID_Y + j)*CLUSTER_GRID_X + i];
+				box.min = Vec3f(fminf(x0*near, x0*far), fminf(y0*near, y0*far), -far);
+				box.max = Vec3f(fmaxf(x1*near, x1*far), fmaxf(y1*near, y1*far), -near);
+			}
+		}
+	}
+}
+
+lt_internal void
+bin_slice(LightClusters &c, i32 k, i32 num_padded)
+{
+	const AABB *bounds = &c.cluster_bounds[k * CLUSTER_GRID_X * CLUSTER_GRID_Y];
+	const f32 near = -bounds[0].max.z;
+	const f32 far = -bounds[0].min.z;
+
+	std::vector<u32> &pairs = c.slice_pairs[k];
+	std::vector<u32> &counts = c.slice_counts[k];
+	pairs.clear();
+	counts.assign(CLUSTER_GRID_X * CLUSTER_GRID_Y, 0);
+
+	const __m128 near4 = _mm_set1_ps(near);
+	const __m128 far4 = _mm_set1_ps(far);
+
+	for (i32 base = 0; base < num_padded; base += 4)
+	{
+		// Four lights at a time against the depth range of the slice.
+		const __m128 depth = _mm_loadu_ps(&c.view_depth[base]);
+		const __m128 radius = _mm_loadu_ps(&c.radius[base]);
+		const __m128 overlaps = _mm_and_ps(_mm_cmpge_ps(_mm_add_ps(depth, radius), near4),
+										   _mm_cmple_ps(_mm_sub_ps(depth, radius), far4));
+		i32 lanes = _mm_movemask_ps(overlaps);
+
+		while (lanes)
+		{
+			const i32 lane = __builtin_ctz(lanes);
+			lanes &= lanes - 1;
+
+			const i32 l = base + lane;
+			const Vec3f center(c.view_x[l], c.view_y[l], -c.view_depth[l]);
+			const f32 r = c.radius[l];
+
+			// Columns share their x range and rows their y range, which narrows the clusters
+			// to test exactly.
+			i32 i0 = 0, i1 = CLUSTER_GRID_X - 1;
+			while (i0 <= i1 && bounds[i0].max.x < center.x - r) i0++;
+			while (i1 >= i0 && bounds[i1].min.x > center.x + r) i1--;
+			i32 j0 = 0, j1 = CLUSTER_GRID_Y - 1;
+			while (j0 <= j1 && bounds[j0*CLUSTER_GRID_X].max.y < center.y - r) j0++;
+			while (j1 >= j0 && bounds[j1*CLUSTER_GRID_X].min.y > center.y + r) j1--;
+
+			for (i32 j = j0; j <= j1; j++)
+			{
+				for (i32 i = i0; i <= i1; i++)
+				{
+					const i32 cluster = j*CLUSTER_GRID_X + i;
+					const AABB &box = bounds[cluster];
+
+					f32 dist2 = 0.0f;
+					for (i32 axis = 0; axis < 3; axis++)
+					{
+						const f32 v = center.val[axis];
+						const f32 d = v - fminf(fmaxf(v, box.min.val[axis]), box.max.val[axis]);
+						dist2 += d*d;
+					}
+
+					if (dist2 <= r*r)
+					{
+						pairs.push_back((u32)cluster << 16 | (u32)l);
+						counts[cluster]++;
+					}
+				}
+			}
+		}
+	}
+}
+
+lt_internal void
+upload_texture_buffer(u32 buffer, const void *data, usize size)
+{
+	// Buffer textures can't be empty, keep at least one texel around.
+	const u32 zeros[4] = {};
+	glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+	if (size > 0)
+		glBufferData(GL_TEXTURE_BUFFER, size, data, GL_STREAM_DRAW);
+	else
+		glBufferData(GL_TEXTURE_BUFFER, sizeof(zeros), zeros, GL_STREAM_DRAW);
+}
+
+void
+update_light_clusters(LightClusters &c, const Entities &entities, const Camera &camera,
+					  const Mat4f &view, LightsBlock &block)
+{
+	PROFILE_SCOPE("Light clusters");
+	const Frustum &f = camera.frustum;
+	if (c.cluster_bounds.empty() || c.fovy != f.fovy || c.ratio != f.ratio
+		|| c.znear != f.znear || c.zfar != f.zfar)
+		compute_cluster_bounds(c, f);
+
+	c.lights.clear();
+	c.view_x.clear();
+	c.view_y.clear();
+	c.view_depth.clear();
+	c.radius.clear();
+
+	for (const Archetype &arch : entities.archetypes)
+	{
+		if (!arch.matches(ComponentKind_LightEmmiter))
+			continue;
+
+		for (const EntityChunk *chunk : arch.chunks)
+		{
+			for (i32 row = 0; row < chunk->count; row++)
+			{
+				const LightEmmiter &le = chunk->light_emmiter[row];
+				const Vec3f &p = le.position;
+				const f32 radius = point_light_radius(le);
+
+				c.lights.push_back(ClusterLight{
+					Vec4f(p.x, p.y, p.z, radius),
+					Vec4f(le.ambient.x, le.ambient.y, le.ambient.z, le.constant),
+					Vec4f(le.diffuse.x, le.diffuse.y, le.diffuse.z, le.linear),
+					Vec4f(le.specular.x, le.specular.y, le.specular.z, le.quadratic),
+				});
+
+				c.view_x.push_back(view(0, 0)*p.x + view(0, 1)*p.y + view(0, 2)*p.z + view(0, 3));
+				c.view_y.push_back(view(1, 0)*p.x + view(1, 1)*p.y + view(1, 2)*p.z + view(1, 3));
+				c.view_depth.push_back(-(view(2, 0)*p.x + view(2, 1)*p.y + view(2, 2)*p.z + view(2, 3)));
+				c.radius.push_back(radius);
+			}
+		}
+	}
+
+	const i32 num_lights = c.lights.size();
+	LT_Assert(num_lights <= MAX_CLUSTER_LIGHTS);
+
+	// Padding lanes sit far behind the camera so they never overlap a slice.
+	while (c.radius.size() % 4 != 0)
+	{
+		c.view_x.push_back(0.0f);
+		c.view_y.push_back(0.0f);
+		c.view_depth.push_back(-1e30f);
+		c.radius.push_back(0.0f);
+	}
+
+	jobs::parallel_for(CLUSTER_GRID_Z, 1, [&c](isize begin, isize end) {
+		for (isize k = begin; k < end; k++)
+			bin_slice(c, k, c.radius.size());
+	});
+
+	// Each slice gets a contiguous range of the index list, ordered by cluster.
+	u32 slice_offsets[CLUSTER_GRID_Z];
+	u32 total = 0;
+	for (i32 k = 0; k < CLUSTER_GRID_Z; k++)
+	{
+		slice_offsets[k] = total;
+		total += c.slice_pairs[k].size();
+	}
+	c.indices.resize(total);
+	c.grid.resize(2 * CLUSTER_COUNT);
+
+	jobs::parallel_for(CLUSTER_GRID_Z, 1, [&c, &slice_offsets](isize begin, isize end) {
+		for (isize k = begin; k < end; k++)
+		{
+			u32 *grid = &c.grid[2 * k * CLUSTER_GRID_X * CLUSTER_GRID_Y];
+			u32 offset = slice_offsets[k];
+			for (i32 cluster = 0; cluster < CLUSTER_GRID_X * CLUSTER_GRID_Y; cluster++)
+			{
+				grid[2*cluster + 0] = offset;
+				grid[2*cluster + 1] = 0;
+				offset += c.slice_counts[k][cluster];
+			}
+
+			for (u32 pair : c.slice_pairs[k])
+			{
+				u32 *cell = &grid[2 * (pair >> 16)];
+				c.indices[cell[0] + cell[1]++] = pair & 0xffff;
+			}
+		}
+	});
+
+	upload_texture_buffer(c.buffers[ClusterTexture_LightData], c.lights.data(),
+						  c.lights.size() * sizeof(ClusterLight));
+	upload_texture_buffer(c.buffers[ClusterTexture_Grid], c.grid.data(), c.grid.size() * sizeof(u32));
+	upload_texture_buffer(c.buffers[ClusterTexture_Indices], c.indices.data(), c.indices.size() * sizeof(u32));
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	// The shader finds the slice with log(depth) * scale + bias.
+	const f32 log_range = logf(f.zfar / f.znear);
+	block.cluster_grid[0] = CLUSTER_GRID_X;
+	block.cluster_grid[1] = CLUSTER_GRID_Y;
+	block.cluster_grid[2] = CLUSTER_GRID_Z;
+	block.cluster_grid[3] = num_lights;
+	block.cluster_depth_scale = CLUSTER_GRID_Z / log_range;
+	block.cluster_depth_bias = -CLUSTER_GRID_Z * logf(f.znear) / log_range;
+}
@@ -0,0 +1,83 @@
+#ifndef __LIGHT_CLUSTERS_HPP__
+#define __LIGHT_CLUSTERS_HPP__
+
+#include <vector>
+#include "lt_core.hpp"
+#include "lt_math.hpp"
+#include "bvh.hpp"
+
+struct Entities;
+struct Camera;
+struct LightsBlock;
+struct LightEmmiter;
+
+//
+// Clustered forward shading. The view frustum is split in a grid of clusters (tiles on the
+// screen, exponential slices in depth), and every point light is binned into the clusters
+// its sphere of influence touches. The fragment shader finds its cluster and only evaluates
+// the lights listed for it.
+//
+// Everything goes to the GPU as buffer textures:
+//   light_data     4 RGBA32F texels per light (position and radius, then ambient, diffuse
+//                  and specular with the attenuation constant, linear and quadratic terms).
+//   cluster_grid   RG32UI per cluster, offset and count of its lights in light_indices.
+//   light_indices  R32UI, indexes into light_data.
+//
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+#define CLUSTER_COUNT (CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z)
+
+struct ClusterLight
+{
+	Vec4f position_radius;
+	Vec4f ambient_constant;
+	Vec4f diffuse_linear;
+	Vec4f specular_quadratic;
+};
+
+enum ClusterTexture
+{
+	ClusterTexture_LightData,
+	ClusterTexture_Grid,
+	ClusterTexture_Indices,
+
+	ClusterTexture_Count,
+};
+
+// Sampler names in the shaders, indexed by ClusterTexture.
+extern const char *const cluster_texture_names[ClusterTexture_Count];
+
+struct LightClusters
+{
+	u32 buffers[ClusterTexture_Count];
+	u32 textures[ClusterTexture_Count];
+
+	// Filled by update_light_clusters.
+	std::vector<ClusterLight> lights;
+	std::vector<u32>          grid;     // Offset and count for each cluster.
+	std::vector<u32>          indices;
+
+	// Projection the cluster bounds were computed for.
+	f32 fovy, ratio, znear, zfar;
+	// View space bounds of every cluster.
+	std::vector<AABB> cluster_bounds;
+
+	// View space spheres of the lights, as separate arrays for the SIMD binning. Padded to
+	// a multiple of 4.
+	std::vector<f32> view_x, view_y, view_depth, radius;
+	// (cluster in slice << 16 | light) pairs binned for each depth slice.
+	std::vector<u32> slice_pairs[CLUSTER_GRID_Z];
+	std::vector<u32> slice_counts[CLUSTER_GRID_Z];
+};
+
+// Distance at which the light contributes less than 1/256 of its color.
+f32 point_light_radius(const LightEmmiter &le);
+
+LightClusters create_light_clusters();
+// Bins every point light into the clusters of the camera's frustum and uploads the result.
+// Also writes the cluster parameters the shaders need into the lights block.
+void          update_light_clusters(LightClusters &clusters, const Entities &entities, const Camera &camera,
+									const Mat4f &view, LightsBlock &block);
+
+#endif // __LIGHT_CLUSTERS_HPP__
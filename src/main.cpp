@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <math.h>
 
 #include <functional>
 #include <string>
@@ -27,7 +28,18 @@
 #include "input.hpp"
 #include "entities.hpp"
 #include "application.hpp"
-#include "macros.hpp"
+#include "systems.hpp"
+#include "scene.hpp"
+#include "jobs.hpp"
+#include "entity_commands.hpp"
+#include "render_queue.hpp"
+#include "uniform_blocks.hpp"
+#include "light_clusters.hpp"
+#include "post_process.hpp"
+#include "occlusion.hpp"
+#include "gpu_profiler.hpp"
+#include "profiler.hpp"
+#include "matrix.hpp"
 
 //
 // TODOs
@@ -61,7 +73,9 @@ struct Counter
 lt_global_variable lt::Logger logger("main");
 lt_global_variable bool g_display_debug_gui = true;
 lt_global_variable Key g_keyboard[NUM_KEYBOARD_KEYS] = {};
+lt_global_variable Key g_mouse_left = {};
 lt_global_variable Counter g_counter = {};
+lt_global_variable const char *const SCENE_PATH = RESOURCES_PATH "scene.bin";
 
 lt_internal void
 update_key_state(Key &key, bool key_pressed)
@@ -100,14 +114,28 @@ process_input(GLFWwindow *win, Key *kb)
 	update_key_state(kb[GLFW_KEY_LEFT], glfwGetKey(win, GLFW_KEY_LEFT));
 	update_key_state(kb[GLFW_KEY_RIGHT], glfwGetKey(win, GLFW_KEY_RIGHT));
 	update_key_state(kb[GLFW_KEY_F1], glfwGetKey(win, GLFW_KEY_F1));
+	update_key_state(g_mouse_left, glfwGetMouseButton(win, GLFW_MOUSE_BUTTON_LEFT));
 
 	if (kb[GLFW_KEY_F1].last_transition == Key::Transition_Down)
 		g_display_debug_gui = !g_display_debug_gui;
 }
 
+// Selects the entity under the cursor, or clears the selection when nothing is hit.
+lt_internal void
+select_entity_under_cursor(GLFWwindow *win, const Camera &camera, const Entities &entities)
+{
+	f64 cursor_x, cursor_y;
+	glfwGetCursorPos(win, &cursor_x, &cursor_y);
+	i32 width, height;
+	glfwGetWindowSize(win, &width, &height);
+
+	const Ray ray = camera.ray_through(2.0f*cursor_x/width - 1.0f, 1.0f - 2.0f*cursor_y/height);
+	dgui::State::instance().selected_entity_handle = pick_entity(entities, ray);
+}
+
 #ifdef DEV_ENV // NOTE: Do I need to wrap this function around ifdefs?
 lt_internal void
-process_watcher_events(Shader &basic_shader, Shader &light_shader)
+process_watcher_events(Shader &basic_shader, Shader &light_shader, PostProcessChain &post_process)
 {
     WatcherEvent *ev;
     while ((ev = watcher_peek_event()) != nullptr)
@@ -120,6 +148,7 @@ process_watcher_events(Shader &basic_shader, Shader &light_shader)
             logger.log("File ", ev->name, " changed, requesting shader recompile.");
             if (ev->name == basic_shader.name) basic_shader.recompile();
             if (ev->name == light_shader.name) light_shader.recompile();
+            if (ev->name == POST_PROCESS_SHADER) post_process.recompile();
         }
 
         // Notify the watcher that the event was consumed.
@@ -128,20 +157,6 @@ process_watcher_events(Shader &basic_shader, Shader &light_shader)
 }
 #endif
 
-enum TextureFormat
-{
-	TextureFormat_RGB = GL_RGB8,
-	TextureFormat_RGBA = GL_RGBA,
-	TextureFormat_SRGB = GL_SRGB8,
-	TextureFormat_SRGBA = GL_SRGB_ALPHA,
-};
-
-enum PixelFormat
-{
-	PixelFormat_RGB = GL_RGB,
-	PixelFormat_RGBA = GL_RGBA,
-};
-
 lt_internal u32
 load_cubemap_texture(const char **textures_files, i32 num_textures,
 					 TextureFormat texture_format, PixelFormat pixel_format)
@@ -186,109 +201,294 @@ load_cubemap_texture(const char **textures_files, i32 num_textures,
 	return texture;
 }
 
-lt_internal u32
-load_texture(const char *path, TextureFormat texture_format, PixelFormat pixel_format)
-{
-    std::string fullpath = std::string(RESOURCES_PATH) + std::string(path);
-    // Textures
-	GLuint texture;
-    glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture);
-    // Wrapping and filtering
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    // Mipmaps
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    i32 width, height, num_channels;
-    uchar *image_data = stbi_load(fullpath.c_str(), &width, &height, &num_channels, 0);
-    if (image_data)
-    {
-        logger.log("Texture ", fullpath, " loaded successfuly.");
-        logger.log("    [", width, " x ", height, "] (num channels = ", num_channels, ")");
-
-		const i32 mipmap_level = 0;
-        glTexImage2D(GL_TEXTURE_2D, mipmap_level, texture_format, width, height,
-					 0, pixel_format, GL_UNSIGNED_BYTE, image_data);
-
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        logger.log("    OpenGL read texture successfully.");
-    }
-    else
-    {
-        logger.error("    Failed loading texture");
-    }
-    // Free image
-    stbi_image_free(image_data);
-	return texture;
-}
-
-struct DirectionalLight
-{
-	Vec3f direction;
-	Vec3f ambient;
-    Vec3f diffuse;
-    Vec3f specular;
-};
-
 lt_internal void
-game_update(Key *kb, Camera& camera, dgui::State &state)
+register_systems(SystemScheduler &scheduler, Key *kb, Camera &camera, Entities &entities,
+				 EntityCommands &commands, const Renderable &spawned_cube)
 {
-	camera.update(kb);
-	// Update debug gui state variables.
-	state.camera_pos = camera.frustum.position;
-	state.camera_front = camera.frustum.front.v;
+	scheduler.add("Camera", ComponentKind_None, ComponentKind_Camera, [kb, &camera](f64 dt) {
+		LT_Unused(dt);
+		camera.update(kb);
+		// Update debug gui state variables.
+		auto &state = dgui::State::instance();
+		state.camera_pos = camera.frustum.position;
+		state.camera_front = camera.frustum.front.v;
+	});
+
+	scheduler.add("World transforms", ComponentKind_None, ComponentKind_Transform, [&entities](f64 dt) {
+		LT_Unused(dt);
+		entities.hierarchy.update(entities);
+	});
+
+	scheduler.add("Entity bounds", ComponentKind_Transform | ComponentKind_Renderable, ComponentKind_Bounds,
+				  [&entities](f64 dt) {
+		LT_Unused(dt);
+		update_entity_bounds(entities);
+	});
+
+	scheduler.add("Light positions", ComponentKind_Transform, ComponentKind_LightEmmiter, [&entities](f64 dt) {
+		LT_Unused(dt);
+		update_light_positions(entities);
+	});
+
+	// Only records commands, the entities are created at the next playback.
+	scheduler.add("Spawner", ComponentKind_None, ComponentKind_None, [&commands, spawned_cube](f64 dt) {
+		LT_Unused(dt);
+		auto &state = dgui::State::instance();
+		const i32 count = state.spawn_cubes_requested;
+		if (count == 0)
+			return;
+		const i32 first = state.num_spawned_cubes;
+		state.spawn_cubes_requested = 0;
+		state.num_spawned_cubes += count;
+
+		// Every batch records to the buffer of the thread running it. The sort key is the cube
+		// number, so the playback order doesn't depend on which thread ran which batch.
+		jobs::parallel_for(count, 64, [&](isize begin, isize end) {
+			EntityCommandBuffer &buffer = commands.local();
+			const u32 old_key = buffer.sort_key;
+			for (isize i = begin; i < end; i++)
+			{
+				const i32 n = first + i;
+				buffer.sort_key = n;
+				const EntityHandle h = buffer.create(ComponentKind_Renderable | ComponentKind_Transform |
+													 ComponentKind_ShadowCaster);
+				buffer.set_renderable(h, spawned_cube);
+
+				// Stacked along a spiral around the default scene.
+				const f32 angle = n * 0.5f;
+				const f32 radius = 6.0f + n * 0.05f;
+				Mat4f transform;
+				transform = lt::translation(transform, Vec3f(cosf(angle) * radius, 0.25f + (n % 8) * 0.5f,
+															 sinf(angle) * radius));
+				transform = lt::scale(transform, Vec3f(0.25f));
+				buffer.set_transform(h, transform);
+			}
+			buffer.sort_key = old_key;
+		});
+	});
 }
 
 struct Shaders
 {
     Shader *light;
     Shader *selection;
-    Shader *hdr_texture_to_quad;
     Shader *basic;
     Shader *skybox;
     Shader *shadow_map;
     Shader *shadow_map_render;
 	Shader *bloom;
+	Shader *gbuffer;
+	Shader *deferred_lighting;
+	Shader *depth_prepass;
+	Shader *overdraw;
+	// Variants are compiled the first time each set of stages is drawn.
+	PostProcessChain post_process;
 
 	~Shaders()
 	{
 		delete light;
 		delete selection;
-		delete hdr_texture_to_quad;
 		delete basic;
 		delete skybox;
 		delete shadow_map;
 		delete shadow_map_render;
 		delete bloom;
+		delete gbuffer;
+		delete deferred_lighting;
+		delete depth_prepass;
+		delete overdraw;
 	}
 };
 
+// Builds the scene used when there is no scene file to load.
+lt_internal void
+create_default_scene(Entities &entities, Resources &resources, Shaders &shaders)
+{
+    const u32 box_texture_diffuse = resources.load_texture("155.JPG", TextureFormat_SRGB, PixelFormat_RGB);
+    const u32 box_texture_normal = resources.load_texture("155_norm.JPG", TextureFormat_RGB, PixelFormat_RGB);
+
+    const u32 floor_texture_diffuse = resources.load_texture("177.JPG", TextureFormat_SRGB, PixelFormat_RGB);
+    const u32 floor_texture_normal = resources.load_texture("177_norm.JPG", TextureFormat_RGB, PixelFormat_RGB);
+
+	// Wall textures
+    const u32 wall_texture_diffuse = resources.load_texture("brickwall.jpg", TextureFormat_SRGB, PixelFormat_RGB);
+    const u32 wall_texture_normal = resources.load_texture("brickwall_normal.jpg", TextureFormat_RGB, PixelFormat_RGB);
+
+    const u32 pallet_texture_diffuse = resources.load_texture("pallet/diffus.tga", TextureFormat_SRGB, PixelFormat_RGB);
+    const u32 pallet_texture_specular = resources.load_texture("pallet/specular.tga", TextureFormat_SRGB, PixelFormat_RGB);
+    const u32 pallet_texture_normal = resources.load_texture("pallet/normal.tga", TextureFormat_RGB, PixelFormat_RGB);
+
+	// Model
+	Mat4f pallet_transform;
+	pallet_transform = lt::translation(pallet_transform, Vec3f(10, 1, 0));
+	pallet_transform = lt::scale(pallet_transform, Vec3f(0.02));
+	create_entity_from_model(entities, resources, "pallet/pallet.obj", shaders.basic,
+							 pallet_transform, 32.0f, pallet_texture_diffuse,
+							 pallet_texture_specular, pallet_texture_normal);
+	
+	// cubes
+	const Vec3f positions[] = {
+		Vec3f(0.0f, 2.0f, 0.0f),
+		Vec3f(4.0f, 3.0f, 0.0f),
+		Vec3f(1.0f, 5.0f, 2.0f),
+		Vec3f(-5.0f, 2.0f, -1.0f),
+		Vec3f(-3.0f, 5.1f, -7.0f),
+	};
+	const Vec3f scales[] = {
+		Vec3f(1),
+		Vec3f(1),
+		Vec3f(1),
+		Vec3f(1),
+		Vec3f(2),
+	};
+	for (usize i = 0; i < LT_Count(positions); i++)
+	{
+		if (i == 2) break;
+		Mat4f transform;
+		transform = lt::translation(transform, positions[i]);
+		transform = lt::scale(transform, scales[i]);
+		create_textured_cube(entities, resources, shaders.basic, transform, 128,
+							 box_texture_diffuse, box_texture_diffuse, box_texture_normal);
+	}
+	// Point light
+	{
+		LightEmmiter le = {};
+		le.position = Vec3f(3.0f, 5.0f, 0.0f);
+		le.ambient = Vec3f(0.01f);
+		le.diffuse = Vec3f(3.0f);
+		le.specular = Vec3f(1.0f);
+		le.constant = 1.0f;
+		le.linear = 0.35;
+		le.quadratic = 0.44f;
+		le.shader = shaders.basic;
+
+		Mat4f transform;
+		transform = lt::translation(transform, Vec3f(3, 5, 0));
+		transform = lt::scale(transform, Vec3f(0.1f));
+
+		create_point_light(entities, resources, shaders.light, transform, le, 0, 0);
+	}
+	// Wall on left
+	{
+		Mat4f transform(1);
+		transform = lt::translation(transform, Vec3f(-18, 18, 0));
+		transform = lt::scale(transform, Vec3f(.5f, 18, 28));
+		const EntityHandle wall = create_textured_cube(entities, resources, shaders.basic, transform, 128,
+													   wall_texture_diffuse, wall_texture_diffuse, wall_texture_normal);
+		entities.add_components(wall, ComponentKind_Occluder);
+	}
+	// Wall on right
+	{
+		Mat4f transform(1);
+		transform = lt::translation(transform, Vec3f(37, 18, 0));
+		transform = lt::scale(transform, Vec3f(.5f, 18, 28));
+		const EntityHandle wall = create_textured_cube(entities, resources, shaders.basic, transform, 128,
+													   wall_texture_diffuse, wall_texture_diffuse, wall_texture_normal);
+		entities.add_components(wall, ComponentKind_Occluder);
+	}
+	// Wall on top
+	{
+		Mat4f transform(1);
+		transform = lt::translation(transform, Vec3f(9.5f, 36.5f, 0));
+		transform = lt::scale(transform, Vec3f(28, .5f, 28));
+		const EntityHandle wall = create_textured_cube(entities, resources, shaders.basic, transform, 128,
+													   wall_texture_diffuse, wall_texture_diffuse, wall_texture_normal);
+		entities.add_components(wall, ComponentKind_Occluder);
+	}
+	// Wall on the back
+	{
+		Mat4f transform(1);
+		transform = lt::translation(transform, Vec3f(9.5f, 18, 27.5f));
+		transform = lt::scale(transform, Vec3f(27, 18, .5f));
+		const EntityHandle wall = create_textured_cube(entities, resources, shaders.basic, transform, 128,
+													   wall_texture_diffuse, wall_texture_diffuse, wall_texture_normal);
+		entities.add_components(wall, ComponentKind_Occluder);
+	}
+	// Wall on the front
+	{
+		Mat4f transform(1);
+		transform = lt::translation(transform, Vec3f(30.0f, 18, -28.5f));
+		transform = lt::scale(transform, Vec3f(27, 18, .5f));
+		const EntityHandle wall = create_textured_cube(entities, resources, shaders.basic, transform, 128,
+													   wall_texture_diffuse, wall_texture_diffuse, wall_texture_normal);
+		entities.add_components(wall, ComponentKind_Occluder);
+	}
+	// FLOOR
+	{
+		Mat4f transform(1);
+		transform = lt::translation(transform, Vec3f(9.5f, 0, 0));
+		transform = lt::rotation_x(transform, -90);
+		transform = lt::scale(transform, Vec3f(28, 28, 1));
+
+		const EntityHandle floor = create_plane(entities, resources, shaders.basic, transform, 32, 10.0f,
+												floor_texture_diffuse, floor_texture_diffuse, floor_texture_normal);
+		entities.add_components(floor, ComponentKind_Occluder);
+	}
+}
+
 lt_internal void
 game_render(f64 lag_offset, const Application &app, Camera &camera, Entities &entities,
-			Shaders &shaders, ShadowMap &shadow_map, const Mat4f &light_view, Vec3f dir_light_pos,
-			Mesh *shadow_map_surface, Mesh *skybox_mesh, GLContext &context)
+			Shaders &shaders, ShadowMap &shadow_map,
+			Mesh *shadow_map_surface, Mesh *skybox_mesh, Mesh *light_volume, RenderQueue &render_queue,
+			const UniformBuffers &uniform_buffers, LightsBlock &lights, LightClusters &light_clusters,
+			OcclusionBuffer &occlusion, GpuProfiler &gpu_profiler, GLContext &context)
 {
 	LT_Assert(lag_offset < 1);
 	LT_Assert(lag_offset >= 0);
 
 	auto &state = dgui::State::instance();
 
+	gpu_profiler_begin_frame(gpu_profiler);
+	for (i32 i = 0; i < GpuPass_Count; i++)
+		state.gpu_timings[i] = gpu_profiler.timings[i];
+	state.gpu_dropped_frames = gpu_profiler.dropped_frames;
+
 	camera.interpolate_frustum(lag_offset);
 
 	const Mat4f view_matrix = camera.view_matrix();
 
+	// Per frame constants, shared by every shader through the uniform buffers.
+	{
+		CameraBlock camera_block = {};
+		camera_block.view = view_matrix;
+		camera_block.projection = camera.frustum.projection;
+		camera_block.view_position = camera.frustum.position;
+		camera_block.screen_size = Vec2f(app.screen_width, app.screen_height);
+		camera_block.inv_view_projection = inverse(camera.frustum.projection * view_matrix);
+		update_uniform_buffer(uniform_buffers, UniformBlock_Camera, &camera_block, sizeof(camera_block));
+
+		shadow_map.num_cascades = state.shadow_cascades;
+		shadow_map.split_lambda = state.cascade_split_lambda;
+		shadow_map.max_distance = state.shadow_distance;
+		fit_shadow_cascades(shadow_map, camera.interpolated_frustum, lights.dir_light.direction, lights);
+
+		update_light_clusters(light_clusters, entities, camera, view_matrix, lights);
+		state.num_point_lights = light_clusters.lights.size();
+		state.num_cluster_light_refs = light_clusters.indices.size();
+		update_uniform_buffer(uniform_buffers, UniformBlock_Lights, &lights, sizeof(lights));
+
+		SettingsBlock settings = {};
+		settings.enable_normal_mapping = state.enable_normal_mapping;
+		settings.pcf_texel_offset = state.pcf_texel_offset;
+		settings.pcf_window_side = state.pcf_window_side;
+		settings.bloom_threshold = state.bloom_threshold;
+		update_uniform_buffer(uniform_buffers, UniformBlock_Settings, &settings, sizeof(settings));
+	}
+
 	// Render first to depth map
-	glViewport(0, 0, shadow_map.width, shadow_map.height);
-	glBindFramebuffer(GL_FRAMEBUFFER, shadow_map.fbo); // TODO: move to GLContext
-	glClear(GL_DEPTH_BUFFER_BIT);
-	glDisable(GL_CULL_FACE);
-	draw_entities_for_shadow_map(entities, light_view, dir_light_pos, shadow_map, context);
-	glEnable(GL_CULL_FACE);
+	gpu_pass_begin(gpu_profiler, GpuPass_ShadowMap);
+	draw_entities_for_shadow_map(entities, shadow_map, render_queue, context);
+	gpu_pass_end(gpu_profiler, GpuPass_ShadowMap);
+
+	// Occluders are rasterized on the CPU, the entities they hide don't reach the render queue.
+	occlusion.valid = false;
+	if (state.enable_occlusion_culling)
+	{
+		PROFILE_SCOPE("Occlusion culling");
+		render_occluders(occlusion, entities, camera.frustum.projection * view_matrix);
+	}
+	state.num_occluders = occlusion.num_occluders;
+	state.num_occluder_triangles = occlusion.triangles.size();
 
 	// Actual rendering
 	glViewport(0, 0, app.screen_width, app.screen_height);
@@ -297,8 +497,10 @@ game_render(f64 lag_offset, const Application &app, Camera &camera, Entities &en
 
 	if (state.draw_shadow_map)
 	{
-		// Draws the shadowmap instead of the scene
-		draw_unit_quad(shadow_map_surface, *shaders.shadow_map_render, context);
+		// Draws a cascade of the shadow map instead of the scene
+		context.use_shader(*shaders.shadow_map_render);
+		shaders.shadow_map_render->set1i("cascade", state.shadow_map_cascade);
+		draw_unit_quad(shadow_map_surface, *shaders.shadow_map_render, context, GL_TEXTURE_2D_ARRAY);
 	}
 	else
 	{
@@ -310,29 +512,41 @@ game_render(f64 lag_offset, const Application &app, Camera &camera, Entities &en
 		glStencilFunc(GL_ALWAYS, 1, 0xff);
 		glStencilMask(0x00);
 
-		context.use_shader(*shaders.basic);
-		shaders.basic->set1i("debug_gui_state.enable_normal_mapping",
-							 dgui::State::instance().enable_normal_mapping);
-		shaders.basic->set1f("debug_gui_state.pcf_texel_offset", dgui::State::instance().pcf_texel_offset);
-		shaders.basic->set1i("debug_gui_state.pcf_window_side", dgui::State::instance().pcf_window_side);
-
-		BEGIN_REGION(PerformanceRegion_DrawEntities);
-		draw_entities(lag_offset, entities, camera, context, shadow_map, dgui::State::instance().selected_entity_handle);
-		END_REGION(PerformanceRegion_DrawEntities);
+		{
+			PROFILE_SCOPE("Draw entities");
+			gpu_pass_begin(gpu_profiler, GpuPass_Scene);
+			if (state.enable_deferred_shading)
+				draw_entities_deferred(app, entities, camera, context, shadow_map, light_clusters, occlusion,
+									   render_queue, *shaders.gbuffer, *shaders.deferred_lighting, light_volume,
+									   state.selected_entity_handle);
+			else
+				draw_entities(lag_offset, entities, camera, context, shadow_map, light_clusters, occlusion,
+							  render_queue, *shaders.depth_prepass, *shaders.overdraw, state.selected_entity_handle);
+			gpu_pass_end(gpu_profiler, GpuPass_Scene);
+		}
 
-		if (state.selected_entity_handle != -1)
+		// Only the entities are counted in the overdraw.
+		if (entities.is_valid(state.selected_entity_handle) && !state.showing_overdraw() &&
+			entities.has_all(state.selected_entity_handle, ComponentKind_Transform | ComponentKind_Renderable))
 		{
 			glStencilFunc(GL_NOTEQUAL, 1, 0xff);
 			glStencilMask(0x00);
 
+			gpu_pass_begin(gpu_profiler, GpuPass_Selection);
 			draw_selected_entity(entities, dgui::State::instance().selected_entity_handle,
-								 *shaders.selection, view_matrix, context);
+								 *shaders.selection, context);
+			gpu_pass_end(gpu_profiler, GpuPass_Selection);
 
 			glStencilFunc(GL_ALWAYS, 1, 0xff);
 		}
 
 		// Don't update the stencil buffer for the skybox
-		draw_skybox(skybox_mesh, *shaders.skybox, view_matrix, context);
+		if (!state.showing_overdraw())
+		{
+			gpu_pass_begin(gpu_profiler, GpuPass_Skybox);
+			draw_skybox(skybox_mesh, *shaders.skybox, context);
+			gpu_pass_end(gpu_profiler, GpuPass_Skybox);
+		}
 	}
 
 	if (g_display_debug_gui)
@@ -344,14 +558,9 @@ game_render(f64 lag_offset, const Application &app, Camera &camera, Entities &en
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	context.use_shader(*shaders.hdr_texture_to_quad);
-	shaders.hdr_texture_to_quad->set1i("enable_tone_mapping", state.enable_tone_mapping);
-	shaders.hdr_texture_to_quad->set1i("enable_gamma_correction", state.enable_gamma_correction);
-	shaders.hdr_texture_to_quad->set1f("exposure", state.exposure);
-
-	// draw_unit_quad(app.render_quad, *shaders.hdr_texture_to_quad, context);
-	draw_unit_quad_and_apply_bloom(app, *shaders.hdr_texture_to_quad, *shaders.bloom, context);
+	draw_unit_quad_and_post_process(app, shaders.post_process, *shaders.bloom, gpu_profiler, context);
 
+	gpu_profiler_end_frame(gpu_profiler);
 	glfwSwapBuffers(app.window);
 }
 
@@ -368,6 +577,10 @@ main(void)
     logger.log("Initializing glfw");
     glfwInit();
 
+	// One worker per core besides the main thread.
+	jobs::init();
+	profiler::init();
+
 	Resources resources = {};
 
     Application app = application_create_and_set_context(resources, "CG playground", WINDOW_WIDTH, WINDOW_HEIGHT);
@@ -383,40 +596,25 @@ main(void)
 	//
 	// Load shaders
 	//
-	// TODO: Fix shader recompilation.
-	//    - All uniforms that are not added every frame have to be reapplied after
-	//      recompilation for the process to work.
-	//    - Currently only the projection matrix is updated
+	// Camera, lights and settings come from uniform buffers, so they survive recompilation.
+	// Uniforms set only once (texture units) still have to be reapplied.
 	//
+	UniformBuffers uniform_buffers = create_uniform_buffers();
+
 	Shaders shaders = {};
     shaders.light = new Shader("light.glsl");
-    shaders.light->on_recompilation([&] {
-        shaders.light->setup_projection_matrix(ASPECT_RATIO, context);
-    });
-
     shaders.selection = new Shader("selection.glsl");
-    shaders.selection->on_recompilation([&] {
-        shaders.selection->setup_projection_matrix(ASPECT_RATIO, context);
-    });
-
-    shaders.hdr_texture_to_quad = new Shader("render-hdr-texture-to-quad.glsl");
-	shaders.hdr_texture_to_quad->add_texture("texture_scene", context);
-	shaders.hdr_texture_to_quad->add_texture("texture_bloom", context);
 
     shaders.basic = new Shader("basic.glsl");
 	shaders.basic->add_texture("material.texture_diffuse1", context);
 	shaders.basic->add_texture("material.texture_specular1", context);
 	shaders.basic->add_texture("material.texture_normal1", context);
 	shaders.basic->add_texture("texture_shadow_map", context);
-    shaders.basic->on_recompilation([&] {
-        shaders.basic->setup_projection_matrix(ASPECT_RATIO, context);
-    });
+	for (i32 i = 0; i < ClusterTexture_Count; i++)
+		shaders.basic->add_texture(cluster_texture_names[i], context);
 
     shaders.skybox = new Shader("skybox.glsl");
 	shaders.skybox->add_texture("skybox", context);
-    shaders.skybox->on_recompilation([&] {
-        shaders.skybox->setup_projection_matrix(ASPECT_RATIO, context);
-    });
 
     shaders.shadow_map = new Shader("shadow_map.glsl");
 
@@ -426,6 +624,21 @@ main(void)
     shaders.bloom = new Shader("bloom.glsl");
 	shaders.bloom->add_texture("texture_image", context);
 
+	shaders.gbuffer = new Shader("gbuffer.glsl");
+	shaders.gbuffer->add_texture("material.texture_diffuse1", context);
+	shaders.gbuffer->add_texture("material.texture_specular1", context);
+	shaders.gbuffer->add_texture("material.texture_normal1", context);
+
+	shaders.deferred_lighting = new Shader("deferred_lighting.glsl");
+	for (i32 i = 0; i < GBufferTarget_Count; i++)
+		shaders.deferred_lighting->add_texture(gbuffer_texture_names[i], context);
+	shaders.deferred_lighting->add_texture("texture_depth", context);
+	shaders.deferred_lighting->add_texture("texture_shadow_map", context);
+	shaders.deferred_lighting->add_texture(cluster_texture_names[ClusterTexture_LightData], context);
+
+	shaders.depth_prepass = new Shader("depth_prepass.glsl");
+	shaders.overdraw = new Shader("depth_prepass.glsl", "#define COUNT_OVERDRAW\n");
+
     const f32 FIELD_OF_VIEW = 60.0f;
     const f32 MOVE_SPEED = 0.33f;
     const f32 ROTATION_SPEED = 0.050f;
@@ -435,16 +648,6 @@ main(void)
     Camera camera(CAMERA_POSITION, CAMERA_FRONT, UP_WORLD,
                   FIELD_OF_VIEW, ASPECT_RATIO, MOVE_SPEED, ROTATION_SPEED);
 
-    const u32 box_texture_diffuse = load_texture("155.JPG", TextureFormat_SRGB, PixelFormat_RGB);
-    const u32 box_texture_normal = load_texture("155_norm.JPG", TextureFormat_RGB, PixelFormat_RGB);
-
-    const u32 floor_texture_diffuse = load_texture("177.JPG", TextureFormat_SRGB, PixelFormat_RGB);
-    const u32 floor_texture_normal = load_texture("177_norm.JPG", TextureFormat_RGB, PixelFormat_RGB);
-
-	// Wall textures
-    const u32 wall_texture_diffuse = load_texture("brickwall.jpg", TextureFormat_SRGB, PixelFormat_RGB);
-    const u32 wall_texture_normal = load_texture("brickwall_normal.jpg", TextureFormat_RGB, PixelFormat_RGB);
-
 	const char *skybox_faces[] = {
 		"right.jpg", // pos x
 		"left.jpg", // neg x
@@ -460,154 +663,69 @@ main(void)
 	const i32 shadow_map_width = 1024, shadow_map_height = 1024;
 	ShadowMap shadow_map = create_shadow_map(shadow_map_width, shadow_map_height, *shaders.shadow_map);
 	Mesh *shadow_map_surface = resources.load_shadow_map_render_surface(shadow_map.texture);
-
-    const u32 pallet_texture_diffuse = load_texture("pallet/diffus.tga", TextureFormat_SRGB, PixelFormat_RGB);
-    const u32 pallet_texture_specular = load_texture("pallet/specular.tga", TextureFormat_SRGB, PixelFormat_RGB);
-    const u32 pallet_texture_normal = load_texture("pallet/normal.tga", TextureFormat_RGB, PixelFormat_RGB);
+	RenderQueue render_queue;
+	LightClusters light_clusters = create_light_clusters();
+	OcclusionBuffer occlusion = create_occlusion_buffer();
+	GpuProfiler gpu_profiler = create_gpu_profiler();
+	// Boxes around the point lights in the deferred path, scaled to their radius.
+	Mesh *light_volume = resources.load_unit_cube(0, 0);
 
 	// ----------------------------------------------------------
 	// Entities
 	// ----------------------------------------------------------
 	Entities entities = {};
-
-	// Model
-	Mat4f pallet_transform;
-	pallet_transform = lt::translation(pallet_transform, Vec3f(10, 1, 0));
-	pallet_transform = lt::scale(pallet_transform, Vec3f(0.02));
-	create_entity_from_model(entities, resources, "pallet/pallet.obj", shaders.basic,
-							 pallet_transform, 32.0f, pallet_texture_diffuse,
-							 pallet_texture_specular, pallet_texture_normal);
-	
-	// cubes
-	const Vec3f positions[] = {
-		Vec3f(0.0f, 2.0f, 0.0f),
-		Vec3f(4.0f, 3.0f, 0.0f),
-		Vec3f(1.0f, 5.0f, 2.0f),
-		Vec3f(-5.0f, 2.0f, -1.0f),
-		Vec3f(-3.0f, 5.1f, -7.0f),
-	};
-	const Vec3f scales[] = {
-		Vec3f(1),
-		Vec3f(1),
-		Vec3f(1),
-		Vec3f(1),
-		Vec3f(2),
-	};
-	for (usize i = 0; i < LT_Count(positions); i++)
 	{
-		if (i == 2) break;
-		Mat4f transform;
-		transform = lt::translation(transform, positions[i]);
-		transform = lt::scale(transform, scales[i]);
-		create_textured_cube(entities, resources, shaders.basic, transform, 128,
-							 box_texture_diffuse, box_texture_diffuse, box_texture_normal);
+		Shader *const scene_shaders[] = {
+			shaders.light, shaders.selection, shaders.basic, shaders.skybox,
+			shaders.shadow_map, shaders.shadow_map_render, shaders.bloom,
+		};
+
+		// The file is only written from the debug gui, so changes to the default scene show up
+		// as long as nobody exported one.
+		if (!scene_load(SCENE_PATH, entities, resources, scene_shaders, LT_Count(scene_shaders)))
+		{
+			logger.log("No scene at ", SCENE_PATH, ", creating the default one.");
+			create_default_scene(entities, resources, shaders);
+		}
 	}
+
+	// The scene is mostly static, so build its bounds tree once with the SAH.
+	entities.hierarchy.update(entities);
+	update_entity_bounds(entities);
+	entities.bvh.rebuild();
+
 	//
 	// Light
 	//
-	DirectionalLight dir_light;
+	// The directional light is static, its shadow cascades and the point lights are updated
+	// every frame.
+	LightsBlock lights = {};
+	DirectionalLightBlock &dir_light = lights.dir_light;
 	dir_light.direction = Vec3f(0.51f, -0.44f, 0.74f);
 	dir_light.ambient = Vec3f(.2f);
 	dir_light.diffuse = Vec3f(1);
 	dir_light.specular = Vec3f(1);
-	const Vec3f dir_light_pos(-55.01f, 57.25f, -101.6f);
-
-	const Mat4f light_view = lt::look_at(dir_light_pos, dir_light_pos+dir_light.direction, Vec3f(0, 1, 0));
-
-	context.use_shader(*shaders.basic);
-	shaders.basic->set3f("dir_light.direction", dir_light.direction);
-	shaders.basic->set3f("dir_light.ambient", dir_light.ambient);
-	shaders.basic->set3f("dir_light.diffuse", dir_light.diffuse);
-	shaders.basic->set3f("dir_light.specular", dir_light.specular);
-
-	{
-		// Set the static light space uniform for the shadow map shader
-		const Mat4f light_projection = lt::orthographic(-50, 50, -50, 50, 1, 1000);
-		const Mat4f light_space = light_projection * light_view;
-		context.use_shader(*shaders.shadow_map);
-		shaders.shadow_map->set_matrix("light_space", light_space);
-		context.use_shader(*shaders.basic);
-		shaders.basic->set_matrix("light_space", light_space);
-	}
-	{
-		LightEmmiter le = {};
-		le.position = Vec3f(3.0f, 5.0f, 0.0f);
-		le.ambient = Vec3f(0.01f);
-		le.diffuse = Vec3f(3.0f);
-		le.specular = Vec3f(1.0f);
-		le.constant = 1.0f;
-		le.linear = 0.35;
-		le.quadratic = 0.44f;
-		le.shader = shaders.basic;
-
-		Mat4f transform;
-		transform = lt::translation(transform, Vec3f(3, 5, 0));
-		transform = lt::scale(transform, Vec3f(0.1f));
-
-		create_point_light(entities, resources, shaders.light, transform, le, 0, 0);
-	}
-	// Wall on left
-	{
-		Mat4f transform(1);
-		transform = lt::translation(transform, Vec3f(-18, 18, 0));
-		transform = lt::scale(transform, Vec3f(.5f, 18, 28));
-		create_textured_cube(entities, resources, shaders.basic, transform, 128,
-							 wall_texture_diffuse, wall_texture_diffuse, wall_texture_normal);
-	}
-	// Wall on right
-	{
-		Mat4f transform(1);
-		transform = lt::translation(transform, Vec3f(37, 18, 0));
-		transform = lt::scale(transform, Vec3f(.5f, 18, 28));
-		create_textured_cube(entities, resources, shaders.basic, transform, 128,
-							 wall_texture_diffuse, wall_texture_diffuse, wall_texture_normal);
-	}
-	// Wall on top
-	{
-		Mat4f transform(1);
-		transform = lt::translation(transform, Vec3f(9.5f, 36.5f, 0));
-		transform = lt::scale(transform, Vec3f(28, .5f, 28));
-		create_textured_cube(entities, resources, shaders.basic, transform, 128,
-							 wall_texture_diffuse, wall_texture_diffuse, wall_texture_normal);
-	}
-	// Wall on the back
-	{
-		Mat4f transform(1);
-		transform = lt::translation(transform, Vec3f(9.5f, 18, 27.5f));
-		transform = lt::scale(transform, Vec3f(27, 18, .5f));
-		create_textured_cube(entities, resources, shaders.basic, transform, 128,
-							 wall_texture_diffuse, wall_texture_diffuse, wall_texture_normal);
-	}
-	// Wall on the front
-	{
-		Mat4f transform(1);
-		transform = lt::translation(transform, Vec3f(30.0f, 18, -28.5f));
-		transform = lt::scale(transform, Vec3f(27, 18, .5f));
-		create_textured_cube(entities, resources, shaders.basic, transform, 128,
-							 wall_texture_diffuse, wall_texture_diffuse, wall_texture_normal);
-	}
-	// FLOOR
-	{
-		Mat4f transform(1);
-		transform = lt::translation(transform, Vec3f(9.5f, 0, 0));
-		transform = lt::rotation_x(transform, -90);
-		transform = lt::scale(transform, Vec3f(28, 28, 1));
 
-		create_plane(entities, resources, shaders.basic, transform, 32, 10.0f,
-					 floor_texture_diffuse, floor_texture_diffuse, floor_texture_normal);
-	}
 	// Skybox
 	Mesh *skybox_mesh = resources.load_cubemap(skybox);
 
-	// Set projection matrices.
-    shaders.light->setup_projection_matrix(ASPECT_RATIO, context);
-    shaders.basic->setup_projection_matrix(ASPECT_RATIO, context);
-    shaders.skybox->setup_projection_matrix(ASPECT_RATIO, context);
-    shaders.selection->setup_projection_matrix(ASPECT_RATIO, context);
-
 	// Initialize the DEBUG GUI
 	dgui::init(app.window);
 
+	// Structural changes recorded by systems are applied after each update.
+	EntityCommands entity_commands;
+	// Cubes spawned from the debug gui, with the textures of the default scene.
+	Renderable spawned_cube = {};
+	spawned_cube.mesh = resources.load_unit_cube(
+		resources.load_texture("155.JPG", TextureFormat_SRGB, PixelFormat_RGB),
+		resources.load_texture("155.JPG", TextureFormat_SRGB, PixelFormat_RGB),
+		resources.load_texture("155_norm.JPG", TextureFormat_RGB, PixelFormat_RGB));
+	spawned_cube.shader = shaders.basic;
+	spawned_cube.shininess = 128;
+
+	SystemScheduler scheduler;
+	register_systems(scheduler, g_keyboard, camera, entities, entity_commands, spawned_cube);
+
     // Define variables to control time
     f64 current_time = get_time_milliseconds();
 	f64 accumulator = 0;
@@ -632,8 +750,11 @@ main(void)
 
         // Process input and watcher events.
         process_input(app.window, g_keyboard);
+		if (g_mouse_left.last_transition == Key::Transition_Down &&
+			!(g_display_debug_gui && dgui::is_capturing_mouse()))
+			select_entity_under_cursor(app.window, camera, entities);
 #ifdef DEV_ENV
-        process_watcher_events(*shaders.basic, *shaders.light);
+        process_watcher_events(*shaders.basic, *shaders.light, shaders.post_process);
 #endif
 
         // Check if the window should close.
@@ -653,24 +774,37 @@ main(void)
 
 		const f64 dt = 1000 / 30.0f;
 
-		BEGIN_REGION(PerformanceRegion_UpdateLoop);
-        while (accumulator >= dt)
-        {
-            game_update(g_keyboard, camera, dgui::State::instance());
-			g_counter.updates++;
-            accumulator -= dt;
+		{
+			PROFILE_SCOPE("Update loop");
+			while (accumulator >= dt)
+			{
+				scheduler.run(dt);
+				entity_commands.playback(entities);
+				g_counter.updates++;
+				accumulator -= dt;
+			}
 		}
-		END_REGION(PerformanceRegion_UpdateLoop);
 
 		const f64 lag_offset = accumulator / dt;
 
-		BEGIN_REGION(PerformanceRegion_RenderLoop);
-		game_render(lag_offset, app, camera, entities, shaders, shadow_map, light_view, dir_light_pos,
-					shadow_map_surface, skybox_mesh, context);
-		END_REGION(PerformanceRegion_RenderLoop);
+		{
+			PROFILE_SCOPE("Render loop");
+			game_render(lag_offset, app, camera, entities, shaders, shadow_map, shadow_map_surface, skybox_mesh,
+						light_volume, render_queue, uniform_buffers, lights, light_clusters, occlusion, gpu_profiler,
+						context);
+		}
 
         glfwPollEvents();
 
+		if (dgui::State::instance().export_scene_requested)
+		{
+			dgui::State::instance().export_scene_requested = false;
+			scene_export(SCENE_PATH, entities, resources);
+		}
+
+		// Everything recorded this iteration, including the zones of the jobs, becomes a frame.
+		profiler::end_frame();
+
 		g_counter.frames++;
 		avg_frame_time += frame_time;
 		if (g_counter.second_passed())
@@ -687,6 +821,9 @@ main(void)
 #ifdef DEV_ENV
     pthread_join(watcher_thread, nullptr);
 #endif
+	jobs::shutdown();
+	profiler::shutdown();
+	destroy_gpu_profiler(gpu_profiler);
     glfwDestroyWindow(app.window);
     glfwTerminate();
 }
@@ -0,0 +1,75 @@
+#include "matrix.hpp"
+#include <math.h>
+#include <algorithm>
+#include "lt_utils.hpp"
+
+Mat4f
+affine_inverse(const Mat4f &m)
+{
+	const f32 a = m(0, 0), b = m(0, 1), c = m(0, 2);
+	const f32 d = m(1, 0), e = m(1, 1), f = m(1, 2);
+	const f32 g = m(2, 0), h = m(2, 1), i = m(2, 2);
+
+	const f32 det = a*(e*i - f*h) - b*(d*i - f*g) + c*(d*h - e*g);
+	const f32 inv_det = 1.0f / det;
+
+	Mat4f r(1);
+	r(0, 0) = (e*i - f*h) * inv_det;
+	r(0, 1) = (c*h - b*i) * inv_det;
+	r(0, 2) = (b*f - c*e) * inv_det;
+	r(1, 0) = (f*g - d*i) * inv_det;
+	r(1, 1) = (a*i - c*g) * inv_det;
+	r(1, 2) = (c*d - a*f) * inv_det;
+	r(2, 0) = (d*h - e*g) * inv_det;
+	r(2, 1) = (b*g - a*h) * inv_det;
+	r(2, 2) = (a*e - b*d) * inv_det;
+
+	for (i32 row = 0; row < 3; row++)
+		r(row, 3) = -(r(row, 0)*m(0, 3) + r(row, 1)*m(1, 3) + r(row, 2)*m(2, 3));
+	return r;
+}
+
+// Gauss-Jordan elimination with partial pivoting.
+Mat4f
+inverse(const Mat4f &m)
+{
+	f32 a[4][8];
+	for (i32 row = 0; row < 4; row++)
+		for (i32 col = 0; col < 4; col++)
+		{
+			a[row][col] = m(row, col);
+			a[row][col + 4] = (row == col) ? 1.0f : 0.0f;
+		}
+
+	for (i32 col = 0; col < 4; col++)
+	{
+		i32 pivot = col;
+		for (i32 row = col + 1; row < 4; row++)
+			if (fabsf(a[row][col]) > fabsf(a[pivot][col]))
+				pivot = row;
+		LT_Assert(a[pivot][col] != 0.0f);
+
+		if (pivot != col)
+			for (i32 k = 0; k < 8; k++)
+				std::swap(a[col][k], a[pivot][k]);
+
+		const f32 inv_pivot = 1.0f / a[col][col];
+		for (i32 k = 0; k < 8; k++)
+			a[col][k] *= inv_pivot;
+
+		for (i32 row = 0; row < 4; row++)
+		{
+			if (row == col)
+				continue;
+			const f32 factor = a[row][col];
+			for (i32 k = 0; k < 8; k++)
+				a[row][k] -= factor * a[col][k];
+		}
+	}
+
+	Mat4f r(1);
+	for (i32 row = 0; row < 4; row++)
+		for (i32 col = 0; col < 4; col++)
+			r(row, col) = a[row][col + 4];
+	return r;
+}
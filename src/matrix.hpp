@@ -0,0 +1,31 @@
+#ifndef __MATRIX_HPP__
+#define __MATRIX_HPP__
+
+#include "lt_core.hpp"
+#include "lt_math.hpp"
+
+// Inverse of an affine transform (the last row being 0 0 0 1).
+Mat4f affine_inverse(const Mat4f &m);
+// Inverse of any invertible matrix, e.g. a projection.
+Mat4f inverse(const Mat4f &m);
+
+// Full product with the point (w = 1), keeping w, e.g. to clip space.
+inline Vec4f
+transform_point(const Mat4f &m, const Vec3f &p)
+{
+	return Vec4f(m(0, 0)*p.x + m(0, 1)*p.y + m(0, 2)*p.z + m(0, 3),
+				 m(1, 0)*p.x + m(1, 1)*p.y + m(1, 2)*p.z + m(1, 3),
+				 m(2, 0)*p.x + m(2, 1)*p.y + m(2, 2)*p.z + m(2, 3),
+				 m(3, 0)*p.x + m(3, 1)*p.y + m(3, 2)*p.z + m(3, 3));
+}
+
+// Transforms a point (w = 1) or a direction (w = 0) by an affine transform.
+inline Vec3f
+transform_vector(const Mat4f &m, const Vec3f &v, f32 w)
+{
+	return Vec3f(m(0, 0)*v.x + m(0, 1)*v.y + m(0, 2)*v.z + m(0, 3)*w,
+				 m(1, 0)*v.x + m(1, 1)*v.y + m(1, 2)*v.z + m(1, 3)*w,
+				 m(2, 0)*v.x + m(2, 1)*v.y + m(2, 2)*v.z + m(2, 3)*w);
+}
+
+#endif // __MATRIX_HPP__
@@ -10,6 +10,23 @@ Mesh::~Mesh()
 {
 	glDeleteBuffers(1, &vbo);
 	glDeleteBuffers(1, &ebo);
+	glDeleteBuffers(1, &instance_vbo);
 	glDeleteVertexArrays(1, &vao);
 }
 
+
+void
+Mesh::compute_bounds()
+{
+	if (vertices.empty())
+	{
+		bounds = AABB{Vec3f(0), Vec3f(0)};
+		return;
+	}
+
+	bounds = AABB{vertices[0], vertices[0]};
+	for (const Vec3f &v : vertices)
+		bounds = aabb_union(bounds, AABB{v, v});
+
+	triangle_bvh.build(vertices, faces);
+}
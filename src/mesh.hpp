@@ -7,6 +7,7 @@
 
 #include "lt_core.hpp"
 #include "lt_math.hpp"
+#include "bvh.hpp"
 
 struct Texture
 {
@@ -18,18 +19,48 @@ struct Texture
 
 typedef Vec3i Face;
 
+// First of the four vertex attribute locations taken by the per instance model matrix.
+#define INSTANCE_MODEL_LOCATION 5
+
+enum MeshAssetKind : u32
+{
+	MeshAssetKind_None,
+	MeshAssetKind_UnitCube,
+	MeshAssetKind_UnitPlane,
+	MeshAssetKind_Model,
+};
+
+// The arguments a mesh was loaded with, so it can be referenced from a scene file.
+struct MeshAsset
+{
+	MeshAssetKind kind = MeshAssetKind_None;
+	std::string   path;
+	f32           tex_coords_scale = 1.0f;
+	u32           diffuse_texture = 0;
+	u32           specular_texture = 0;
+	u32           normal_texture = 0;
+};
+
 struct Submesh
 {
 	isize                start_index;
 	i32                  num_indices;
 	std::vector<Texture> textures;
+	u32                  material; // Id of the texture set, 0 if it has no material textures.
 };
 
 struct Mesh
 {
 	isize id;
     u32 vao = 0, vbo = 0, ebo = 0;
+	// Per instance model matrices, only for meshes that can be drawn instanced.
+	u32 instance_vbo = 0;
 	std::vector<Submesh>            submeshes;
+	MeshAsset                       asset;
+	// Bounds of the vertices in model space.
+	AABB                            bounds;
+	// Built once at load time, for ray casts against the faces.
+	TriangleBVH                     triangle_bvh;
 
 	std::vector<Vec3f>              vertices;
 	std::vector<Vec2f>              tex_coords;
@@ -45,6 +76,9 @@ struct Mesh
 
 	~Mesh();
 
+	// Computes the bounds and builds the triangle BVH from the vertices and faces.
+	void compute_bounds();
+
 	inline isize number_of_indices() const {return faces.size() * 3;}
 };
 
@@ -0,0 +1,337 @@
+#include "occlusion.hpp"
+#include <math.h>
+#include <xmmintrin.h>
+#include "entities.hpp"
+#include "mesh.hpp"
+#include "culling.hpp"
+#include "jobs.hpp"
+#include "profiler.hpp"
+#include "matrix.hpp"
+
+#define OCCLUDER_MASK (ComponentKind_Occluder | ComponentKind_Renderable | ComponentKind_Transform)
+#define OCCLUSION_NUM_BANDS (OCCLUSION_HEIGHT / OCCLUSION_BAND_HEIGHT)
+
+OcclusionBuffer
+create_occlusion_buffer()
+{
+	OcclusionBuffer buffer = {};
+	buffer.depth.resize(OCCLUSION_WIDTH * OCCLUSION_HEIGHT, 1.0f);
+	buffer.tile_max.resize(OCCLUSION_TILES_X * OCCLUSION_TILES_Y, 1.0f);
+	return buffer;
+}
+
+// Pixel containing the coordinate, clamped to the buffer. Also keeps huge values away from
+// the integer conversion.
+lt_internal inline i32
+pixel_index(f32 v, i32 size)
+{
+	return v <= 0.0f ? 0 : v >= size - 1 ? size - 1 : (i32)v;
+}
+
+// Sets up a triangle whose vertices are all in front of the near plane and inside the guard band.
+lt_internal void
+setup_triangle(OcclusionBuffer &buffer, const Vec4f &v0, const Vec4f &v1, const Vec4f &v2)
+{
+	const Vec4f *v[3] = {&v0, &v1, &v2};
+	f32 x[3], y[3], z[3];
+	for (i32 i = 0; i < 3; i++)
+	{
+		const f32 inv_w = 1.0f / v[i]->w;
+		x[i] = (v[i]->x*inv_w*0.5f + 0.5f) * OCCLUSION_WIDTH;
+		y[i] = (v[i]->y*inv_w*0.5f + 0.5f) * OCCLUSION_HEIGHT;
+		z[i] = v[i]->z*inv_w*0.5f + 0.5f;
+	}
+
+	const f32 min_x = fminf(x[0], fminf(x[1], x[2])), max_x = fmaxf(x[0], fmaxf(x[1], x[2]));
+	const f32 min_y = fminf(y[0], fminf(y[1], y[2])), max_y = fmaxf(y[0], fmaxf(y[1], y[2]));
+	if (max_x < 0.0f || min_x >= OCCLUSION_WIDTH || max_y < 0.0f || min_y >= OCCLUSION_HEIGHT)
+		return;
+	if (z[0] > 1.0f && z[1] > 1.0f && z[2] > 1.0f)
+		return;
+
+	// Both windings are drawn, the back of a wall hides as much as its front.
+	f32 area = (x[1] - x[0])*(y[2] - y[0]) - (y[1] - y[0])*(x[2] - x[0]);
+	if (fabsf(area) < 1e-6f)
+		return;
+	if (area < 0.0f)
+	{
+		f32 t;
+		t = x[1]; x[1] = x[2]; x[2] = t;
+		t = y[1]; y[1] = y[2]; y[2] = t;
+		t = z[1]; z[1] = z[2]; z[2] = t;
+		area = -area;
+	}
+
+	// Edge i goes from vertex i to the next one, its function is the barycentric weight of
+	// the vertex in front of it times the area.
+	OcclusionTriangle tri;
+	for (i32 i = 0; i < 3; i++)
+	{
+		const i32 j = (i + 1) % 3;
+		tri.edge_a[i] = y[i] - y[j];
+		tri.edge_b[i] = x[j] - x[i];
+		tri.edge_c[i] = -tri.edge_a[i]*x[i] - tri.edge_b[i]*y[i];
+	}
+	const f32 inv_area = 1.0f / area;
+	tri.z_a = (tri.edge_a[1]*z[0] + tri.edge_a[2]*z[1] + tri.edge_a[0]*z[2]) * inv_area;
+	tri.z_b = (tri.edge_b[1]*z[0] + tri.edge_b[2]*z[1] + tri.edge_b[0]*z[2]) * inv_area;
+	tri.z_c = (tri.edge_c[1]*z[0] + tri.edge_c[2]*z[1] + tri.edge_c[0]*z[2]) * inv_area;
+
+	tri.min_x = pixel_index(min_x, OCCLUSION_WIDTH);
+	tri.max_x = pixel_index(max_x, OCCLUSION_WIDTH);
+	tri.min_y = pixel_index(min_y, OCCLUSION_HEIGHT);
+	tri.max_y = pixel_index(max_y, OCCLUSION_HEIGHT);
+	buffer.triangles.push_back(tri);
+}
+
+// Distance between a clip space vertex and each clipping plane, positive inside. Besides the
+// near plane, x and y are clipped to a guard band around the buffer, so the screen space
+// coordinates stay small enough for the f32 edge functions to be exact at pixel scale.
+lt_internal inline f32
+plane_distance(const Vec4f &p, i32 plane)
+{
+	switch (plane)
+	{
+	case 0: return p.z + p.w;
+	case 1: return OCCLUSION_GUARD_BAND*p.w - p.x;
+	case 2: return OCCLUSION_GUARD_BAND*p.w + p.x;
+	case 3: return OCCLUSION_GUARD_BAND*p.w - p.y;
+	default: return OCCLUSION_GUARD_BAND*p.w + p.y;
+	}
+}
+
+// Clips the triangle against the near plane and the guard band, then sets up what is left.
+// The rest of the guard band is handled by clamping to the buffer.
+lt_internal void
+add_triangle(OcclusionBuffer &buffer, const Vec4f &a, const Vec4f &b, const Vec4f &c)
+{
+	// Every plane adds at most one vertex to the polygon.
+	Vec4f poly[2][8] = {{a, b, c}};
+	i32 count = 3;
+	i32 curr = 0;
+
+	for (i32 plane = 0; plane < 5 && count > 0; plane++)
+	{
+		const Vec4f *in = poly[curr];
+		Vec4f *out = poly[curr ^ 1];
+		i32 num_out = 0;
+
+		for (i32 i = 0; i < count; i++)
+		{
+			const Vec4f &p = in[i];
+			const Vec4f &q = in[(i + 1) % count];
+			const f32 dp = plane_distance(p, plane);
+			const f32 dq = plane_distance(q, plane);
+
+			if (dp >= 0.0f)
+				out[num_out++] = p;
+			if ((dp >= 0.0f) != (dq >= 0.0f))
+			{
+				const f32 t = dp / (dp - dq);
+				out[num_out++] = Vec4f(p.x + t*(q.x - p.x), p.y + t*(q.y - p.y),
+									   p.z + t*(q.z - p.z), p.w + t*(q.w - p.w));
+			}
+		}
+		count = num_out;
+		curr ^= 1;
+	}
+
+	const Vec4f *out = poly[curr];
+	for (i32 i = 1; i + 1 < count; i++)
+		setup_triangle(buffer, out[0], out[i], out[i + 1]);
+}
+
+// Clears the rows of the band, draws every triangle overlapping it keeping the nearest
+// depth, then computes the farthest depth of its tiles.
+lt_internal void
+rasterize_band(OcclusionBuffer &buffer, i32 band)
+{
+	PROFILE_SCOPE("Rasterize occluders");
+	const i32 y_begin = band * OCCLUSION_BAND_HEIGHT;
+	const i32 y_end = y_begin + OCCLUSION_BAND_HEIGHT;
+	f32 *depth = buffer.depth.data();
+
+	for (i32 i = y_begin * OCCLUSION_WIDTH; i < y_end * OCCLUSION_WIDTH; i++)
+		depth[i] = 1.0f;
+
+	const __m128 zero = _mm_setzero_ps();
+	// Centers of the four pixels of a step.
+	const __m128 lane_centers = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+
+	for (const OcclusionTriangle &tri : buffer.triangles)
+	{
+		const i32 min_y = tri.min_y > y_begin ? tri.min_y : y_begin;
+		const i32 max_y = tri.max_y < y_end - 1 ? tri.max_y : y_end - 1;
+		if (min_y > max_y)
+			continue;
+		// The buffer width is a multiple of 4, aligned steps never go past a row.
+		const i32 min_x = tri.min_x & ~3;
+
+		__m128 edge_a[3], edge_b[3], edge_c[3];
+		for (i32 i = 0; i < 3; i++)
+		{
+			edge_a[i] = _mm_set1_ps(tri.edge_a[i]);
+			edge_b[i] = _mm_set1_ps(tri.edge_b[i]);
+			edge_c[i] = _mm_set1_ps(tri.edge_c[i]);
+		}
+		const __m128 z_a = _mm_set1_ps(tri.z_a);
+		const __m128 z_b = _mm_set1_ps(tri.z_b);
+		const __m128 z_c = _mm_set1_ps(tri.z_c);
+
+		for (i32 y = min_y; y <= max_y; y++)
+		{
+			const __m128 py = _mm_set1_ps(y + 0.5f);
+			__m128 row_edge[3];
+			for (i32 i = 0; i < 3; i++)
+				row_edge[i] = _mm_add_ps(_mm_mul_ps(edge_b[i], py), edge_c[i]);
+			const __m128 row_z = _mm_add_ps(_mm_mul_ps(z_b, py), z_c);
+
+			f32 *row = depth + y * OCCLUSION_WIDTH;
+			for (i32 x = min_x; x <= tri.max_x; x += 4)
+			{
+				const __m128 px = _mm_add_ps(_mm_set1_ps((f32)x), lane_centers);
+				const __m128 e0 = _mm_add_ps(_mm_mul_ps(edge_a[0], px), row_edge[0]);
+				const __m128 e1 = _mm_add_ps(_mm_mul_ps(edge_a[1], px), row_edge[1]);
+				const __m128 e2 = _mm_add_ps(_mm_mul_ps(edge_a[2], px), row_edge[2]);
+				const __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)),
+												 _mm_cmpge_ps(e2, zero));
+				if (_mm_movemask_ps(inside) == 0)
+					continue;
+
+				const __m128 z = _mm_add_ps(_mm_mul_ps(z_a, px), row_z);
+				const __m128 old = _mm_loadu_ps(row + x);
+				const __m128 nearest = _mm_min_ps(old, z);
+				_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+			}
+		}
+	}
+
+	for (i32 ty = y_begin / OCCLUSION_TILE_SIZE; ty < y_end / OCCLUSION_TILE_SIZE; ty++)
+	{
+		for (i32 tx = 0; tx < OCCLUSION_TILES_X; tx++)
+		{
+			__m128 farthest = _mm_setzero_ps();
+			for (i32 y = ty * OCCLUSION_TILE_SIZE; y < (ty + 1) * OCCLUSION_TILE_SIZE; y++)
+			{
+				const f32 *row = depth + y * OCCLUSION_WIDTH + tx * OCCLUSION_TILE_SIZE;
+				for (i32 x = 0; x < OCCLUSION_TILE_SIZE; x += 4)
+					farthest = _mm_max_ps(farthest, _mm_loadu_ps(row + x));
+			}
+
+			f32 lanes[4];
+			_mm_storeu_ps(lanes, farthest);
+			buffer.tile_max[ty * OCCLUSION_TILES_X + tx] = fmaxf(fmaxf(lanes[0], lanes[1]), fmaxf(lanes[2], lanes[3]));
+		}
+	}
+}
+
+void
+render_occluders(OcclusionBuffer &buffer, const Entities &entities, const Mat4f &view_projection)
+{
+	buffer.view_projection = view_projection;
+	buffer.triangles.clear();
+	buffer.num_occluders = 0;
+
+	const FrustumPlanes frustum = frustum_planes_from_matrix(view_projection);
+	for (const Archetype &arch : entities.archetypes)
+	{
+		if (!arch.matches(OCCLUDER_MASK))
+			continue;
+
+		for (const EntityChunk *chunk : arch.chunks)
+		{
+			const BoundsSoA bounds = {
+				{chunk->bounds_center[0], chunk->bounds_center[1], chunk->bounds_center[2]},
+				{chunk->bounds_extent[0], chunk->bounds_extent[1], chunk->bounds_extent[2]},
+			};
+			buffer.visible.resize(chunk->count);
+			frustum_cull(frustum, bounds, chunk->count, buffer.visible.data());
+
+			for (i32 row = 0; row < chunk->count; row++)
+			{
+				if (!buffer.visible[row])
+					continue;
+
+				const Mesh *mesh = chunk->renderable[row].mesh;
+				const Mat4f mvp = view_projection * chunk->transform[row].mat;
+
+				buffer.clip_vertices.resize(mesh->vertices.size());
+				for (usize i = 0; i < mesh->vertices.size(); i++)
+					buffer.clip_vertices[i] = transform_point(mvp, mesh->vertices[i]);
+
+				for (const Face &f : mesh->faces)
+					add_triangle(buffer, buffer.clip_vertices[f.x], buffer.clip_vertices[f.y],
+								 buffer.clip_vertices[f.z]);
+				buffer.num_occluders++;
+			}
+		}
+	}
+
+	// Bands write disjoint rows and tiles, they don't need any synchronization.
+	jobs::parallel_for(OCCLUSION_NUM_BANDS, 1, [&buffer](isize begin, isize end) {
+		for (isize band = begin; band < end; band++)
+			rasterize_band(buffer, band);
+	});
+	buffer.valid = true;
+}
+
+bool
+is_box_visible(const OcclusionBuffer &buffer, const Vec3f &center, const Vec3f &extent)
+{
+	if (!buffer.valid)
+		return true;
+
+	// Screen bounds of the corners, and the depth of the nearest one.
+	f32 min_x = INFINITY, max_x = -INFINITY, min_y = INFINITY, max_y = -INFINITY, min_z = INFINITY;
+	for (i32 i = 0; i < 8; i++)
+	{
+		const Vec3f corner(center.x + ((i & 1) ? extent.x : -extent.x),
+						   center.y + ((i & 2) ? extent.y : -extent.y),
+						   center.z + ((i & 4) ? extent.z : -extent.z));
+		const Vec4f p = transform_point(buffer.view_projection, corner);
+		// Boxes crossing the near plane don't project to a rectangle, and are surely close.
+		if (p.z < -p.w || p.w <= 0.0f)
+			return true;
+
+		const f32 inv_w = 1.0f / p.w;
+		const f32 x = (p.x*inv_w*0.5f + 0.5f) * OCCLUSION_WIDTH;
+		const f32 y = (p.y*inv_w*0.5f + 0.5f) * OCCLUSION_HEIGHT;
+		min_x = fminf(min_x, x);
+		max_x = fmaxf(max_x, x);
+		min_y = fminf(min_y, y);
+		max_y = fmaxf(max_y, y);
+		min_z = fminf(min_z, p.z*inv_w*0.5f + 0.5f);
+	}
+	// Off the buffer, the frustum culling already decided.
+	if (max_x < 0.0f || min_x >= OCCLUSION_WIDTH || max_y < 0.0f || min_y >= OCCLUSION_HEIGHT)
+		return true;
+
+	const i32 x0 = pixel_index(min_x, OCCLUSION_WIDTH), x1 = pixel_index(max_x, OCCLUSION_WIDTH);
+	const i32 y0 = pixel_index(min_y, OCCLUSION_HEIGHT), y1 = pixel_index(max_y, OCCLUSION_HEIGHT);
+
+	for (i32 ty = y0 / OCCLUSION_TILE_SIZE; ty <= y1 / OCCLUSION_TILE_SIZE; ty++)
+	{
+		for (i32 tx = x0 / OCCLUSION_TILE_SIZE; tx <= x1 / OCCLUSION_TILE_SIZE; tx++)
+		{
+			// The whole tile is in front of the box.
+			if (buffer.tile_max[ty * OCCLUSION_TILES_X + tx] < min_z)
+				continue;
+
+			// Some pixel of the tile is behind the box, look at the ones the box covers.
+			const i32 px0 = x0 > tx * OCCLUSION_TILE_SIZE ? x0 : tx * OCCLUSION_TILE_SIZE;
+			const i32 px1 = x1 < (tx + 1) * OCCLUSION_TILE_SIZE - 1 ? x1 : (tx + 1) * OCCLUSION_TILE_SIZE - 1;
+			const i32 py0 = y0 > ty * OCCLUSION_TILE_SIZE ? y0 : ty * OCCLUSION_TILE_SIZE;
+			const i32 py1 = y1 < (ty + 1) * OCCLUSION_TILE_SIZE - 1 ? y1 : (ty + 1) * OCCLUSION_TILE_SIZE - 1;
+			for (i32 y = py0; y <= py1; y++)
+			{
+				const f32 *row = buffer.depth.data() + y * OCCLUSION_WIDTH;
+				for (i32 x = px0; x <= px1; x++)
+				{
+					if (row[x] >= min_z)
+						return true;
+				}
+			}
+		}
+	}
+	return false;
+}
@@ -0,0 +1,65 @@
+#ifndef __OCCLUSION_HPP__
+#define __OCCLUSION_HPP__
+
+#include <vector>
+#include "lt_core.hpp"
+#include "lt_math.hpp"
+
+struct Entities;
+
+//
+// Software occlusion culling. The meshes of the entities with an Occluder component are
+// rasterized on the CPU to a small depth buffer, and the boxes of the other entities are
+// tested against it before they are pushed to the render queue. Nothing is read back from the
+// GPU, so the results are ready in the same frame and work without a context.
+//
+// The buffer is split in bands of rows rasterized in parallel, 4 pixels at a time with SSE.
+// Every tile of the buffer also keeps its farthest depth, so most boxes are accepted or
+// rejected without looking at single pixels.
+//
+// Depths are the NDC z mapped to [0, 1], 1 being the far plane.
+//
+#define OCCLUSION_WIDTH 320
+#define OCCLUSION_HEIGHT 192
+#define OCCLUSION_TILE_SIZE 8
+#define OCCLUSION_TILES_X (OCCLUSION_WIDTH / OCCLUSION_TILE_SIZE)
+#define OCCLUSION_TILES_Y (OCCLUSION_HEIGHT / OCCLUSION_TILE_SIZE)
+// Rows rasterized by a single job, whole rows of tiles.
+#define OCCLUSION_BAND_HEIGHT (2 * OCCLUSION_TILE_SIZE)
+// Occluders are clipped to this NDC range in x and y, 2 buffer sizes past each edge.
+#define OCCLUSION_GUARD_BAND 5.0f
+
+static_assert(OCCLUSION_WIDTH % OCCLUSION_TILE_SIZE == 0 && OCCLUSION_HEIGHT % OCCLUSION_BAND_HEIGHT == 0,
+			  "The occlusion buffer has to be made of whole tiles and bands.");
+
+// Screen space triangle set up for rasterization. The edge functions a*x + b*y + c are
+// positive inside, and the depth is the plane z_a*x + z_b*y + z_c.
+struct OcclusionTriangle
+{
+	f32 edge_a[3], edge_b[3], edge_c[3];
+	f32 z_a, z_b, z_c;
+	i32 min_x, max_x, min_y, max_y; // Pixels covered by the bounds, inclusive.
+};
+
+struct OcclusionBuffer
+{
+	// False until occluders are rendered, every box is visible then.
+	bool                           valid;
+	Mat4f                          view_projection;
+	std::vector<f32>               depth;    // Row major, the bottom row first.
+	std::vector<f32>               tile_max; // Farthest depth of each tile.
+	std::vector<OcclusionTriangle> triangles;
+	i32                            num_occluders;
+
+	// Scratch memory for the culling and vertex transform of the occluders.
+	std::vector<u8>                visible;
+	std::vector<Vec4f>             clip_vertices;
+};
+
+OcclusionBuffer create_occlusion_buffer();
+// Clears the buffer and rasterizes the occluders inside the frustum of the matrix.
+void render_occluders(OcclusionBuffer &buffer, const Entities &entities, const Mat4f &view_projection);
+// False when the box is entirely behind the occluders.
+bool is_box_visible(const OcclusionBuffer &buffer, const Vec3f &center, const Vec3f &extent);
+
+#endif // __OCCLUSION_HPP__
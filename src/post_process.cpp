@@ -0,0 +1,52 @@
+#include "post_process.hpp"
+#include <string>
+#include "shader.hpp"
+#include "lt_utils.hpp"
+
+lt_internal lt::Logger logger("post_process");
+
+// Define enabling each stage in the shader, indexed by the bit of the stage.
+lt_internal const char *const stage_defines[PostProcessStage_Count] = {
+	"BLOOM",
+	"BLOOM_ONLY",
+	"TONE_MAPPING",
+	"COLOR_GRADING",
+	"VIGNETTE",
+	"GAMMA_CORRECTION",
+	"OVERDRAW_HEAT_MAP",
+};
+
+PostProcessChain::~PostProcessChain()
+{
+	for (auto &it : variants)
+		delete it.second;
+}
+
+Shader &
+PostProcessChain::variant(u32 stages, GLContext &context)
+{
+	auto it = variants.find(stages);
+	if (it != variants.end())
+		return *it->second;
+
+	std::string defines;
+	for (i32 i = 0; i < PostProcessStage_Count; i++)
+	{
+		if (stages & (1 << i))
+			defines += std::string("#define ") + stage_defines[i] + "\n";
+	}
+
+	logger.log("Compiling post processing variant ", stages);
+	Shader *shader = new Shader(POST_PROCESS_SHADER, defines);
+	shader->add_texture("texture_scene", context);
+	shader->add_texture("texture_bloom", context);
+	variants[stages] = shader;
+	return *shader;
+}
+
+void
+PostProcessChain::recompile()
+{
+	for (auto &it : variants)
+		it.second->recompile();
+}
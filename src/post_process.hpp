@@ -0,0 +1,49 @@
+#ifndef __POST_PROCESS_HPP__
+#define __POST_PROCESS_HPP__
+
+#include <unordered_map>
+#include "lt_core.hpp"
+
+struct Shader;
+struct GLContext;
+
+//
+// Per pixel post processing, done in a single full screen pass over the HDR scene. Every
+// stage is an #ifdef block of post_process.glsl, and each set of enabled stages is compiled
+// to its own program the first time it is used, so disabled stages cost nothing and the
+// shader has no branches on settings.
+//
+// Filters that read a neighborhood, like the bloom blur, can't be fused this way and run
+// before, the chain only composites their result.
+//
+enum PostProcessStage
+{
+	PostProcessStage_Bloom           = (1 << 0),
+	// Shows the bloom alone instead of adding it to the scene.
+	PostProcessStage_BloomOnly       = (1 << 1),
+	PostProcessStage_ToneMapping     = (1 << 2),
+	PostProcessStage_ColorGrading    = (1 << 3),
+	PostProcessStage_Vignette        = (1 << 4),
+	PostProcessStage_GammaCorrection = (1 << 5),
+	// Colors the fragment count in the red channel of the scene, used alone.
+	PostProcessStage_OverdrawHeatMap = (1 << 6),
+
+	PostProcessStage_Count = 7,
+};
+
+#define POST_PROCESS_SHADER "post_process.glsl"
+
+struct PostProcessChain
+{
+	~PostProcessChain();
+
+	// Program with the stages enabled, compiled and cached the first time it is asked for.
+	Shader &variant(u32 stages, GLContext &context);
+	// Recompiles every cached variant, when the shader source changed.
+	void   recompile();
+
+	// Indexed by the stages mask.
+	std::unordered_map<u32, Shader*> variants;
+};
+
+#endif // __POST_PROCESS_HPP__
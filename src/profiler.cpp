@@ -0,0 +1,283 @@
+#include "profiler.hpp"
+#include <atomic>
+#include <stdio.h>
+#include <time.h>
+#include "lt_utils.hpp"
+#include "jobs.hpp"
+
+lt_internal lt::Logger logger("profiler");
+
+struct ProfileRing
+{
+	ProfileZone      zones[PROFILER_RING_SIZE];
+	std::atomic<u64> head;    // Only written by the thread that owns the ring.
+	std::atomic<u64> tail;    // Only written by the collector.
+	std::atomic<u64> dropped;
+};
+
+// Indexed like the job system threads, the threads outside of it come after them.
+lt_global_variable std::atomic<ProfileRing*> g_rings[PROFILER_MAX_THREADS];
+lt_global_variable std::atomic<i32>          g_num_slots(0);
+lt_global_variable std::atomic<i32>          g_num_foreign_threads(0);
+
+lt_global_variable ProfileFrame g_frames[PROFILER_HISTORY_FRAMES];
+lt_global_variable i32          g_num_frames = 0;
+lt_global_variable i32          g_next_frame = 0;
+lt_global_variable u64          g_frame_begin = 0;
+lt_global_variable bool         g_paused = false;
+// Zones collected while paused, thrown away.
+lt_global_variable std::vector<ProfileZone> g_discarded;
+
+// rdtsc and monotonic clock at init, to convert cycles to time.
+lt_global_variable u64 g_init_cycles = 0;
+lt_global_variable f64 g_init_ms = 0;
+
+lt_global_variable thread_local ProfileRing *t_ring = nullptr;
+lt_global_variable thread_local u32          t_thread = 0;
+lt_global_variable thread_local u32          t_depth = 0;
+// Set once the thread asked for a ring, threads past PROFILER_MAX_THREADS get none.
+lt_global_variable thread_local bool         t_registered = false;
+
+lt_internal f64
+monotonic_ms()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1.0e6;
+}
+
+lt_internal void
+register_thread()
+{
+	t_registered = true;
+	i32 index = jobs::thread_index();
+	if (index < 0)
+		index = jobs::num_threads() + g_num_foreign_threads.fetch_add(1, std::memory_order_relaxed);
+	if (index >= PROFILER_MAX_THREADS)
+	{
+		logger.error("Too many threads, thread ", index, " won't be profiled.");
+		return;
+	}
+
+	ProfileRing *ring = new ProfileRing;
+	ring->head.store(0, std::memory_order_relaxed);
+	ring->tail.store(0, std::memory_order_relaxed);
+	ring->dropped.store(0, std::memory_order_relaxed);
+	t_ring = ring;
+	t_thread = index;
+	g_rings[index].store(ring, std::memory_order_release);
+
+	i32 num_slots = g_num_slots.load(std::memory_order_relaxed);
+	while (num_slots <= index && !g_num_slots.compare_exchange_weak(num_slots, index + 1))
+		;
+}
+
+ProfileScope::ProfileScope(const char *name)
+	: name(name)
+{
+	t_depth++;
+	begin = lt::rdtsc();
+}
+
+ProfileScope::~ProfileScope()
+{
+	const u64 end = lt::rdtsc();
+	t_depth--;
+
+	if (!t_registered)
+		register_thread();
+	ProfileRing *ring = t_ring;
+	if (!ring)
+		return;
+
+	const u64 head = ring->head.load(std::memory_order_relaxed);
+	if (head - ring->tail.load(std::memory_order_acquire) >= PROFILER_RING_SIZE)
+	{
+		ring->dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	ProfileZone &zone = ring->zones[head & (PROFILER_RING_SIZE - 1)];
+	zone.name = name;
+	zone.begin = begin;
+	zone.end = end;
+	zone.depth = t_depth;
+	zone.thread = t_thread;
+	ring->head.store(head + 1, std::memory_order_release);
+}
+
+void
+profiler::init()
+{
+	g_init_cycles = lt::rdtsc();
+	g_init_ms = monotonic_ms();
+	g_frame_begin = g_init_cycles;
+	if (!t_registered)
+		register_thread();
+}
+
+void
+profiler::shutdown()
+{
+	const i32 n = num_threads();
+	for (i32 i = 0; i < n; i++)
+		delete g_rings[i].exchange(nullptr);
+}
+
+void
+profiler::end_frame()
+{
+	const u64 now = lt::rdtsc();
+
+	std::vector<ProfileZone> *zones = &g_discarded;
+	if (!g_paused)
+	{
+		ProfileFrame &frame = g_frames[g_next_frame];
+		frame.begin = g_frame_begin;
+		frame.end = now;
+		zones = &frame.zones;
+	}
+	zones->clear();
+
+	const i32 n = num_threads();
+	for (i32 i = 0; i < n; i++)
+	{
+		ProfileRing *ring = g_rings[i].load(std::memory_order_acquire);
+		if (!ring)
+			continue;
+
+		const u64 tail = ring->tail.load(std::memory_order_relaxed);
+		const u64 head = ring->head.load(std::memory_order_acquire);
+		for (u64 z = tail; z < head; z++)
+			zones->push_back(ring->zones[z & (PROFILER_RING_SIZE - 1)]);
+		ring->tail.store(head, std::memory_order_release);
+	}
+
+	if (!g_paused)
+	{
+		g_next_frame = (g_next_frame + 1) % PROFILER_HISTORY_FRAMES;
+		if (g_num_frames < PROFILER_HISTORY_FRAMES)
+			g_num_frames++;
+	}
+	g_frame_begin = now;
+}
+
+void
+profiler::set_paused(bool paused)
+{
+	g_paused = paused;
+}
+
+bool
+profiler::is_paused()
+{
+	return g_paused;
+}
+
+const ProfileFrame *
+profiler::last_frame()
+{
+	if (g_num_frames == 0)
+		return nullptr;
+	return &g_frames[(g_next_frame + PROFILER_HISTORY_FRAMES - 1) % PROFILER_HISTORY_FRAMES];
+}
+
+i32
+profiler::num_frames()
+{
+	return g_num_frames;
+}
+
+i32
+profiler::num_threads()
+{
+	return g_num_slots.load(std::memory_order_acquire);
+}
+
+u64
+profiler::dropped_zones()
+{
+	u64 dropped = 0;
+	const i32 n = num_threads();
+	for (i32 i = 0; i < n; i++)
+	{
+		ProfileRing *ring = g_rings[i].load(std::memory_order_acquire);
+		if (ring)
+			dropped += ring->dropped.load(std::memory_order_relaxed);
+	}
+	return dropped;
+}
+
+f64
+profiler::cycles_per_ms()
+{
+	const f64 elapsed_ms = monotonic_ms() - g_init_ms;
+	if (elapsed_ms <= 0.0)
+		return 1.0e6;
+	return (lt::rdtsc() - g_init_cycles) / elapsed_ms;
+}
+
+// Writes the string with the characters JSON doesn't allow escaped.
+lt_internal void
+write_json_string(FILE *file, const char *s)
+{
+	fputc('"', file);
+	for (; *s; s++)
+	{
+		if (*s == '"' || *s == '\\')
+			fputc('\\', file);
+		if ((u8)*s >= 0x20)
+			fputc(*s, file);
+	}
+	fputc('"', file);
+}
+
+bool
+profiler::write_chrome_trace(const char *path)
+{
+	FILE *file = fopen(path, "w");
+	if (!file)
+	{
+		logger.error("Can't open ", path, " to write the trace.");
+		return false;
+	}
+
+	const f64 cycles_per_us = cycles_per_ms() / 1000.0;
+	const i32 first = (g_next_frame + PROFILER_HISTORY_FRAMES - g_num_frames) % PROFILER_HISTORY_FRAMES;
+	const u64 base = g_num_frames > 0 ? g_frames[first].begin : 0;
+
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	bool comma = false;
+	for (i32 t = 0; t < num_threads(); t++)
+	{
+		if (!g_rings[t].load(std::memory_order_acquire))
+			continue;
+		fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,"
+				"\"args\":{\"name\":\"%s %d\"}}\n", comma ? "," : "", t, t == 0 ? "Main" : "Thread", t);
+		comma = true;
+	}
+
+	for (i32 f = 0; f < g_num_frames; f++)
+	{
+		const ProfileFrame &frame = g_frames[(first + f) % PROFILER_HISTORY_FRAMES];
+		// Frames as zones of their own, above everything on the main thread.
+		fprintf(file, "%s{\"name\":\"Frame\",\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f}\n",
+				comma ? "," : "", (i64)(frame.begin - base) / cycles_per_us, (frame.end - frame.begin) / cycles_per_us);
+		comma = true;
+
+		for (const ProfileZone &zone : frame.zones)
+		{
+			fprintf(file, ",{\"name\":");
+			write_json_string(file, zone.name);
+			// Zones can start before the first frame, the difference is signed.
+			fprintf(file, ",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}\n", zone.thread,
+					(i64)(zone.begin - base) / cycles_per_us, (zone.end - zone.begin) / cycles_per_us);
+		}
+	}
+	fprintf(file, "]}\n");
+
+	const bool ok = !ferror(file);
+	fclose(file);
+	logger.log("Wrote ", g_num_frames, " frames to ", path);
+	return ok;
+}
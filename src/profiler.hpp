@@ -0,0 +1,84 @@
+#ifndef __PROFILER_HPP__
+#define __PROFILER_HPP__
+
+#include <vector>
+#include "lt_core.hpp"
+
+//
+// Scoped CPU profiler. A zone records its name and the rdtsc at both of its ends, and is
+// pushed when it closes to a ring buffer owned by the thread that ran it. Every ring has a
+// single producer, its thread, and a single consumer, the main thread collecting the frame,
+// so pushing a zone takes no lock.
+//
+// Zones nest, each one keeps its depth in the thread's stack of open zones. Zone names must
+// outlive the profiler, string literals or names that are never freed.
+//
+// Collected frames are kept in a history that can be drawn as a flame graph or written as a
+// Chrome trace (chrome://tracing or ui.perfetto.dev).
+//
+#define PROFILER_MAX_THREADS 64
+// Zones a thread can have in flight between two collections, a power of 2.
+#define PROFILER_RING_SIZE 8192
+#define PROFILER_HISTORY_FRAMES 120
+
+struct ProfileZone
+{
+	const char *name;
+	u64         begin;
+	u64         end;
+	u32         depth;
+	u32         thread;
+};
+
+struct ProfileFrame
+{
+	u64                      begin;
+	u64                      end;
+	// Every zone that closed during the frame, in the order they closed on each thread.
+	std::vector<ProfileZone> zones;
+};
+
+struct ProfileScope
+{
+	const char *name;
+	u64         begin;
+
+	explicit ProfileScope(const char *name);
+	~ProfileScope();
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(_profile_scope_, __LINE__)(name)
+
+namespace profiler
+{
+
+// Threads are numbered like in the job system, so it has to be initialized first. The
+// calling thread is registered right away.
+void  init();
+void  shutdown();
+
+// Moves the zones closed since the last call to a new frame of the history. Only called by
+// the thread that called init.
+void  end_frame();
+// While paused the zones are still drained, but the history is not updated.
+void  set_paused(bool paused);
+bool  is_paused();
+
+// Most recent frame, nullptr before the first one.
+const ProfileFrame *last_frame();
+i32   num_frames();
+// One past the highest thread index that recorded a zone.
+i32   num_threads();
+// Zones lost because the ring of their thread was full.
+u64   dropped_zones();
+// rdtsc cycles per millisecond, measured since init.
+f64   cycles_per_ms();
+
+// Writes every frame of the history, returns false if the file can't be written.
+bool  write_chrome_trace(const char *path);
+
+};
+
+#endif // __PROFILER_HPP__
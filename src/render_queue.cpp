@@ -0,0 +1,81 @@
+#include "render_queue.hpp"
+#include <utility>
+#include <algorithm>
+
+u64
+render_key(RenderPass pass, u32 program, u32 material, u32 vao, f32 depth)
+{
+	const u32 max_depth = (1u << RENDER_KEY_DEPTH_BITS) - 1;
+	const f32 clamped = depth < 0.0f ? 0.0f : (depth > 1.0f ? 1.0f : depth);
+
+	return ((u64)(pass & 0xf) << RENDER_KEY_PASS_SHIFT)
+		| ((u64)(program & 0x3ff) << RENDER_KEY_SHADER_SHIFT)
+		| ((u64)(material & 0xffff) << RENDER_KEY_MATERIAL_SHIFT)
+		| ((u64)(vao & 0xfff) << RENDER_KEY_VAO_SHIFT)
+		| (u64)(clamped * max_depth);
+}
+
+void
+RenderQueue::clear()
+{
+	m_items.clear();
+	m_entries.clear();
+}
+
+void
+RenderQueue::push(u64 key, const RenderItem &item)
+{
+	m_entries.push_back(SortEntry{key, (u32)m_items.size()});
+	m_items.push_back(item);
+}
+
+void
+RenderQueue::sort()
+{
+	const usize n = m_entries.size();
+	if (n < 2)
+		return;
+
+	m_scratch.resize(n);
+	SortEntry *src = m_entries.data();
+	SortEntry *dst = m_scratch.data();
+
+	// LSD radix sort, one byte per pass. Most keys in a frame share the upper bytes (a couple
+	// of passes and shaders), those passes are skipped when every key has the same digit.
+	for (i32 shift = 0; shift < 64; shift += 8)
+	{
+		u32 offsets[256] = {};
+		for (usize i = 0; i < n; i++)
+			offsets[(src[i].key >> shift) & 0xff]++;
+
+		if (offsets[(src[0].key >> shift) & 0xff] == n)
+			continue;
+
+		u32 total = 0;
+		for (i32 digit = 0; digit < 256; digit++)
+		{
+			const u32 count = offsets[digit];
+			offsets[digit] = total;
+			total += count;
+		}
+
+		for (usize i = 0; i < n; i++)
+			dst[offsets[(src[i].key >> shift) & 0xff]++] = src[i];
+
+		std::swap(src, dst);
+	}
+
+	if (src != m_entries.data())
+		m_entries.swap(m_scratch);
+}
+
+void
+RenderQueue::pass_range(RenderPass pass, usize &begin, usize &end) const
+{
+	const auto key_less = [](const SortEntry &e, u64 key) { return e.key < key; };
+	const u64 first_key = (u64)pass << RENDER_KEY_PASS_SHIFT;
+	const u64 next_key = (u64)(pass + 1) << RENDER_KEY_PASS_SHIFT;
+
+	begin = std::lower_bound(m_entries.begin(), m_entries.end(), first_key, key_less) - m_entries.begin();
+	end = std::lower_bound(m_entries.begin() + begin, m_entries.end(), next_key, key_less) - m_entries.begin();
+}
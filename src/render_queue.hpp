@@ -0,0 +1,106 @@
+#ifndef __RENDER_QUEUE_HPP__
+#define __RENDER_QUEUE_HPP__
+
+#include <vector>
+#include "lt_core.hpp"
+#include "lt_math.hpp"
+
+struct Mesh;
+struct Submesh;
+struct Shader;
+struct LightEmmiter;
+
+enum RenderPass
+{
+	// Light cubes, drawn unlit with their own color.
+	RenderPass_Lights,
+	RenderPass_Opaque,
+	// Depth only, drawn to the shadow map in a queue of its own.
+	RenderPass_Shadow,
+
+	RenderPass_Count,
+};
+
+//
+// Sort key of a draw, from the most significant bits to the least:
+//
+//   pass (4) | shader (10) | material (16) | vao (12) | depth (22)
+//
+// so sorting the keys groups draws by the state that is most expensive to change, and
+// draws sharing all of it go front to back. Ids wider than their field are truncated, which
+// only makes the grouping worse, the submission compares the real state.
+//
+#define RENDER_KEY_PASS_SHIFT 60
+#define RENDER_KEY_SHADER_SHIFT 50
+#define RENDER_KEY_MATERIAL_SHIFT 34
+#define RENDER_KEY_VAO_SHIFT 22
+#define RENDER_KEY_DEPTH_BITS 22
+
+// depth is the view distance divided by the far plane, values outside [0, 1] are clamped.
+u64 render_key(RenderPass pass, u32 program, u32 material, u32 vao, f32 depth);
+
+inline RenderPass
+render_key_pass(u64 key)
+{
+	return (RenderPass)(key >> RENDER_KEY_PASS_SHIFT);
+}
+
+struct RenderItem
+{
+	const Mat4f        *model;
+	const Mesh         *mesh;
+	const Submesh      *submesh;  // nullptr draws the whole mesh.
+	Shader             *shader;
+	f32                 shininess;
+	const LightEmmiter *light;    // nullptr for everything but lights.
+	bool                selected; // Writes to the stencil buffer for the selection outline.
+};
+
+// Counts of the culled entities and the state changes issued by the last submission.
+struct RenderStats
+{
+	i32 draw_calls;
+	i32 instances;
+	i32 shader_changes;
+	i32 material_changes;
+	i32 vao_changes;
+	i32 visible;
+	i32 culled;      // Entities outside the view frustum.
+	i32 occluded;    // Entities in the frustum but hidden behind the occluders.
+};
+
+//
+// Draws collected during a frame. Items are pushed in any order and sort reorders them by
+// key with a radix sort, the items themselves are not moved, only (key, index) pairs.
+//
+struct RenderQueue
+{
+	void clear();
+	void push(u64 key, const RenderItem &item);
+	void sort();
+	// Range of the sorted draws in the pass, draws of a pass are contiguous once sorted.
+	void pass_range(RenderPass pass, usize &begin, usize &end) const;
+
+	inline usize size() const { return m_entries.size(); }
+	inline u64 key(usize i) const { return m_entries[i].key; }
+	// Items in sorted order after calling sort, push order before that.
+	inline const RenderItem &operator[](usize i) const { return m_items[m_entries[i].item]; }
+
+	// Scratch memory for the model matrices of an instanced draw.
+	std::vector<Mat4f> instances;
+	// Scratch memory for the frustum culling results of a chunk.
+	std::vector<u8>    visible;
+
+private:
+	struct SortEntry
+	{
+		u64 key;
+		u32 item;
+	};
+
+	std::vector<RenderItem> m_items;
+	std::vector<SortEntry>  m_entries;
+	std::vector<SortEntry>  m_scratch;
+};
+
+#endif // __RENDER_QUEUE_HPP__
@@ -4,6 +4,7 @@
 #include "glad/glad.h"
 #include <cstring>
 #include "gl_resources.hpp"
+#include "stb_image.h"
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
@@ -218,6 +219,18 @@ setup_mesh_buffers_puntb(Mesh &m)
 						  (void*)offsetof(Vertex_PUNTB, bitangent));
     glEnableVertexAttribArray(4);
 
+	// Per instance model matrix, one column per location. The buffer is filled when drawing.
+	glGenBuffers(1, &m.instance_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, m.instance_vbo);
+	for (u32 col = 0; col < 4; col++)
+	{
+		const u32 location = INSTANCE_MODEL_LOCATION + col;
+		glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(Mat4f),
+							  (void*)(col * sizeof(Vec4f)));
+		glEnableVertexAttribArray(location);
+		glVertexAttribDivisor(location, 1);
+	}
+
     glBindVertexArray(0);
 }
 
@@ -337,6 +350,10 @@ Resources::load_hdr_render_quad(u32 hdr_texture)
 Mesh *
 Resources::load_unit_cube(u32 diffuse_texture, u32 specular_texture, u32 normal_texture)
 {
+	if (Mesh *loaded = find_mesh(MeshAssetKind_UnitCube, "", 1.0f, diffuse_texture, specular_texture,
+								 normal_texture))
+		return loaded;
+
 	const i64 this_mesh_id = get_new_id();
 
 	Mesh *mesh = &meshes[this_mesh_id];
@@ -418,8 +435,15 @@ Resources::load_unit_cube(u32 diffuse_texture, u32 specular_texture, u32 normal_
     sm.textures.push_back(Texture(specular_texture, "material.texture_specular1"));
 	if (normal_texture)
 		sm.textures.push_back(Texture(normal_texture, "material.texture_normal1"));
+	sm.material = material_id(diffuse_texture, specular_texture, normal_texture);
 	mesh->submeshes.push_back(sm);
 
+	mesh->asset.kind = MeshAssetKind_UnitCube;
+	mesh->asset.diffuse_texture = diffuse_texture;
+	mesh->asset.specular_texture = specular_texture;
+	mesh->asset.normal_texture = normal_texture;
+
+	mesh->compute_bounds();
 	setup_mesh_buffers_puntb(*mesh);
     return mesh;
 }
@@ -428,6 +452,10 @@ Mesh *
 Resources::load_unit_plane(f32 tex_coords_scale, u32 diffuse_texture,
 						   u32 specular_texture, u32 normal_texture)
 {
+	if (Mesh *loaded = find_mesh(MeshAssetKind_UnitPlane, "", tex_coords_scale, diffuse_texture,
+								 specular_texture, normal_texture))
+		return loaded;
+
 	const i64 this_mesh_id = get_new_id();
 
 	Mesh *mesh = &meshes[this_mesh_id];
@@ -508,8 +536,16 @@ Resources::load_unit_plane(f32 tex_coords_scale, u32 diffuse_texture,
     sm.textures.push_back(Texture(specular_texture, "material.texture_specular1"));
 	if (normal_texture)
 		sm.textures.push_back(Texture(normal_texture, "material.texture_normal1"));
+	sm.material = material_id(diffuse_texture, specular_texture, normal_texture);
 	mesh->submeshes.push_back(sm);
 
+	mesh->asset.kind = MeshAssetKind_UnitPlane;
+	mesh->asset.tex_coords_scale = tex_coords_scale;
+	mesh->asset.diffuse_texture = diffuse_texture;
+	mesh->asset.specular_texture = specular_texture;
+	mesh->asset.normal_texture = normal_texture;
+
+	mesh->compute_bounds();
 	setup_mesh_buffers_puntb(*mesh);
     return mesh;
 }
@@ -518,6 +554,10 @@ Mesh *
 Resources::load_mesh_from_model(const char *path, u32 diffuse_texture, u32 specular_texture,
 								u32 normal_texture, Resources &resources)
 {
+	if (Mesh *loaded = find_mesh(MeshAssetKind_Model, path, 1.0f, diffuse_texture, specular_texture,
+								 normal_texture))
+		return loaded;
+
 	using std::string;
 	Assimp::Importer importer;
 
@@ -601,8 +641,16 @@ Resources::load_mesh_from_model(const char *path, u32 diffuse_texture, u32 specu
 		sm.textures.push_back(Texture(specular_texture, "material.texture_specular1"));
 		if (normal_texture)
 			sm.textures.push_back(Texture(normal_texture, "material.texture_normal1"));
+		sm.material = material_id(diffuse_texture, specular_texture, normal_texture);
 		mesh->submeshes.push_back(sm);
 
+		mesh->asset.kind = MeshAssetKind_Model;
+		mesh->asset.path = path;
+		mesh->asset.diffuse_texture = diffuse_texture;
+		mesh->asset.specular_texture = specular_texture;
+		mesh->asset.normal_texture = normal_texture;
+
+		mesh->compute_bounds();
 		setup_mesh_buffers_puntb(*mesh);
 		return mesh;
 	}
@@ -614,3 +662,88 @@ Resources::load_mesh_from_model(const char *path, u32 diffuse_texture, u32 specu
 	}
 	
 }
+
+u32
+Resources::load_texture(const char *path, TextureFormat texture_format, PixelFormat pixel_format)
+{
+	for (const TextureAsset &t : textures)
+		if (t.path == path && t.texture_format == texture_format && t.pixel_format == pixel_format)
+			return t.id;
+
+    std::string fullpath = std::string(RESOURCES_PATH) + std::string(path);
+    // Textures
+	GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    // Wrapping and filtering
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    // Mipmaps
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    i32 width, height, num_channels;
+    uchar *image_data = stbi_load(fullpath.c_str(), &width, &height, &num_channels, 0);
+    if (image_data)
+    {
+        logger.log("Texture ", fullpath, " loaded successfuly.");
+        logger.log("    [", width, " x ", height, "] (num channels = ", num_channels, ")");
+
+		const i32 mipmap_level = 0;
+        glTexImage2D(GL_TEXTURE_2D, mipmap_level, texture_format, width, height,
+					 0, pixel_format, GL_UNSIGNED_BYTE, image_data);
+
+        glGenerateMipmap(GL_TEXTURE_2D);
+
+        logger.log("    OpenGL read texture successfully.");
+    }
+    else
+    {
+        logger.error("    Failed loading texture");
+    }
+    // Free image
+    stbi_image_free(image_data);
+
+	textures.push_back(TextureAsset{path, texture_format, pixel_format, texture});
+	return texture;
+}
+
+const TextureAsset *
+Resources::find_texture(u32 id) const
+{
+	for (const TextureAsset &t : textures)
+		if (t.id == id)
+			return &t;
+	return nullptr;
+}
+
+u32
+Resources::material_id(u32 diffuse_texture, u32 specular_texture, u32 normal_texture)
+{
+	for (usize i = 0; i < materials.size(); i++)
+	{
+		const MaterialTextures &m = materials[i];
+		if (m.diffuse == diffuse_texture && m.specular == specular_texture && m.normal == normal_texture)
+			return i + 1;
+	}
+
+	materials.push_back(MaterialTextures{diffuse_texture, specular_texture, normal_texture});
+	return materials.size();
+}
+
+Mesh *
+Resources::find_mesh(MeshAssetKind kind, const char *path, f32 tex_coords_scale, u32 diffuse_texture,
+					 u32 specular_texture, u32 normal_texture)
+{
+	for (Mesh &mesh : meshes)
+	{
+		const MeshAsset &a = mesh.asset;
+		if (a.kind == kind && a.path == path && a.tex_coords_scale == tex_coords_scale
+			&& a.diffuse_texture == diffuse_texture && a.specular_texture == specular_texture
+			&& a.normal_texture == normal_texture)
+			return &mesh;
+	}
+	return nullptr;
+}
@@ -2,6 +2,8 @@
 #define __RESOURCES_HPP__
 
 #include <vector>
+#include <string>
+#include "glad/glad.h"
 #include "lt_core.hpp"
 #include "mesh.hpp"
 
@@ -20,6 +22,37 @@ struct Mesh;
 // 	VertexF
 // };
 
+enum TextureFormat
+{
+	TextureFormat_RGB = GL_RGB8,
+	TextureFormat_RGBA = GL_RGBA,
+	TextureFormat_SRGB = GL_SRGB8,
+	TextureFormat_SRGBA = GL_SRGB_ALPHA,
+};
+
+enum PixelFormat
+{
+	PixelFormat_RGB = GL_RGB,
+	PixelFormat_RGBA = GL_RGBA,
+};
+
+// Where a loaded texture came from, so it can be referenced from a scene file.
+struct TextureAsset
+{
+	std::string   path;
+	TextureFormat texture_format;
+	PixelFormat   pixel_format;
+	u32           id;
+};
+
+// Texture set of a submesh, submeshes with the same one share a material id.
+struct MaterialTextures
+{
+	u32 diffuse;
+	u32 specular;
+	u32 normal;
+};
+
 struct Vertex_PU
 {
 	Vec3f position;
@@ -42,7 +75,18 @@ static_assert(sizeof(Vertex_PUNTB) == sizeof(f32)*14, "Vertex_PUNTB should be pa
 struct Resources
 {
 	Mesh meshes[MAX_NUM_MESHES] = {};
+	std::vector<TextureAsset> textures;
+	std::vector<MaterialTextures> materials;
+
+	// Loads a texture from the resources folder, or returns the one already loaded from the same path.
+	u32 load_texture(const char *path, TextureFormat texture_format, PixelFormat pixel_format);
+	// Returns nullptr if the texture was not loaded with load_texture.
+	const TextureAsset *find_texture(u32 id) const;
+	// Returns the id of the texture set, starting at 1, adding it if it is new.
+	u32 material_id(u32 diffuse_texture, u32 specular_texture, u32 normal_texture);
 
+	// Meshes loaded from an asset are shared, loading the same one again returns the same mesh,
+	// so every entity using it can be drawn with a single instanced draw call.
 	Mesh *load_cubemap(u32 cubemap_texture);
 	Mesh *load_unit_cube(u32 diffuse_texture, u32 specular_texture, u32 normal_texture = 0);
 	Mesh *load_unit_plane(f32 tex_coords_scale, u32 diffuse_texture,
@@ -53,6 +97,9 @@ struct Resources
 							   u32 normal_texture, Resources &resources);
 
 private:
+	Mesh *find_mesh(MeshAssetKind kind, const char *path, f32 tex_coords_scale, u32 diffuse_texture,
+					u32 specular_texture, u32 normal_texture);
+
 	inline i64 get_new_id()
 	{
 		lt_local_persist i64 mesh_id = 0;
@@ -0,0 +1,419 @@
+#include "scene.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+#include "lt_utils.hpp"
+#include "entities.hpp"
+#include "resources.hpp"
+#include "shader.hpp"
+
+lt_global_variable lt::Logger logger("scene");
+
+lt_internal inline usize
+align_up(usize value, usize alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+lt_internal u32
+push_string(std::vector<char> &strings, const char *str)
+{
+	const u32 offset = strings.size();
+	strings.insert(strings.end(), str, str + strlen(str) + 1);
+	return offset;
+}
+
+lt_internal LocalTransform
+identity_local_transform()
+{
+	LocalTransform t;
+	t.position = Vec3f(0);
+	t.rotation = Vec3f(0);
+	t.scale = Vec3f(1);
+	return t;
+}
+
+bool
+scene_export(const char *path, const Entities &entities, const Resources &resources)
+{
+	std::vector<char>          strings;
+	std::vector<SceneTexture>  textures;
+	std::vector<u32>           texture_ids;
+	std::vector<SceneMesh>     meshes;
+	std::vector<const Mesh*>   mesh_ptrs;
+	std::vector<SceneShader>   shaders;
+	std::vector<const Shader*> shader_ptrs;
+
+	auto texture_index = [&](u32 id) -> u32 {
+		if (id == 0)
+			return SCENE_NONE;
+		for (usize i = 0; i < texture_ids.size(); i++)
+			if (texture_ids[i] == id)
+				return i;
+
+		const TextureAsset *asset = resources.find_texture(id);
+		if (!asset)
+		{
+			logger.error("Texture ", id, " was not loaded from a file, skipping it.");
+			return SCENE_NONE;
+		}
+		textures.push_back(SceneTexture{push_string(strings, asset->path.c_str()),
+										(u32)asset->texture_format, (u32)asset->pixel_format});
+		texture_ids.push_back(id);
+		return textures.size() - 1;
+	};
+
+	auto mesh_index = [&](const Mesh *mesh) -> u32 {
+		if (!mesh)
+			return SCENE_NONE;
+		for (usize i = 0; i < mesh_ptrs.size(); i++)
+			if (mesh_ptrs[i] == mesh)
+				return i;
+
+		if (mesh->asset.kind == MeshAssetKind_None)
+		{
+			logger.error("Mesh ", mesh->id, " was not loaded from an asset, skipping it.");
+			return SCENE_NONE;
+		}
+		SceneMesh m = {};
+		m.kind = mesh->asset.kind;
+		m.path = mesh->asset.path.empty() ? SCENE_NONE : push_string(strings, mesh->asset.path.c_str());
+		m.tex_coords_scale = mesh->asset.tex_coords_scale;
+		m.diffuse_texture = texture_index(mesh->asset.diffuse_texture);
+		m.specular_texture = texture_index(mesh->asset.specular_texture);
+		m.normal_texture = texture_index(mesh->asset.normal_texture);
+		meshes.push_back(m);
+		mesh_ptrs.push_back(mesh);
+		return meshes.size() - 1;
+	};
+
+	auto shader_index = [&](const Shader *shader) -> u32 {
+		if (!shader)
+			return SCENE_NONE;
+		for (usize i = 0; i < shader_ptrs.size(); i++)
+			if (shader_ptrs[i] == shader)
+				return i;
+		shaders.push_back(SceneShader{push_string(strings, shader->name)});
+		shader_ptrs.push_back(shader);
+		return shaders.size() - 1;
+	};
+
+	// Walking the archetypes keeps entities with the same mask together in the file.
+	std::vector<EntityHandle> handles;
+	std::vector<u32>          scene_index(entities.num_slots(), SCENE_NONE);
+	for (const Archetype &arch : entities.archetypes)
+	{
+		for (const EntityChunk *chunk : arch.chunks)
+		{
+			for (i32 row = 0; row < chunk->count; row++)
+			{
+				scene_index[entity_index(chunk->handles[row])] = handles.size();
+				handles.push_back(chunk->handles[row]);
+			}
+		}
+	}
+
+	const usize n = handles.size();
+	std::vector<u32>               masks(n);
+	std::vector<u32>               names(n, SCENE_NONE);
+	std::vector<u32>               parents(n, SCENE_NONE);
+	std::vector<Transform>         transforms(n, Transform{Mat4f(1)});
+	std::vector<LocalTransform>    locals(n, identity_local_transform());
+	std::vector<SceneRenderable>   renderables(n, SceneRenderable{SCENE_NONE, SCENE_NONE, 0});
+	std::vector<SceneLightEmmiter> light_emmiters(n);
+
+	for (usize i = 0; i < n; i++)
+	{
+		const EntityHandle h = handles[i];
+		const u32 index = entity_index(h);
+		const u32 mask = entities.mask(h);
+		masks[i] = mask;
+
+		if (const char *name = entities.get_name(h))
+			names[i] = push_string(strings, name);
+
+		if (mask & ComponentKind_Transform)
+		{
+			transforms[i] = *entities.transform(h);
+			locals[i] = entities.hierarchy.local[index];
+
+			const EntityHandle parent = entities.hierarchy.parent[index];
+			if (parent != -1)
+				parents[i] = scene_index[entity_index(parent)];
+		}
+
+		if (mask & ComponentKind_Renderable)
+		{
+			const Renderable *r = entities.renderable(h);
+			renderables[i].mesh = mesh_index(r->mesh);
+			renderables[i].shader = shader_index(r->shader);
+			renderables[i].shininess = r->shininess;
+		}
+
+		light_emmiters[i] = {};
+		light_emmiters[i].shader = SCENE_NONE;
+		if (mask & ComponentKind_LightEmmiter)
+		{
+			const LightEmmiter *le = entities.light_emmiter(h);
+			light_emmiters[i].ambient = le->ambient;
+			light_emmiters[i].diffuse = le->diffuse;
+			light_emmiters[i].specular = le->specular;
+			light_emmiters[i].position = le->position;
+			light_emmiters[i].constant = le->constant;
+			light_emmiters[i].linear = le->linear;
+			light_emmiters[i].quadratic = le->quadratic;
+			light_emmiters[i].shader = shader_index(le->shader);
+		}
+	}
+
+	SceneHeader header = {};
+	header.magic = SCENE_MAGIC;
+	header.version = SCENE_VERSION;
+	header.num_entities = n;
+	header.num_textures = textures.size();
+	header.num_meshes = meshes.size();
+	header.num_shaders = shaders.size();
+	header.strings_size = strings.size();
+
+	std::vector<u8> file(sizeof(SceneHeader));
+	auto add_section = [&](SceneSection section, const void *data, usize size) {
+		file.resize(align_up(file.size(), SCENE_SECTION_ALIGNMENT), 0);
+		header.sections[section] = file.size();
+		file.insert(file.end(), (const u8*)data, (const u8*)data + size);
+	};
+
+	add_section(SceneSection_Strings, strings.data(), strings.size());
+	add_section(SceneSection_Textures, textures.data(), textures.size() * sizeof(SceneTexture));
+	add_section(SceneSection_Meshes, meshes.data(), meshes.size() * sizeof(SceneMesh));
+	add_section(SceneSection_Shaders, shaders.data(), shaders.size() * sizeof(SceneShader));
+	add_section(SceneSection_Masks, masks.data(), n * sizeof(u32));
+	add_section(SceneSection_Names, names.data(), n * sizeof(u32));
+	add_section(SceneSection_Parents, parents.data(), n * sizeof(u32));
+	add_section(SceneSection_Transforms, transforms.data(), n * sizeof(Transform));
+	add_section(SceneSection_Locals, locals.data(), n * sizeof(LocalTransform));
+	add_section(SceneSection_Renderables, renderables.data(), n * sizeof(SceneRenderable));
+	add_section(SceneSection_LightEmmiters, light_emmiters.data(), n * sizeof(SceneLightEmmiter));
+
+	header.file_size = file.size();
+	memcpy(file.data(), &header, sizeof(SceneHeader));
+
+	FILE *fp = fopen(path, "wb");
+	if (!fp)
+	{
+		logger.error("Failed to open ", path, " for writing.");
+		return false;
+	}
+	const bool written = fwrite(file.data(), 1, file.size(), fp) == file.size();
+	fclose(fp);
+
+	if (!written)
+	{
+		logger.error("Failed to write the scene to ", path);
+		return false;
+	}
+	logger.log("Exported ", n, " entities to ", path, " (", file.size(), " bytes).");
+	return true;
+}
+
+// Returns the section if it fits inside the file, nullptr otherwise.
+lt_internal const void *
+section_data(const u8 *file, const SceneHeader &header, SceneSection section, usize size)
+{
+	const u64 offset = header.sections[section];
+	if (offset % SCENE_SECTION_ALIGNMENT != 0 || offset > header.file_size || size > header.file_size - offset)
+		return nullptr;
+	return file + offset;
+}
+
+lt_internal bool
+load_mapped_scene(const u8 *file, usize file_size, const char *path, Entities &entities,
+				  Resources &resources, Shader *const *shaders, i32 num_shaders)
+{
+	const SceneHeader &header = *(const SceneHeader*)file;
+	if (header.magic != SCENE_MAGIC)
+	{
+		logger.error(path, " is not a scene file.");
+		return false;
+	}
+	if (header.version != SCENE_VERSION)
+	{
+		logger.error(path, " has version ", header.version, ", expected version ", SCENE_VERSION, ".");
+		return false;
+	}
+	if (header.file_size != file_size)
+	{
+		logger.error(path, " is truncated.");
+		return false;
+	}
+
+	const usize n = header.num_entities;
+	const char *strings = (const char*)section_data(file, header, SceneSection_Strings, header.strings_size);
+	const SceneTexture *textures = (const SceneTexture*)section_data(
+		file, header, SceneSection_Textures, header.num_textures * sizeof(SceneTexture));
+	const SceneMesh *meshes = (const SceneMesh*)section_data(
+		file, header, SceneSection_Meshes, header.num_meshes * sizeof(SceneMesh));
+	const SceneShader *scene_shaders = (const SceneShader*)section_data(
+		file, header, SceneSection_Shaders, header.num_shaders * sizeof(SceneShader));
+	const u32 *masks = (const u32*)section_data(file, header, SceneSection_Masks, n * sizeof(u32));
+	const u32 *names = (const u32*)section_data(file, header, SceneSection_Names, n * sizeof(u32));
+	const u32 *parents = (const u32*)section_data(file, header, SceneSection_Parents, n * sizeof(u32));
+	const Transform *transforms = (const Transform*)section_data(
+		file, header, SceneSection_Transforms, n * sizeof(Transform));
+	const LocalTransform *locals = (const LocalTransform*)section_data(
+		file, header, SceneSection_Locals, n * sizeof(LocalTransform));
+	const SceneRenderable *renderables = (const SceneRenderable*)section_data(
+		file, header, SceneSection_Renderables, n * sizeof(SceneRenderable));
+	const SceneLightEmmiter *light_emmiters = (const SceneLightEmmiter*)section_data(
+		file, header, SceneSection_LightEmmiters, n * sizeof(SceneLightEmmiter));
+
+	if (!strings || !textures || !meshes || !scene_shaders || !masks || !names || !parents ||
+		!transforms || !locals || !renderables || !light_emmiters ||
+		(header.strings_size > 0 && strings[header.strings_size - 1] != 0))
+	{
+		logger.error(path, " has invalid sections.");
+		return false;
+	}
+
+	auto string_at = [&](u32 offset) -> const char * {
+		return offset < header.strings_size ? strings + offset : nullptr;
+	};
+
+	//
+	// Assets
+	//
+	std::vector<u32> texture_ids(header.num_textures, 0);
+	for (u32 i = 0; i < header.num_textures; i++)
+	{
+		const char *texture_path = string_at(textures[i].path);
+		if (texture_path)
+			texture_ids[i] = resources.load_texture(texture_path, (TextureFormat)textures[i].texture_format,
+													(PixelFormat)textures[i].pixel_format);
+	}
+	auto texture_id = [&](u32 index) -> u32 {
+		return index < texture_ids.size() ? texture_ids[index] : 0;
+	};
+
+	std::vector<Mesh*> mesh_ptrs(header.num_meshes, nullptr);
+	for (u32 i = 0; i < header.num_meshes; i++)
+	{
+		const SceneMesh &m = meshes[i];
+		switch (m.kind)
+		{
+		case MeshAssetKind_UnitCube:
+			mesh_ptrs[i] = resources.load_unit_cube(texture_id(m.diffuse_texture), texture_id(m.specular_texture),
+													texture_id(m.normal_texture));
+			break;
+		case MeshAssetKind_UnitPlane:
+			mesh_ptrs[i] = resources.load_unit_plane(m.tex_coords_scale, texture_id(m.diffuse_texture),
+													 texture_id(m.specular_texture), texture_id(m.normal_texture));
+			break;
+		case MeshAssetKind_Model:
+			if (string_at(m.path))
+				mesh_ptrs[i] = resources.load_mesh_from_model(string_at(m.path), texture_id(m.diffuse_texture),
+															  texture_id(m.specular_texture),
+															  texture_id(m.normal_texture), resources);
+			break;
+		default:
+			logger.error("Unknown mesh kind ", m.kind, " in ", path);
+		}
+	}
+
+	std::vector<Shader*> shader_ptrs(header.num_shaders, nullptr);
+	for (u32 i = 0; i < header.num_shaders; i++)
+	{
+		const char *name = string_at(scene_shaders[i].name);
+		for (i32 s = 0; name && s < num_shaders; s++)
+			if (shaders[s] && strcmp(shaders[s]->name, name) == 0)
+				shader_ptrs[i] = shaders[s];
+
+		if (!shader_ptrs[i])
+			logger.error("Shader ", name ? name : "(null)", " used by the scene is not loaded.");
+	}
+	auto shader_at = [&](u32 index) -> Shader * {
+		return index < shader_ptrs.size() ? shader_ptrs[index] : nullptr;
+	};
+
+	//
+	// Entities, created one at a time with their components copied from the mapped columns.
+	//
+	std::vector<EntityHandle> handles(n);
+	for (usize i = 0; i < n; i++)
+	{
+		const u32 mask = masks[i];
+		const EntityHandle h = entities.create(mask);
+		handles[i] = h;
+
+		if (names[i] != SCENE_NONE && string_at(names[i]))
+			entities.set_name(h, string_at(names[i]));
+
+		if (mask & ComponentKind_Transform)
+		{
+			*entities.transform(h) = transforms[i];
+			// Marks the entity dirty, its world matrix and bounds are computed by the next update.
+			entities.hierarchy.set_local(h, locals[i]);
+		}
+
+		if (mask & ComponentKind_Renderable)
+		{
+			Renderable *r = entities.renderable(h);
+			r->mesh = renderables[i].mesh < mesh_ptrs.size() ? mesh_ptrs[renderables[i].mesh] : nullptr;
+			r->shader = shader_at(renderables[i].shader);
+			r->shininess = renderables[i].shininess;
+		}
+
+		if (mask & ComponentKind_LightEmmiter)
+		{
+			const SceneLightEmmiter &src = light_emmiters[i];
+			LightEmmiter *le = entities.light_emmiter(h);
+			le->ambient = src.ambient;
+			le->diffuse = src.diffuse;
+			le->specular = src.specular;
+			le->position = src.position;
+			le->constant = src.constant;
+			le->linear = src.linear;
+			le->quadratic = src.quadratic;
+			le->shader = shader_at(src.shader);
+		}
+	}
+
+	for (usize i = 0; i < n; i++)
+		if (parents[i] < n && (masks[i] & masks[parents[i]] & ComponentKind_Transform))
+			entities.hierarchy.set_parent(handles[i], handles[parents[i]]);
+
+	logger.log("Loaded ", n, " entities from ", path);
+	return true;
+}
+
+bool
+scene_load(const char *path, Entities &entities, Resources &resources, Shader *const *shaders, i32 num_shaders)
+{
+	const i32 fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(SceneHeader))
+	{
+		logger.error(path, " is not a scene file.");
+		close(fd);
+		return false;
+	}
+
+	void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		logger.error("Failed to map ", path);
+		return false;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	const bool loaded = load_mapped_scene((const u8*)map, st.st_size, path, entities,
+										  resources, shaders, num_shaders);
+	munmap(map, st.st_size);
+	return loaded;
+}
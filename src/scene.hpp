@@ -0,0 +1,110 @@
+#ifndef __SCENE_HPP__
+#define __SCENE_HPP__
+
+#include "lt_core.hpp"
+#include "lt_math.hpp"
+#include "hierarchy.hpp"
+
+struct Entities;
+struct Resources;
+struct Shader;
+
+//
+// Binary scene file. The file starts with a SceneHeader, followed by sections at the
+// offsets stored in the header, each aligned to SCENE_SECTION_ALIGNMENT.
+//
+// Assets are stored as tables of load arguments (texture paths, mesh kinds, shader names),
+// and the entities as parallel component columns with one element per entity. Loading maps
+// the file and reads the columns in place, nothing is parsed, but every entity is still
+// created and has its components copied one by one, with the mesh and shader indices
+// resolved to the loaded assets.
+//
+#define SCENE_MAGIC 0x4e435353 // "SSCN"
+// Bumped whenever the layout or the content of the default scene changes, older files are
+// rejected and the default scene is used instead.
+#define SCENE_VERSION 2
+#define SCENE_SECTION_ALIGNMENT 16
+// String offset or table index meaning there is nothing referenced.
+#define SCENE_NONE 0xffffffff
+
+enum SceneSection
+{
+	SceneSection_Strings,        // char[], NUL terminated strings
+	SceneSection_Textures,       // SceneTexture[num_textures]
+	SceneSection_Meshes,         // SceneMesh[num_meshes]
+	SceneSection_Shaders,        // SceneShader[num_shaders]
+	SceneSection_Masks,          // u32[num_entities]
+	SceneSection_Names,          // u32[num_entities], offset into the strings
+	SceneSection_Parents,        // u32[num_entities], index of the parent entity
+	SceneSection_Transforms,     // Transform[num_entities]
+	SceneSection_Locals,         // LocalTransform[num_entities]
+	SceneSection_Renderables,    // SceneRenderable[num_entities]
+	SceneSection_LightEmmiters,  // SceneLightEmmiter[num_entities]
+
+	SceneSection_Count,
+};
+
+struct SceneHeader
+{
+	u32 magic;
+	u32 version;
+	u32 num_entities;
+	u32 num_textures;
+	u32 num_meshes;
+	u32 num_shaders;
+	u32 strings_size;
+	u64 file_size;
+	u64 sections[SceneSection_Count];
+};
+
+struct SceneTexture
+{
+	u32 path;
+	u32 texture_format;
+	u32 pixel_format;
+};
+
+struct SceneMesh
+{
+	u32 kind;
+	u32 path;
+	f32 tex_coords_scale;
+	u32 diffuse_texture;
+	u32 specular_texture;
+	u32 normal_texture;
+};
+
+struct SceneShader
+{
+	u32 name;
+};
+
+struct SceneRenderable
+{
+	u32 mesh;
+	u32 shader;
+	f32 shininess;
+};
+
+struct SceneLightEmmiter
+{
+	Vec3f ambient;
+	Vec3f diffuse;
+	Vec3f specular;
+	Vec3f position;
+	f32   constant;
+	f32   linear;
+	f32   quadratic;
+	u32   shader;
+};
+
+// Writes every entity to the file. Meshes and textures have to be loaded through
+// Resources, otherwise they can't be referenced and the entity is saved without them.
+bool scene_export(const char *path, const Entities &entities, const Resources &resources);
+
+// Creates the entities stored in the file. Shaders are resolved by their name from the
+// given list. Returns false if the file does not exist or is not a valid scene.
+bool scene_load(const char *path, Entities &entities, Resources &resources,
+				Shader *const *shaders, i32 num_shaders);
+
+#endif // __SCENE_HPP__
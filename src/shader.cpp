@@ -8,19 +8,16 @@
 #include "lt_fs.hpp"
 #include "lt_utils.hpp"
 #include "gl_context.hpp"
-#include "camera.hpp"
+#include "uniform_blocks.hpp"
 
 lt_internal lt::Logger logger("shader");
 
-lt_internal GLuint
-make_program(const char* shader_name)
+lt_internal bool
+read_shader_source(const char *file_name, std::string &source)
 {
     using std::string;
 
-	logger.log("Making shader program for ", shader_name);
-
-    // Fetch source codes from each shader
-    string shader_src_path = string(RESOURCES_PATH) + string(shader_name);
+    string shader_src_path = string(RESOURCES_PATH) + string(file_name);
     FileContents *shader_src = file_read_contents(shader_src_path.c_str());
 
     LT_Assert(shader_src != nullptr);
@@ -29,12 +26,27 @@ make_program(const char* shader_name)
     {
         logger.error("Error reading shader source from ", shader_src_path);
         file_free_contents(shader_src);
-        return 0;
+        return false;
     }
 
-    string shader_string((char*)shader_src->data, (char*)shader_src->data + shader_src->size - 1);
+    source.assign((char*)shader_src->data, (char*)shader_src->data + shader_src->size - 1);
 
     file_free_contents(shader_src);
+    return true;
+}
+
+lt_internal GLuint
+make_program(const char* shader_name, const std::string &defines)
+{
+    using std::string;
+
+	logger.log("Making shader program for ", shader_name);
+
+    // Fetch source codes from each shader, every one of them gets the uniform blocks first.
+    string blocks_string, shader_string;
+    if (!read_shader_source(UNIFORM_BLOCKS_SHADER, blocks_string) ||
+        !read_shader_source(shader_name, shader_string))
+        return 0;
 
     GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
     GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
@@ -42,7 +54,6 @@ make_program(const char* shader_name)
     if (vertex_shader == 0 || fragment_shader == 0)
     {
         logger.error("Error creating shaders (glCreateShader)\n");
-        file_free_contents(shader_src);
         glDeleteShader(vertex_shader);
         glDeleteShader(fragment_shader);
         return 0;
@@ -52,19 +63,23 @@ make_program(const char* shader_name)
     GLchar info[512] = {};
     GLint success;
     {
-        const char *vertex_string[3] = {
+        const char *vertex_string[5] = {
             "#version 330 core\n",
             "#define COMPILING_VERTEX\n",
+            defines.c_str(),
+            blocks_string.c_str(),
             shader_string.c_str(),
         };
-        glShaderSource(vertex_shader, 3, &vertex_string[0], NULL);
+        glShaderSource(vertex_shader, 5, &vertex_string[0], NULL);
 
-        const char *fragment_string[3] = {
+        const char *fragment_string[5] = {
             "#version 330 core\n",
             "#define COMPILING_FRAGMENT\n",
+            defines.c_str(),
+            blocks_string.c_str(),
             shader_string.c_str(),
         };
-        glShaderSource(fragment_shader, 3, &fragment_string[0], NULL);
+        glShaderSource(fragment_shader, 5, &fragment_string[0], NULL);
     }
 
     glCompileShader(vertex_shader);
@@ -103,6 +118,8 @@ make_program(const char* shader_name)
         goto error_cleanup;
     }
 
+    bind_uniform_blocks(program);
+
     glDeleteShader(vertex_shader);
     glDeleteShader(fragment_shader);
     return program;
@@ -118,7 +135,7 @@ Shader::recompile()
 {
     logger.log("Recompiling ", name, " shader");
     GLuint old_program = program;
-    GLuint new_program = make_program(name);
+    GLuint new_program = make_program(name, defines);
 
     if (new_program == 0)
         return;
@@ -130,11 +147,12 @@ Shader::recompile()
         m_recompilation_handler();
 }
 
-Shader::Shader(const char *name)
+Shader::Shader(const char *name, const std::string &defines)
     : name(name)
+	, defines(defines)
 	, m_next_texture_unit(0)
 {
-    program = make_program(name);
+    program = make_program(name, defines);
 }
 
 Shader::~Shader()
@@ -176,14 +194,6 @@ Shader::texture_unit(const std::string &name) const
 	return texture_unit(name.c_str());
 }
 
-void
-Shader::setup_projection_matrix(f32 aspect_ratio, GLContext &context)
-{
-    const Mat4f projection = lt::perspective(60.0f, aspect_ratio, Camera::ZNEAR, Camera::ZFAR);
-    context.use_shader(*this);
-    glUniformMatrix4fv(get_location("projection"), 1, GL_FALSE, projection.data());
-}
-
 void
 Shader::set3f(const char *name, Vec3f v)
 {
@@ -3,6 +3,7 @@
 #include "glad/glad.h"
 
 #include <functional>
+#include <string>
 #include <unordered_map>
 #include "lt_core.hpp"
 #include "lt_math.hpp"
@@ -13,8 +14,11 @@ struct Shader
 {
     const char *name;
     u32 program;
+    // Lines inserted after the version directive, e.g. "#define FOO\n", to compile a variant
+    // of the source.
+    std::string defines;
 
-    explicit Shader(const char *name);
+    explicit Shader(const char *name, const std::string &defines = std::string());
     Shader()
 		: name(nullptr)
 		, program(-1)
@@ -23,7 +27,6 @@ struct Shader
 
     void recompile();
     void on_recompilation(const std::function<void()> &handler);
-    void setup_projection_matrix(f32 aspect_ratio, GLContext &context);
 
     void set3f(const char *name, Vec3f v);
     void set1i(const char *name, i32 i);
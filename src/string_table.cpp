@@ -0,0 +1,128 @@
+#include "string_table.hpp"
+#include <string.h>
+#include <stdlib.h>
+#include "lt_utils.hpp"
+
+// Size of each arena block, strings longer than this get a block of their own.
+#define STRING_TABLE_BLOCK_SIZE (16 * 1024)
+#define STRING_TABLE_INITIAL_SLOTS 256
+
+// FNV-1a
+lt_internal u32
+hash_string(const char *str, usize len)
+{
+	u32 hash = 2166136261u;
+	for (usize i = 0; i < len; i++)
+	{
+		hash ^= (u8)str[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+StringTable::StringTable()
+	: m_slots(STRING_TABLE_INITIAL_SLOTS, STRING_ID_NONE)
+	, m_block_used(0)
+	, m_block_size(0)
+{
+}
+
+StringTable::~StringTable()
+{
+	for (char *block : m_blocks)
+		free(block);
+}
+
+StringId
+StringTable::lookup(const char *str, usize len, u32 hash, usize *slot) const
+{
+	const usize mask = m_slots.size() - 1;
+	usize i = hash & mask;
+
+	// Linear probing, the table is kept at most half full so there is always an empty slot.
+	while (m_slots[i] != STRING_ID_NONE)
+	{
+		const Entry &e = m_strings[m_slots[i] - 1];
+		if (e.hash == hash && e.len == len && memcmp(e.str, str, len) == 0)
+			break;
+		i = (i + 1) & mask;
+	}
+
+	if (slot)
+		*slot = i;
+	return m_slots[i];
+}
+
+const char *
+StringTable::store(const char *str, usize len)
+{
+	const usize size = len + 1;
+	if (m_blocks.empty() || m_block_used + size > m_block_size)
+	{
+		const usize block_size = size > STRING_TABLE_BLOCK_SIZE ? size : STRING_TABLE_BLOCK_SIZE;
+		m_blocks.push_back((char*)malloc(block_size));
+		m_block_used = 0;
+		m_block_size = block_size;
+	}
+
+	char *dst = m_blocks.back() + m_block_used;
+	memcpy(dst, str, len);
+	dst[len] = 0;
+	m_block_used += size;
+	return dst;
+}
+
+void
+StringTable::grow_slots()
+{
+	const usize new_size = m_slots.size() * 2;
+	m_slots.assign(new_size, STRING_ID_NONE);
+
+	for (usize id = 1; id <= m_strings.size(); id++)
+	{
+		usize i = m_strings[id - 1].hash & (new_size - 1);
+		while (m_slots[i] != STRING_ID_NONE)
+			i = (i + 1) & (new_size - 1);
+		m_slots[i] = id;
+	}
+}
+
+StringId
+StringTable::intern(const char *str, usize len)
+{
+	const u32 hash = hash_string(str, len);
+	usize slot;
+	const StringId found = lookup(str, len, hash, &slot);
+	if (found != STRING_ID_NONE)
+		return found;
+
+	m_strings.push_back(Entry{store(str, len), (u32)len, hash});
+	const StringId id = m_strings.size();
+
+	if (m_strings.size() * 2 > m_slots.size())
+		grow_slots();
+	else
+		m_slots[slot] = id;
+
+	return id;
+}
+
+StringId
+StringTable::intern(const char *str)
+{
+	return intern(str, strlen(str));
+}
+
+StringId
+StringTable::find(const char *str) const
+{
+	const usize len = strlen(str);
+	return lookup(str, len, hash_string(str, len), nullptr);
+}
+
+const char *
+StringTable::get(StringId id) const
+{
+	LT_Assert(id != STRING_ID_NONE && id <= m_strings.size());
+	return m_strings[id - 1].str;
+}
@@ -0,0 +1,53 @@
+#ifndef __STRING_TABLE_HPP__
+#define __STRING_TABLE_HPP__
+
+#include <vector>
+#include "lt_core.hpp"
+
+// Compact identifier of an interned string, 0 meaning no string.
+typedef u32 StringId;
+
+#define STRING_ID_NONE 0
+
+//
+// Interns strings into an append-only arena, so every distinct string is stored once and
+// is identified by a small integer. Interned strings never move or get freed, so the
+// pointers returned by get stay valid for the lifetime of the table.
+//
+struct StringTable
+{
+	StringTable();
+	StringTable(const StringTable&) = delete;
+	StringTable &operator=(const StringTable&) = delete;
+	~StringTable();
+
+	// Returns the id of the string, adding it to the table if it is not there yet.
+	StringId    intern(const char *str);
+	StringId    intern(const char *str, usize len);
+	// Returns STRING_ID_NONE if the string was never interned.
+	StringId    find(const char *str) const;
+	const char *get(StringId id) const;
+
+	// Ids go from 1 to count(), inclusive.
+	inline u32  count() const { return m_strings.size(); }
+
+private:
+	struct Entry
+	{
+		const char *str;
+		u32         len;
+		u32         hash;
+	};
+
+	std::vector<Entry>    m_strings; // Indexed by id - 1.
+	std::vector<StringId> m_slots;   // Open addressing hash table, size is a power of two.
+	std::vector<char*>    m_blocks;
+	usize                 m_block_used;
+	usize                 m_block_size;
+
+	StringId    lookup(const char *str, usize len, u32 hash, usize *slot) const;
+	const char *store(const char *str, usize len);
+	void        grow_slots();
+};
+
+#endif // __STRING_TABLE_HPP__
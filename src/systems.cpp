@@ -0,0 +1,104 @@
+#include "systems.hpp"
+#include <algorithm>
+#include "lt_utils.hpp"
+#include "debug_gui.hpp"
+#include "jobs.hpp"
+#include "profiler.hpp"
+
+lt_global_variable lt::Logger logger("systems");
+
+lt_internal void
+execute_system(System *system, f64 dt)
+{
+	// System names are string literals, they outlive the profiler. The debug gui finds the
+	// time of each system by its zone.
+	PROFILE_SCOPE(system->name);
+	system->fn(dt);
+}
+
+void
+SystemScheduler::add(const char *name, u32 reads, u32 writes, const SystemFunction &fn)
+{
+	System system = {};
+	system.name = name;
+	system.reads = reads;
+	system.writes = writes;
+	system.fn = fn;
+	systems.push_back(system);
+}
+
+//
+// Assign every system to a level. A system depends on every system registered
+// before it whose component sets conflict with its own, so it runs one level after
+// the deepest of them. Systems in the same level never conflict, and conflicting
+// systems always run in registration order, which keeps results deterministic.
+//
+void
+SystemScheduler::build_levels()
+{
+	for (usize i = 0; i < systems.size(); i++)
+	{
+		systems[i].level = 0;
+		for (usize j = 0; j < i; j++)
+			if (systems[i].conflicts_with(systems[j]) && systems[j].level >= systems[i].level)
+				systems[i].level = systems[j].level + 1;
+	}
+}
+
+struct SystemJobData
+{
+	System *system;
+	f64     dt;
+};
+
+lt_internal void
+system_job(Job *job, const void *data)
+{
+	LT_Unused(job);
+	const SystemJobData *job_data = (const SystemJobData*)data;
+	execute_system(job_data->system, job_data->dt);
+}
+
+void
+SystemScheduler::run(f64 dt)
+{
+	build_levels();
+
+	i32 max_level = -1;
+	for (const System &system : systems)
+		max_level = std::max(max_level, system.level);
+
+	std::vector<System*> level_systems;
+
+	for (i32 level = 0; level <= max_level; level++)
+	{
+		level_systems.clear();
+		for (System &system : systems)
+			if (system.level == level)
+				level_systems.push_back(&system);
+
+		// Not worth going through the job system for a single system.
+		if (level_systems.size() == 1)
+		{
+			execute_system(level_systems[0], dt);
+			continue;
+		}
+
+		Job *root = jobs::create(nullptr);
+		for (System *system : level_systems)
+		{
+			const SystemJobData data = {system, dt};
+			jobs::run(jobs::create_child(root, system_job, &data, sizeof(data)));
+		}
+		jobs::run(root);
+		jobs::wait(root);
+	}
+
+	auto &infos = dgui::State::instance().systems;
+	infos.resize(systems.size());
+	for (usize i = 0; i < systems.size(); i++)
+	{
+		infos[i].name = systems[i].name;
+		infos[i].level = systems[i].level;
+	}
+}
@@ -0,0 +1,41 @@
+#ifndef __SYSTEMS_HPP__
+#define __SYSTEMS_HPP__
+
+#include <vector>
+#include <functional>
+#include "lt_core.hpp"
+
+typedef std::function<void(f64 dt)> SystemFunction;
+
+//
+// A system is a piece of per-tick work that declares which component columns
+// (ComponentKind masks) it reads and writes. Systems whose sets do not conflict
+// are run concurrently by the scheduler.
+//
+struct System
+{
+	const char     *name;
+	u32             reads;
+	u32             writes;
+	SystemFunction  fn;
+	i32             level;
+
+	inline bool conflicts_with(const System &other) const
+	{
+		return (writes & (other.reads | other.writes)) || (other.writes & reads);
+	}
+};
+
+struct SystemScheduler
+{
+	std::vector<System> systems;
+
+	void add(const char *name, u32 reads, u32 writes, const SystemFunction &fn);
+	// Runs all systems, the ones in the same level as jobs in the job system.
+	void run(f64 dt);
+
+private:
+	void build_levels();
+};
+
+#endif // __SYSTEMS_HPP__
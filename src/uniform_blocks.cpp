@@ -0,0 +1,50 @@
+#include "uniform_blocks.hpp"
+#include "glad/glad.h"
+
+const char *const uniform_block_names[UniformBlock_Count] = {
+	"Camera",
+	"Lights",
+	"Settings",
+};
+
+lt_internal const usize uniform_block_sizes[UniformBlock_Count] = {
+	sizeof(CameraBlock),
+	sizeof(LightsBlock),
+	sizeof(SettingsBlock),
+};
+
+UniformBuffers
+create_uniform_buffers()
+{
+	UniformBuffers ub = {};
+	glGenBuffers(UniformBlock_Count, ub.buffers);
+	for (i32 i = 0; i < UniformBlock_Count; i++)
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, ub.buffers[i]);
+		glBufferData(GL_UNIFORM_BUFFER, uniform_block_sizes[i], nullptr, GL_DYNAMIC_DRAW);
+		glBindBufferBase(GL_UNIFORM_BUFFER, i, ub.buffers[i]);
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	return ub;
+}
+
+void
+update_uniform_buffer(const UniformBuffers &ub, UniformBlock block, const void *data, usize size)
+{
+	LT_Assert(size == uniform_block_sizes[block]);
+	glBindBuffer(GL_UNIFORM_BUFFER, ub.buffers[block]);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void
+bind_uniform_blocks(u32 program)
+{
+	for (u32 i = 0; i < UniformBlock_Count; i++)
+	{
+		// Blocks a program does not use are optimized out and have no index.
+		const u32 index = glGetUniformBlockIndex(program, uniform_block_names[i]);
+		if (index != GL_INVALID_INDEX)
+			glUniformBlockBinding(program, index, i);
+	}
+}
@@ -0,0 +1,98 @@
+#ifndef __UNIFORM_BLOCKS_HPP__
+#define __UNIFORM_BLOCKS_HPP__
+
+#include <stddef.h>
+#include "lt_core.hpp"
+#include "lt_math.hpp"
+
+//
+// Mirrors of the std140 uniform blocks declared in resources/uniform_blocks.glsl, which is
+// prepended to every shader. Every program binds each block to the binding point with the
+// same index, so one buffer per block serves all of them.
+//
+#define UNIFORM_BLOCKS_SHADER "uniform_blocks.glsl"
+// Also defined in uniform_blocks.glsl.
+#define MAX_SHADOW_CASCADES 4
+
+enum UniformBlock
+{
+	UniformBlock_Camera,
+	UniformBlock_Lights,
+	UniformBlock_Settings,
+
+	UniformBlock_Count,
+};
+
+// Block names as declared in the shaders, indexed by UniformBlock.
+extern const char *const uniform_block_names[UniformBlock_Count];
+
+// In std140 a vec3 takes the space of a vec4, unless a scalar comes right after it.
+struct CameraBlock
+{
+	Mat4f view;
+	Mat4f projection;
+	Vec3f view_position;
+	f32   _pad0;
+	Vec2f screen_size;
+	f32   _pad1[2];
+	// Takes the NDC of the depth buffer back to world space in the deferred lighting.
+	Mat4f inv_view_projection;
+};
+
+struct DirectionalLightBlock
+{
+	Vec3f direction;
+	f32   _pad0;
+	Vec3f ambient;
+	f32   _pad1;
+	Vec3f diffuse;
+	f32   _pad2;
+	Vec3f specular;
+	f32   _pad3;
+};
+
+struct LightsBlock
+{
+	DirectionalLightBlock dir_light;
+	// Light space of each shadow cascade and the view depth where it ends (see ShadowMap).
+	Mat4f                 light_space[MAX_SHADOW_CASCADES];
+	f32                   cascade_splits[MAX_SHADOW_CASCADES];
+	// Clusters in x, y and z, then the number of point lights (see light_clusters.hpp).
+	u32                   cluster_grid[4];
+	f32                   cluster_depth_scale;
+	f32                   cluster_depth_bias;
+	i32                   num_shadow_cascades;
+	f32                   _pad0;
+};
+
+struct SettingsBlock
+{
+	i32 enable_normal_mapping; // bool
+	f32 pcf_texel_offset;
+	i32 pcf_window_side;
+	i32 _pad0;
+	f32 bloom_threshold;
+	f32 _pad1[3];
+};
+
+static_assert(sizeof(CameraBlock) == 224 && offsetof(CameraBlock, view_position) == 128
+			  && offsetof(CameraBlock, screen_size) == 144 && offsetof(CameraBlock, inv_view_projection) == 160,
+			  "CameraBlock does not match the std140 layout.");
+static_assert(sizeof(LightsBlock) == 368 && offsetof(LightsBlock, cascade_splits) == 320
+			  && offsetof(LightsBlock, cluster_grid) == 336 && offsetof(LightsBlock, num_shadow_cascades) == 360,
+			  "LightsBlock does not match the std140 layout.");
+static_assert(sizeof(SettingsBlock) == 32 && offsetof(SettingsBlock, bloom_threshold) == 16,
+			  "SettingsBlock does not match the std140 layout.");
+
+struct UniformBuffers
+{
+	u32 buffers[UniformBlock_Count];
+};
+
+// Creates a buffer for each block and binds it to the block's binding point.
+UniformBuffers create_uniform_buffers();
+void           update_uniform_buffer(const UniformBuffers &ub, UniformBlock block, const void *data, usize size);
+// Binds the blocks used by the program to their binding points, called after linking it.
+void           bind_uniform_blocks(u32 program);
+
+#endif // __UNIFORM_BLOCKS_HPP__